@@ -1,666 +1,6871 @@
 #include <stdlib.h>    // malloc, realloc, free
 #include <stdio.h>     // fopen, fclose, printf, fprintf, getline
+#include <stdarg.h>    // va_list, for `out_printf`
 #include <string.h>    // strcpy, strcat, strerror, sscanf
 #include <sys/types.h> // Types for system functions
 #include <sys/stat.h>  // stat
 #include <dirent.h>    // opendir, readdir
 #include <errno.h>     // errno
 #include <pthread.h>   // pthread_t, pthread_create, mutex stuff
-#include <time.h>      // time, localtime, strftime
+#include <time.h>      // time, localtime, strftime, clock_gettime
+#include <unistd.h>    // sysconf, write, fdatasync
+#include <fcntl.h>     // open, for the journal, and fcntl
+#include <sys/file.h>  // flock, ditto
+#include <sched.h>     // sched_yield
+#include <sys/uio.h>   // writev
+#include <sys/socket.h> // socket, sendmsg, recvmsg, for shard servers
+#include <sys/un.h>    // sockaddr_un
+#include <sys/syscall.h> // SYS_memfd_create, SYS_io_uring_setup
+#include <poll.h>      // poll
+#include <signal.h>    // sigaction
+#include <sys/mman.h>  // mmap, for the io_uring's rings
+#include <linux/io_uring.h> // io_uring_params, io_uring_sqe, io_uring_cqe
+#include "comitoz.mem.h" // mem_alloc and friends, bool
+#include "comitoz.trace.h" // trace_begin, trace_end
 
 
 // `typedef`s
-typedef enum {false, true} bool; // tfw no C99
-
 typedef enum {START_ROOM, MID_ROOM, END_ROOM} room_type;
 
+#define MAX_CONNECTIONS 6
+#define MAX_ROOM_NAME_LEN 23 // Same as in *.buildrooms.c
+
+// Room names come from a tiny vocabulary (with a number on the end, on big
+// maps), and each one is mentioned by its own room and by every neighbor's.
+// Instead of a heap copy per mention, names are interned: every distinct
+// name is stored once for the whole process, however many maps it turns up
+// in, and everyone else holds on to a `name_id`. Two names are the same iff
+// their ids are, and ids are handed out densely from 0, so they can be used
+// to index arrays as well.
+typedef int name_id;
+
+#define NO_NAME (-1)
+#define NAME_PAGE_SIZE 1024  // Names per page of `NameTable.pages`
+#define NAME_MAX_PAGES 16384 // For at most 16M distinct names
+
+// A slot in `NameIndex`. The hash is kept next to the id so that probing
+// past other names (and growing the table) doesn't have to go and read their
+// text. `id` is stored last, with release order, so whoever sees it set also
+// sees the hash and the name's text.
+typedef struct NameSlot
+{
+    name_id       id;
+    unsigned int  hash;
+} NameSlot;
+
+// Open-addressed hash of ids by text. Growing it makes a new one rather than
+// moving this one, since readers might be partway through a probe; the old
+// ones hang on in `older` until `free_names`, which costs less than the
+// current one (they halve each time).
+typedef struct NameIndex
+{
+    NameSlot*         slots;
+    size_t            cap;
+    struct NameIndex* older;
+} NameIndex;
+
+// Every name gets the same `MAX_ROOM_NAME_LEN + 1` bytes in `pages`, so
+// finding one's text is a bit of arithmetic and a single load. Interning
+// takes `name_table_lock`, but looking up a name doesn't: pages never move
+// once they've been handed out and `index` is only ever swapped for a
+// complete bigger copy, so threads matching what players type against room
+// names don't all queue up on one mutex
+typedef struct NameTable
+{
+    char*      pages[NAME_MAX_PAGES];
+    int        count;
+    NameIndex* index; // Read with acquire order, swapped with release
+} NameTable;
+
+static NameTable       name_table;
+static pthread_mutex_t name_table_lock = PTHREAD_MUTEX_INITIALIZER;
+
 typedef struct Room
 {
     int id;
-    char* name;
-    char* connections[6];
+    name_id name;
+    name_id connections[MAX_CONNECTIONS];
     int connection_count;
     room_type type;
+    char* prompt;      // CURRENT LOCATION ... WHERE TO? >, rendered once
+    size_t prompt_len;
+    bool owns_prompt;  // Otherwise it's in a `RoomCache`'s `prompts`
 } Room;
 
+// Everything the game says in a turn is gathered up here and then written
+// out with a single `write`, instead of trickling out through `printf` and
+// whatever buffering stdio decides on for the kind of file stdout happens
+// to be (line buffered for a TTY, but not for a pipe or socket)
+typedef struct OutBuf
+{
+    int    fd;
+    char*  data;
+    size_t len;
+    size_t cap;
+} OutBuf;
 
-// Forward declarations
-void _Room(Room* room);
+// The compressed adjacency section that buildrooms writes with
+// `--adjacency` (the format is described over there), kept compressed in
+// memory. Finding a room's record takes an offset for its block of
+// `PACKED_BLOCK` rooms plus a 2-byte one within the block (records are
+// tiny), so we can jump straight to any room and decode just that one.
+// `rooms_by_hash` is every room sorted by the hash of its name, which is
+// binary searched to find rooms by name. That's 4 bytes a room, against at
+// least 8 for a hash table half full. Buildrooms prints what it all adds up
+// to, so keep the two in step.
+#define ADJACENCY_FILE_NAME ".adjacency"
+#define ADJACENCY_VERSION 1
+#define PACKED_BLOCK 64
 
-bool spawn_child(pthread_t* thread, pthread_mutex_t* mutex);
+// Just the START_ROOM's name and a '\n', so lazy mode can start without
+// walking the directory. Same as in *.buildrooms.c
+#define START_FILE_NAME ".start"
 
-void try_to_write_date(void* mutex_ptr);
+typedef struct PackedMap
+{
+    int             room_count;
+    unsigned char*  bytes;         // The whole file
+    size_t          bytes_len;
+    size_t*         block_offsets; // Into `bytes`, one per `PACKED_BLOCK`
+    unsigned short* room_offsets;  // From the start of the room's block
+    int*            rooms_by_hash;
+} PackedMap;
 
-bool get_fresh_dir_path(char* path_buffer);
+// For sorting `PackedMap.rooms_by_hash`
+typedef struct PackedNameKey
+{
+    unsigned int hash;
+    int          room;
+} PackedNameKey;
 
-int parse_room_dir(const char* dir_path, Room** room_buffer, int max_rooms);
+// Bounded least-recently-used pile of parsed `Room`s. In lazy mode, rooms get
+// pulled in from `dir_path` (or decoded from `packed`) as the player wanders
+// into them and the stalest one is kicked out once we hit `capacity`. In
+// eager mode the whole map is loaded up front into a cache that's exactly big
+// enough, so nothing ever gets evicted and both sources are `NULL`
+typedef struct RoomCache
+{
+    const char*      dir_path;
+    const PackedMap* packed;
+    Room**           rooms;
+    unsigned long*   last_used; // Parallel to `rooms`
+    int              capacity;
+    int              count;
+    unsigned long    clock;     // Ticks once per lookup
+    int              next_id;
+    char*            prompts;   // Every room's prompt, back to back (eager)
+    int              room_count; // In the whole map, or 0 if we don't know
+    char             map_kind;   // 'T'ext or 'P'acked, for checkpoints
+    unsigned long    map_hash;   // Fingerprint of the map, ditto
+    int*             slot_of_name; // Index into `rooms` by `name_id`, -1 for
+    int              slot_of_name_len; // rooms that aren't here
+} RoomCache;
 
-Room* parse_file(FILE* file_handle, int room_id, bool* parse_succeeded);
+// Where the player has been, as names (for the victory lap) and as room ids
+// (for checkpoints). Ids are only meaningful when the cache knows the whole
+// map, i.e. not in lazy mode
+typedef struct PathHistory
+{
+    name_id* names;
+    int*   ids;
+    int    len;
+    int    cap;
+} PathHistory;
 
-const char* room_type_to_str(room_type rt);
+// A checkpoint is "CSAV", a u8 version, a u8 map kind, the u64 map hash
+// (little endian), and then varints: the room count, the current room, the
+// path length and the path itself, each step as a zigzagged delta from the
+// step before it (the first one from 0). It's all written in one go and
+// read back without replaying a single move.
+#define CHECKPOINT_VERSION 1
+#define DEFAULT_CHECKPOINT_PATH "comitoz.checkpoint"
 
-int game_loop(
-    Room**           room_buffer,
-    int              room_count,
-    Room*            current_room,
-    pthread_mutex_t* mutex,
-    pthread_t*       child
-);
+// One player's game, which is everything the engine needs to take a step.
+// Nothing in here knows about stdin, stdout or the time thread, so it can be
+// driven by whatever is on the other end (a terminal, a socket, a simulator).
+// Any number of these can share a `RoomCache`, even a bounded one (--lazy or
+// --compressed) that might evict one session's room while loading another's:
+// the current room is held by name, and `session_room` looks it up (or loads
+// it back) whenever the engine needs the `Room` itself.
+typedef struct Session
+{
+    RoomCache*  rooms;
+    name_id     current_room;
+    PathHistory path;
+    int         turns; // Commands taken so far
+    bool        won;
+    unsigned int id;   // Who this is, in the journal
+} Session;
 
+// What a step did. The ones that need the outside world (the clock, the
+// disk) are handed back to whoever is driving the session to deal with
+typedef enum
+{
+    STEP_MOVED,
+    STEP_UNKNOWN,
+    STEP_TIME,
+    STEP_SAVE,
+    STEP_LOAD,
+    STEP_WON,
+    STEP_ERROR,
+    STEP_MEMORY, // Appended, since journals store these
+    STEP_OVER    // Nothing to do, the game was already won
+} step_code;
 
-// `free`s memory owned by a `Room`, basically a glorified destructor
-void _Room(Room* room)
+typedef struct StepResult
 {
-    free(room->name);
+    step_code   code;
+    const char* arg; // The checkpoint path, for `STEP_SAVE` and `STEP_LOAD`
+} StepResult;
 
-    int i;
-    for (i = 0; i < room->connection_count; ++i)
-    {
-        free(room->connections[i]);
-    }
-}
+// The journal is "CJNL", a u8 version, a u8 record size and two bytes of
+// padding, and then one `JournalRecord` per command, in host byte order.
+// Names are fixed size (and zero padded) since lazy maps don't have ids, and
+// commands longer than the field are cut short. *.journal.c reads these.
+#define JOURNAL_VERSION 1
+#define JOURNAL_RING_SIZE 4096    // Records, and it has to be a power of two
+#define JOURNAL_INTERVAL_NS 10000000L // How long the writer naps, 10ms
+#define JOURNAL_RETRIES 100 // Intervals a batch gets to make it to disk
+#define JOURNAL_COMMAND_LEN 32
 
-// Spawns the child thread, giving it the mutex and returning `false` in case
-// of failure.
-bool spawn_child(pthread_t* thread, pthread_mutex_t* mutex)
+typedef struct JournalRecord
 {
-    // No options, just pass the mutex so we don't have to keep it as a global
-    // variable
-    int thread_spawn_result = pthread_create(
-        thread,
-        NULL,
-        try_to_write_date,
-        (void*) mutex
-    );
-    if (thread_spawn_result != 0)
-    {
-        fprintf(
-            stderr,
-            "Failed to spawn child thread, result code: %d\n",
-            thread_spawn_result
-        );
-        return false;
-    }
+    unsigned long timestamp_ns;  // Wall clock
+    unsigned int  session;
+    unsigned char code;          // A `step_code`
+    unsigned char padding[3];
+    char          from[MAX_ROOM_NAME_LEN + 1];
+    char          to[MAX_ROOM_NAME_LEN + 1]; // Same as `from` if we didn't move
+    char          command[JOURNAL_COMMAND_LEN];
+} JournalRecord;
 
-    return true;
-}
+// The game thread appends records to `ring` and bumps `head`. The writer
+// thread wakes up every interval, writes out everything between `tail` and
+// `head` with one `writev` and one `fdatasync`, and then bumps `tail`. Each
+// side only ever stores its own counter, so no locks are needed. They sit on
+// separate cache lines so that they don't fight over one. A batch that won't
+// go out is retried for a while, and then the writer gives up and sets
+// `failed`, which appends check so they don't wait on a ring nobody drains
+typedef struct Journal
+{
+    JournalRecord* ring;
+    int            fd;
+    pthread_t      writer;
+    unsigned long  stalls; // How many appends found the ring full and waited
+    unsigned long  head __attribute__((aligned(64)));
+    unsigned long  tail __attribute__((aligned(64)));
+    int            stopping;
+    int            failed;
+} Journal;
 
-// This is the entry point/environment for the single child thread of this
-// program. It waits for the main thread to unlock the given mutex and then
-// greedily writes the current time to a file that the main thread can then
-// read.
-void try_to_write_date(void* mutex_ptr)
+// `--partition K` splits a map into K shards and writes down which room
+// went where in `.shards`: "CSHD", a u8 version, then varints for the shard
+// count, the room count and the START_ROOM's index, and then one record per
+// room in name order, which is a u8 shard and the NUL terminated name. Shard
+// servers keep the whole (small) table in memory and load rooms lazily.
+#define SHARD_FILE_NAME ".shards"
+#define SHARD_VERSION 1
+#define MAX_SHARDS 255 // Shards are stored as bytes
+
+typedef struct ShardTable
 {
-    pthread_mutex_t* mutex = (pthread_mutex_t*) mutex_ptr;
+    int            shard_count;
+    int            room_count;
+    int            start_room;   // Index into the table
+    unsigned char* bytes;        // The whole file
+    size_t*        name_offsets; // Into `bytes`, in name order
+} ShardTable;
 
-    // Waiting for the parent thread to let us do the thing
-    pthread_mutex_lock(mutex);
+// A player connected to a shard server. Their socket doesn't block, so whatever it won't take
+// yet waits in `output`, and we don't read anything more from them until
+// it's all gone: one player who stops reading can't hold up everybody else
+// on the shard, and can't make us buffer without end either.
+typedef struct ShardClient
+{
+    int     fd;
+    Session session;
+    char*   input;      // What they've typed that we haven't handled yet
+    size_t  input_len;
+    size_t  input_cap;
+    OutBuf  output;     // Replies their socket hasn't taken yet
+    bool    typed_ahead; // Came in with `input`, so don't wait for `poll`
+    bool    closing;    // Done with, once `output` drains
+} ShardClient;
 
-    // We got the lock, so it's time to write the time to a file.
-    // First, let's get the date as a string
-    time_t current_timestamp = time(NULL);
-    struct tm* time_struct = localtime(&current_timestamp);
+// One process serving one shard. Players connect to `listen_fd`. When one of
+// them walks into another shard, their socket is handed over to that
+// shard's server, along with their session, by sending both fds (SCM_RIGHTS)
+// to its `handoff_fd`. The player's connection doesn't notice a thing.
+typedef struct ShardServer
+{
+    int               shard;
+    const ShardTable* table;
+    RoomCache*        rooms;
+    const char*       socket_dir;
+    int               listen_fd;
+    int               handoff_fd; // Unix datagrams from the other shards
+    ShardClient**     clients;
+    int               client_count;
+    int               client_cap;
+    unsigned long     handoffs_in;
+    unsigned long     handoffs_out;
+} ShardServer;
 
-    char time_str[64];
-    strftime(time_str, 64, "%I:%M%p, %A, %B %e, %Y", time_struct);
-    // The above ALMOST works, except that %p prints in uppercase and
-    // %I is zero-padded (not space-padded). So, in lieu of fixing that
-    time_str[0] = ' ';
-    if (time_str[5] == 'A') // AM
-    {
-        time_str[5] = 'a';
-    }
-    else                    // PM
-    {
-        time_str[5] = 'p';
-    }
-    time_str[6] = 'm';
+#define SHARD_MAX_INPUT 4096 // Longest line a client can send us
+#define HANDOFF_RETRY_MS 1   // How long to wait on a full handoff queue
+#define HANDOFF_TRIES 5000   // before trying again, and how many times
 
-    // Alright, now we write
-    FILE* time_file = fopen("currentTime.txt", "w");
-    if (time_file == NULL)
-    {
-        fprintf(
-            stderr,
-            "Failed to open currentTime.txt for writing. errno: %s\n",
-            strerror(errno)
-        );
+// Set by SIGINT and SIGTERM, so the server can clean up its sockets
+static volatile sig_atomic_t shard_server_stopping = 0;
 
-        exit(2); // Exit the program with extreme violence, no mercy, and
-                 // no cleanup
-    }
+// The whole map as a structure of arrays, for when we want to actually walk
+// the graph (simulations, analysis, benchmarks) instead of poking at a room
+// at a time. Room `i` is index `i` into everything, and neighbors are
+// `MAX_CONNECTIONS` `int` slots per room, so a traversal reads a few dense
+// arrays front to back instead of chasing `Room*`s around the heap. Since
+// name ids are dense, finding a room by name is just an index too.
+typedef struct MapStore
+{
+    int            room_count;
+    unsigned char* types;        // Really `room_type`s, but those are 4 bytes
+    unsigned char* degrees;
+    name_id*       names;
+    int*           neighbors;
+    int*           room_of_name; // By `name_id`, -1 for other maps' names
+    int            room_of_name_len;
+} MapStore;
 
-    fprintf(time_file, "%s", time_str);
+// Command line knobs
+typedef struct Options
+{
+    bool        lazy;
+    bool        compressed;
+    int         cache_size;
+    bool        bench;
+    bool        check;
+    int         threads;  // For `--check`
+    const char* dir_path; // `NULL` means the freshest one
+    const char* resume_path;
+    const char* journal_path; // `NULL` means no journal
+    int         partition_shards; // For `--partition`, 0 if we aren't
+    int         serve_shard;      // For `--serve`, -1 if we aren't
+    const char* socket_dir;       // Where shard servers put their sockets
+    const char* connect_path;     // `--connect`, to play on a shard server
+    bool        mem_report;       // Print `format_mem_report` at exit
+    const char* trace_path;       // `--trace`, or `NULL` for no trace
+    bool        no_uring;         // Read room files without io_uring
+    bool        machine;          // Speak `machine_loop`'s protocol
+} Options;
 
-    fclose(time_file);
+// A slice of the work for one `--check` thread. Each thread gets its own
+// range of rooms, first for parsing and then for checking connections, and
+// counts up whatever it finds wrong
+typedef struct CheckJob
+{
+    const char*     dir_path;
+    char**          file_names;
+    Room**          rooms;
+    const MapStore* store;
+    int             first; // Rooms [first, last)
+    int             last;
+    long            problems;
+} CheckJob;
 
-    // We're done, so we can cede control back to the parent thread by
-    // releasing the mutex
-    pthread_mutex_unlock(mutex);
-}
+// Loading a whole text map is an open, a few reads and a close per room
+// file, and on a cold cache every one of those waits on the disk. So
+// `parse_room_dir` hands them to an io_uring when it can: each file gets an
+// open, a read and a close, linked so the kernel runs them back to back
+// without coming back to us in between, and `URING_SLOTS` files are in
+// flight at once. Files are opened straight into the ring's own file table
+// (slot `i` is file index `i`), which is what lets the read use the file
+// before we've ever seen a descriptor for it. There's no liburing around,
+// so this is the raw system calls and the rings they share with the kernel.
+// Anything the ring can't do (no io_uring at all, an old kernel, a file too
+// big for its buffer) is left to the regular `fopen` path.
+#define URING_SLOTS 256    // Room files in flight at once
+#define URING_ENTRIES 1024 // Submission queue, with three entries per slot
+#define ROOM_FILE_MAX 4096 // Buffer per slot, far more than a room file needs
 
-// Get path of most recently modified room file directory. `false` signifies
-// failure.
-bool get_fresh_dir_path(char* path_buffer)
+// What a completion was for, in the low bits of its `user_data`
+#define URING_OPEN 0
+#define URING_READ 1
+#define URING_CLOSE 2
+#define URING_OPS 3 // Completions per file
+
+typedef struct RoomRing
 {
-    const char* dir_prefix = "comitoz.rooms.";
-    const int dir_prefix_len = 14;
+    int                  fd;
+    void*                sq_ring;
+    size_t               sq_ring_len;
+    void*                cq_ring; // The same mapping as `sq_ring` on any
+    size_t               cq_ring_len; // kernel that's had io_uring for long
+    struct io_uring_sqe* sqes;
+    size_t               sqes_len;
+    unsigned int*        sq_tail;
+    unsigned int*        sq_mask;
+    unsigned int*        cq_head;
+    unsigned int*        cq_tail;
+    unsigned int*        cq_mask;
+    struct io_uring_cqe* cqes;
+    unsigned int         queued;  // Entries written since the last submit
+} RoomRing;
 
-    DIR* cwd = opendir(".");
-    if (cwd == NULL)
-    {
-        fprintf(
-            stderr,
-            "opendir(\".\") failed with: \"%s\"\n",
-            strerror(errno)
-        );
+static bool uring_disabled = false; // `--no-uring`
 
-        return false;
-    }
+#define DEFAULT_CACHE_SIZE 64
+#define BENCH_WORK 10000000 // Rooms visited per benchmark
+#define MACHINE_MAX_INPUT 4096 // Bytes of `--machine` requests read at once
 
-    struct stat sb;
-    time_t freshest_path_time = 0;
 
-    // Loop over the entities in the current dir
-    struct dirent* entity = readdir(cwd);
-    while (entity != NULL)
-    {
-        // Check to see if the entity's name starts with "comitoz.rooms."
-        char* entity_name = entity->d_name;
-        bool matching_prefix = true;
-        int i;
-        for (i = 0; i < dir_prefix_len; ++i)
-        {
-            if (entity_name[i] == '\0' || entity_name[i] != dir_prefix[i])
-            {
-                matching_prefix = false;
+// Forward declarations
+void _Room(Room* room);
 
-                break;
-            }
-        }
+name_id intern_name(const char* name);
 
-        if (matching_prefix)
-        {
-            if (stat(entity_name, &sb) == -1)
-            {
-                fprintf(
-                    stderr,
-                    "stat(%s, &sb) failed with: \"%s\"\n",
-                    entity_name,
-                    strerror(errno)
-                );
+name_id find_name(const char* name);
 
-                closedir(cwd);
+name_id lookup_name(const char* name, bool insert);
 
-                return false;
-            }
+name_id probe_names(const char* name, unsigned int hash);
 
-            // Accumulate on the largest time (i.e. most recent)
-            time_t last_time = sb.st_mtime;
-            if (last_time > freshest_path_time)
-            {
-                freshest_path_time = last_time;
-                strcpy(path_buffer, entity_name);
-            }
-        }
+name_id add_name(const char* name, size_t len, unsigned int hash);
 
-        // Get the next entity
-        entity = readdir(cwd);
-    }
+bool grow_name_index(void);
 
-    // Free directory resource
-    closedir(cwd);
+const char* name_text(name_id id);
 
-    if (freshest_path_time == 0)
-    {
-        fprintf(
-            stderr,
-            "Did not find any directories of the form `comitoz.rooms.*` in the current dir\n"
-        );
+void free_names(void);
 
-        return false;
-    }
+bool parse_args(int argc, char* argv[], Options* options);
 
-    return true;
-}
+bool init_room_cache(
+    RoomCache*       cache,
+    const char*      dir_path,
+    const PackedMap* packed,
+    int              capacity
+);
 
-// Read directory for room files and parse each one into a `Room`.
-// This returns the numebr of `Room`s that were parsed, or -1 on failure.
-int parse_room_dir(const char* dir_path, Room** room_buffer, int max_rooms)
-{
-    DIR* dir = opendir(dir_path);
-    if (dir == NULL)
-    {
-        fprintf(
-            stderr,
-            "opendir(\"%s\") failed with: \"%s\"\n",
-            dir_path,
-            strerror(errno)
-        );
+void _RoomCache(RoomCache* cache);
 
-        return -1;
-    }
+Room* cache_lookup(RoomCache* cache, name_id name);
 
-    int parsed_room_count = 0;
-    char rel_path_buffer[256];
+Room* cache_insert(RoomCache* cache, Room* room);
 
-    // Snoop this directory looking for any files in it
-    struct dirent* entity = readdir(dir);
-    while (entity != NULL && parsed_room_count < max_rooms)
-    {
-        char* entity_name = entity->d_name;
-        // We assume all files in the folder are map files, but we still have
-        // to filter out the . and .. directories
-        if (entity_name[0] == '.')
-        {
-            entity = readdir(dir);
-            continue;
-        }
+Room* get_room(RoomCache* cache, name_id name);
 
-        // Get the relative path, not just the filename
-        strcpy(rel_path_buffer, dir_path);
-        strcat(rel_path_buffer, "/");
-        strcat(rel_path_buffer, entity_name);
+Room* find_start_room(RoomCache* cache);
 
-        FILE* file_handle = fopen(rel_path_buffer, "r");
-        if (file_handle == NULL)
-        {
-            fprintf(
-                stderr,
-                "fopen(\"%s\", \"r\") failed with: \"%s\"\n",
-                rel_path_buffer,
-                strerror(errno)
-            );
+Room* load_room_file(const char* path, int room_id);
 
-            closedir(dir); // Always clean up after yourself,
-                           // and eat your vegetables
+size_t render_prompt(const Room* room, char* buffer);
 
-            return -1;
-        }
+bool render_prompts(RoomCache* cache);
 
-        bool parse_succeeded = true;
-        Room* parsed_room = parse_file( // Pass the actual parsing off to
-            file_handle,                // another function
-            parsed_room_count,
-            &parse_succeeded
-        );
-        if (!parse_succeeded) // D'oh
-        {
-            fprintf(stderr, "Parse failure was in %s\n", rel_path_buffer);
+bool init_out_buf(OutBuf* out, int fd);
 
-            closedir(dir); // Stay clean, even in emergencies
+void _OutBuf(OutBuf* out);
 
-            return -1;
-        }
-        room_buffer[parsed_room_count] = parsed_room; // Now the caller's
-        parsed_room_count++;                          // neat little array
-                                                      // to all the `Room`s
-                                                      // we're parsing
-        fclose(file_handle);
+bool out_reserve(OutBuf* out, size_t len);
 
-        entity = readdir(dir);
-    }
+void out_append(OutBuf* out, const char* data, size_t len);
 
-    closedir(dir); // If you love it, set it free
+void out_printf(OutBuf* out, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
 
-    return parsed_room_count;
-}
+bool out_flush(OutBuf* out);
 
-// Use file handle to parse file contents into a `Room*`. Caller must `free`
-// the returned pointer
-Room* parse_file(FILE* file_handle, int room_id, bool* parse_succeeded)
-{
-    char* line = NULL;
-    size_t getline_buffer_len = 0;
+bool out_send(OutBuf* out);
 
-    // Initialize `Room` to be returned
-    Room* room = malloc(sizeof(Room));
-    room->id = room_id;
-    room->name = malloc(20 * sizeof(char));
-    room->connection_count = 0;
+unsigned long hash_name(const char* name);
 
-    // Parsing state
-    bool got_name = false;
+bool build_map_store(
+    Room**    room_buffer,
+    int       room_count,
+    bool      allow_dangling,
+    MapStore* store
+);
 
-    ssize_t chars_read = getline(&line, &getline_buffer_len, file_handle);
-    while (chars_read != -1)
-    {
-        if (chars_read == 0)
-        {
-            // Ignore empty lines
-            chars_read = getline(&line, &getline_buffer_len, file_handle);
+void _MapStore(MapStore* store);
 
-            continue;
-        }
+int find_room_index(const MapStore* store, name_id name);
 
-        // Classic `sscanf`. This relies on the format to not incur buffer
-        // overflow, so uh, make sure no one tampered with your room
-        // files since you last checked.
-        char second_token[6];
-        char property_value[20];
-        int sscanf_result = sscanf(
-            line,
-            "%*s %s %s\n",
-            second_token, property_value
-        );
-        if (sscanf_result == 2)
-        {
-            // We only need the first character of the second token of the
-            // property name to distinguish them due to the format
-            switch (second_token[0])
-            {
-                case 'N': // ROOM NAME: ...
-                {
-                    if (got_name)
-                    {
-                        _Room(room);
-                        fprintf(
-                            stderr,
-                            "Parsing failed: saw 'N' but already parsed ROOM NAME\n"
-                        );
-                        *parse_succeeded = false;
+double elapsed_ms(const struct timespec* start);
 
-                        return room;
-                    }
+void swap_connection_ids(
+    Room**          room_buffer,
+    int             room_count,
+    const MapStore* store,
+    bool            to_indices
+);
 
-                    strcpy(room->name, property_value);
-                    got_name = true;
-                    break;
+void run_benchmarks(
+    Room**           room_buffer,
+    int              room_count,
+    const MapStore*  store,
+    const PackedMap* packed
+);
+
+bool get_varint(
+    const unsigned char* bytes,
+    size_t               bytes_len,
+    size_t*              pos,
+    unsigned long*       value
+);
+
+bool load_packed_map(const char* dir_path, PackedMap* map);
+
+void _PackedMap(PackedMap* map);
+
+size_t packed_offset(const PackedMap* map, int room);
+
+unsigned int packed_name_hash(const PackedMap* map, int room);
+
+int compare_packed_keys(const void* a, const void* b);
+
+int packed_neighbors(const PackedMap* map, int room, int* neighbors);
+
+int find_packed_room(const PackedMap* map, const char* name);
+
+Room* room_from_packed(const PackedMap* map, int room);
+
+void* check_parse_worker(void* job_ptr);
+
+void* check_connections_worker(void* job_ptr);
+
+long run_check_threads(
+    CheckJob* jobs,
+    int       threads,
+    void*     (*worker)(void*)
+);
+
+int check_map(const char* dir_path, int threads);
+
+bool spawn_child(pthread_t* thread, pthread_mutex_t* mutex);
+
+void try_to_write_date(void* mutex_ptr);
+
+bool get_fresh_dir_path(char* path_buffer);
+
+int list_room_files(const char* dir_path, char*** file_names);
+
+void _FileNames(char** file_names, int file_count);
+
+int parse_room_dir(const char* dir_path, Room*** room_buffer);
+
+Room* parse_room_text(char* text, size_t len, int room_id);
+
+bool open_room_ring(RoomRing* ring);
+
+bool probe_fixed_open(RoomRing* ring);
+
+void _RoomRing(RoomRing* ring);
+
+struct io_uring_sqe* ring_next_sqe(RoomRing* ring);
+
+int ring_submit(RoomRing* ring, unsigned int wait);
+
+bool ring_complete_one(RoomRing* ring, int* res);
+
+void queue_room_file(
+    RoomRing*   ring,
+    int         dir_fd,
+    const char* file_name,
+    int         slot,
+    char*       buffer
+);
+
+bool load_rooms_uring(
+    const char* dir_path,
+    char**      file_names,
+    int         file_count,
+    Room**      rooms,
+    bool*       parsed
+);
+
+int compare_room_names(const void* a, const void* b);
+
+unsigned long hash_bytes(unsigned long hash, const void* data, size_t len);
+
+unsigned long hash_rooms(Room** room_buffer, int room_count);
+
+Room* get_room_by_id(RoomCache* cache, int id);
+
+name_id get_room_name_by_id(const RoomCache* cache, int id);
+
+void init_path_history(PathHistory* path);
+
+void _PathHistory(PathHistory* path);
+
+bool path_push(PathHistory* path, name_id name, int id);
+
+size_t put_varint(unsigned char* buffer, unsigned long value);
+
+bool save_checkpoint(
+    const char*        file_path,
+    const RoomCache*   cache,
+    const Room*        current_room,
+    const PathHistory* path
+);
+
+Room* load_checkpoint(
+    const char*  file_path,
+    RoomCache*   cache,
+    PathHistory* path
+);
+
+Room* parse_file(FILE* file_handle, int room_id, bool* parse_succeeded);
+
+const char* room_type_to_str(room_type rt);
+
+void init_session(Session* session, RoomCache* rooms, const Room* start_room);
+
+Room* session_room(const Session* session);
+
+void _Session(Session* session);
+
+bool engine_render(const Session* session, OutBuf* out);
+
+void engine_move(Session* session, Room* next_room, StepResult* result);
+
+void engine_step(
+    Session*    session,
+    const char* command,
+    StepResult* result,
+    OutBuf*     out
+);
+
+bool engine_save(Session* session, const char* file_path, OutBuf* out);
+
+bool engine_load(Session* session, const char* file_path, OutBuf* out);
+
+bool open_journal(Journal* journal, const char* file_path);
+
+void close_journal(Journal* journal);
+
+void* journal_writer(void* journal_ptr);
+
+ssize_t write_journal_batch(
+    const Journal* journal,
+    unsigned long  tail,
+    unsigned long  head,
+    size_t         skip
+);
+
+bool journal_append(
+    Journal*    journal,
+    unsigned int session,
+    step_code   code,
+    const char* from,
+    const char* to,
+    const char* command
+);
+
+int* partition_map(const MapStore* store, int shard_count, int start_room);
+
+long count_cut_edges(const MapStore* store, const int* shard_of);
+
+int run_partition(const char* dir_path, int shard_count);
+
+bool load_shard_table(const char* dir_path, ShardTable* table);
+
+void _ShardTable(ShardTable* table);
+
+int find_shard(const ShardTable* table, const char* name);
+
+void shard_socket_path(
+    char*       buffer,
+    const char* socket_dir,
+    int         shard,
+    const char* kind
+);
+
+bool open_shard_server(ShardServer* server);
+
+ShardClient* add_shard_client(ShardServer* server, int fd, Room* room);
+
+void drop_shard_client(ShardServer* server, int index);
+
+bool hand_off_client(
+    ShardServer* server,
+    int          fd,
+    name_id      room_name,
+    const Session* session,
+    const char*  pending,
+    size_t       pending_len,
+    const OutBuf* unsent
+);
+
+bool send_client_output(ShardServer* server, int index);
+
+void receive_handoff(ShardServer* server);
+
+bool serve_client_input(ShardServer* server, int index);
+
+void accept_shard_client(ShardServer* server);
+
+void stop_shard_server(int signal_number);
+
+int run_shard_server(const char* dir_path, const Options* options);
+
+int run_shard_client(const char* socket_path);
+
+void format_current_time(char* buffer);
+
+int game_loop(
+    RoomCache*       rooms,
+    Room*            current_room,
+    const char*      resume_path,
+    Journal*         journal,
+    pthread_mutex_t* mutex,
+    pthread_t*       child
+);
+
+int neighbor_ids(
+    const RoomCache* cache,
+    const MapStore*  store,
+    const Room*      room,
+    int*             ids
+);
+
+int machine_report(
+    const Session*  session,
+    const MapStore* store,
+    int*            ids,
+    OutBuf*         out
+);
+
+bool machine_step(
+    Session*        session,
+    const MapStore* store,
+    int*            ids,
+    int*            degree,
+    char*           line,
+    Journal*        journal,
+    OutBuf*         out
+);
+
+int machine_loop(
+    RoomCache*      rooms,
+    Room*           current_room,
+    const MapStore* store,
+    const char*     resume_path,
+    Journal*        journal
+);
+
+
+// `free`s memory owned by a `Room`, basically a glorified destructor
+void _Room(Room* room)
+{
+    // Names are interned, so they aren't ours to free
+    if (room->owns_prompt)
+    {
+        mem_free(room->prompt);
+    }
+}
+
+// Fill `options` from the command line, returning `false` (after complaining)
+// if we got something we don't understand
+bool parse_args(int argc, char* argv[], Options* options)
+{
+    options->lazy = false;
+    options->compressed = false;
+    options->cache_size = DEFAULT_CACHE_SIZE;
+    options->bench = false;
+    options->check = false;
+    options->threads = 0;
+    options->dir_path = NULL;
+    options->resume_path = NULL;
+    options->journal_path = NULL;
+    options->partition_shards = 0;
+    options->serve_shard = -1;
+    options->socket_dir = ".";
+    options->connect_path = NULL;
+    options->mem_report = false;
+    options->trace_path = NULL;
+    options->no_uring = false;
+    options->machine = false;
+
+    int i;
+    for (i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--lazy") == 0)
+        {
+            options->lazy = true;
+        }
+        else if (strcmp(argv[i], "--compressed") == 0)
+        {
+            options->compressed = true;
+        }
+        else if (strcmp(argv[i], "--bench") == 0)
+        {
+            options->bench = true;
+        }
+        else if (strcmp(argv[i], "--check") == 0)
+        {
+            options->check = true;
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            options->threads = atoi(argv[++i]);
+            if (options->threads < 1)
+            {
+                fprintf(stderr, "--threads must be at least 1\n");
+
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+        {
+            options->dir_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--resume") == 0 && i + 1 < argc)
+        {
+            options->resume_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--journal") == 0 && i + 1 < argc)
+        {
+            options->journal_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--partition") == 0 && i + 1 < argc)
+        {
+            options->partition_shards = atoi(argv[++i]);
+            if (
+                options->partition_shards < 1 ||
+                options->partition_shards > MAX_SHARDS
+            ) {
+                fprintf(stderr, "--partition takes 1 to %d shards\n",
+                        MAX_SHARDS);
+
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+        {
+            options->serve_shard = atoi(argv[++i]);
+            if (options->serve_shard < 0)
+            {
+                fprintf(stderr, "--serve takes a shard number\n");
+
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--socket-dir") == 0 && i + 1 < argc)
+        {
+            options->socket_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc)
+        {
+            options->connect_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--mem-report") == 0)
+        {
+            options->mem_report = true;
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+            options->trace_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-uring") == 0)
+        {
+            options->no_uring = true;
+        }
+        else if (strcmp(argv[i], "--machine") == 0)
+        {
+            options->machine = true;
+        }
+        else if (strcmp(argv[i], "--mem-budget") == 0 && i + 1 < argc)
+        {
+            if (!parse_mem_budget(argv[++i]))
+            {
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc)
+        {
+            options->cache_size = atoi(argv[++i]);
+            if (options->cache_size < 2) // The room we're in plus the room
+            {                            // we're going to, at the very least
+                fprintf(stderr, "--cache-size must be at least 2\n");
+
+                return false;
+            }
+        }
+        else
+        {
+            fprintf(
+                stderr,
+                "Unrecognized argument: %s\n"
+                "Usage: %s [--dir DIR] [--lazy | --compressed] [--cache-size N]\n"
+                "       [--resume CHECKPOINT] [--journal FILE] [--bench]\n"
+                "       [--check [--threads N]] [--partition K]\n"
+                "       [--serve SHARD [--socket-dir DIR]] [--connect SOCKET]\n"
+                "       [--mem-report] [--mem-budget CATEGORY=BYTES]...\n"
+                "       [--trace FILE] [--no-uring] [--machine]\n",
+                argv[i],
+                argv[0]
+            );
+
+            return false;
+        }
+    }
+
+    if ((options->bench || options->check) &&
+        (options->lazy || options->compressed))
+    {
+        fprintf(
+            stderr,
+            "--bench and --check load the whole map themselves, so leave off "
+            "--lazy and --compressed\n"
+        );
+
+        return false;
+    }
+    if (options->threads == 0)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        options->threads = cores < 1 ? 1 : (int) cores;
+    }
+    if (options->lazy && options->compressed)
+    {
+        fprintf(stderr, "Pick one of --lazy and --compressed\n");
+
+        return false;
+    }
+    if (
+        options->serve_shard != -1 &&
+        (options->compressed || options->resume_path != NULL)
+    ) {
+        fprintf(
+            stderr,
+            "Shard servers load rooms lazily, so no --compressed or --resume\n"
+        );
+
+        return false;
+    }
+    if (options->lazy && options->resume_path != NULL)
+    {
+        fprintf(stderr, "--lazy maps don't have room ids, so no --resume\n");
+
+        return false;
+    }
+    if (options->machine && (options->lazy || options->serve_shard != -1))
+    {
+        fprintf(
+            stderr,
+            "--machine talks in room ids, which --lazy maps (and shard "
+            "servers) don't have\n"
+        );
+
+        return false;
+    }
+
+    return true;
+}
+
+// The id of `name`, interning it first if nobody has before. `NO_NAME` if it
+// can't be a room name (empty, or too long), or if we're out of memory
+name_id intern_name(const char* name)
+{
+    return lookup_name(name, true);
+}
+
+// Like `intern_name`, but only for names that are already interned, so that
+// matching whatever the player typed against room names can't grow the table
+name_id find_name(const char* name)
+{
+    return lookup_name(name, false);
+}
+
+// Look `name` up in `name_table`, and add it if it's missing and we're told
+// to `insert` it. Only adding takes the lock
+name_id lookup_name(const char* name, bool insert)
+{
+    size_t len = strlen(name);
+    if (len == 0 || len > MAX_ROOM_NAME_LEN)
+    {
+        return NO_NAME;
+    }
+
+    unsigned int hash = (unsigned int) hash_name(name);
+    name_id id = probe_names(name, hash);
+    if (id == NO_NAME && insert)
+    {
+        pthread_mutex_lock(&name_table_lock);
+        // Somebody might have added it since we looked
+        id = probe_names(name, hash);
+        if (id == NO_NAME)
+        {
+            id = add_name(name, len, hash);
+        }
+        pthread_mutex_unlock(&name_table_lock);
+    }
+
+    return id;
+}
+
+// Find `name` (which hashes to `hash`) in the current `name_table.index`,
+// without locking. `NO_NAME` if it isn't there
+name_id probe_names(const char* name, unsigned int hash)
+{
+    const NameIndex* index = __atomic_load_n(&name_table.index,
+                                             __ATOMIC_ACQUIRE);
+    if (index == NULL)
+    {
+        return NO_NAME;
+    }
+
+    size_t mask = index->cap - 1;
+    size_t slot = hash & mask;
+    name_id id;
+    while (
+        (id = __atomic_load_n(&index->slots[slot].id, __ATOMIC_ACQUIRE)) !=
+        NO_NAME
+    ) {
+        if (
+            index->slots[slot].hash == hash &&
+            strcmp(name_text(id), name) == 0
+        ) {
+            return id;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    return NO_NAME;
+}
+
+// Give `name` (which we know isn't interned yet) the next id. The caller
+// holds `name_table_lock`
+name_id add_name(const char* name, size_t len, unsigned int hash)
+{
+    name_id id = name_table.count;
+    int page = id / NAME_PAGE_SIZE;
+    if (page == NAME_MAX_PAGES)
+    {
+        fprintf(stderr, "More than %d room names, that's too many\n",
+                NAME_MAX_PAGES * NAME_PAGE_SIZE);
+
+        return NO_NAME;
+    }
+
+    // Keep the hash table at most half full so probes stay short
+    if (
+        (name_table.index == NULL ||
+         2 * (size_t) (id + 1) > name_table.index->cap) &&
+        !grow_name_index()
+    ) {
+        return NO_NAME;
+    }
+    if (name_table.pages[page] == NULL)
+    {
+        name_table.pages[page] = mem_alloc(
+            MEM_STRINGS,
+            NAME_PAGE_SIZE * (MAX_ROOM_NAME_LEN + 1) * sizeof(char)
+        );
+        if (name_table.pages[page] == NULL)
+        {
+            return NO_NAME;
+        }
+    }
+    memcpy(
+        &name_table.pages[page][
+            (size_t) (id % NAME_PAGE_SIZE) * (MAX_ROOM_NAME_LEN + 1)
+        ],
+        name,
+        len + 1
+    );
+
+    NameIndex* index = name_table.index;
+    size_t mask = index->cap - 1;
+    size_t slot = hash & mask;
+    while (index->slots[slot].id != NO_NAME)
+    {
+        slot = (slot + 1) & mask;
+    }
+    index->slots[slot].hash = hash;
+    __atomic_store_n(&index->slots[slot].id, id, __ATOMIC_RELEASE);
+    name_table.count++;
+
+    return id;
+}
+
+// Publish a copy of `name_table`'s hash at twice the size (or start it off)
+// with every id put back in. The caller holds `name_table_lock`
+bool grow_name_index(void)
+{
+    NameIndex* old_index = name_table.index;
+    size_t cap = old_index != NULL ? 2 * old_index->cap : 64;
+    NameIndex* index = mem_alloc(MEM_STRINGS, sizeof(NameIndex));
+    NameSlot* slots = mem_alloc(MEM_STRINGS, cap * sizeof(NameSlot));
+    if (index == NULL || slots == NULL)
+    {
+        mem_free(index);
+        mem_free(slots);
+
+        return false;
+    }
+
+    size_t slot;
+    for (slot = 0; slot < cap; ++slot)
+    {
+        slots[slot].id = NO_NAME;
+    }
+
+    size_t old;
+    for (old = 0; old_index != NULL && old < old_index->cap; ++old)
+    {
+        const NameSlot* moving = &old_index->slots[old];
+        if (moving->id != NO_NAME)
+        {
+            slot = moving->hash & (cap - 1);
+            while (slots[slot].id != NO_NAME)
+            {
+                slot = (slot + 1) & (cap - 1);
+            }
+            slots[slot] = *moving;
+        }
+    }
+
+    index->slots = slots;
+    index->cap = cap;
+    index->older = old_index;
+    __atomic_store_n(&name_table.index, index, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+// The text of an interned name
+const char* name_text(name_id id)
+{
+    return &name_table.pages[id / NAME_PAGE_SIZE][
+        (size_t) (id % NAME_PAGE_SIZE) * (MAX_ROOM_NAME_LEN + 1)
+    ];
+}
+
+// Let go of every interned name. `atexit` calls this, since names are shared
+// by every map and session and live as long as the process does
+void free_names(void)
+{
+    int page;
+    for (page = 0; page < NAME_MAX_PAGES; ++page)
+    {
+        mem_free(name_table.pages[page]);
+        name_table.pages[page] = NULL;
+    }
+    while (name_table.index != NULL)
+    {
+        NameIndex* older = name_table.index->older;
+        mem_free(name_table.index->slots);
+        mem_free(name_table.index);
+        name_table.index = older;
+    }
+    name_table.count = 0;
+}
+
+// Set up an empty `RoomCache`. Rooms that miss are read from the files in
+// `dir_path`, or else decoded out of `packed`; pass `NULL` for both if the
+// cache is going to be filled up front and should never miss.
+bool init_room_cache(
+    RoomCache*       cache,
+    const char*      dir_path,
+    const PackedMap* packed,
+    int              capacity
+) {
+    cache->dir_path = dir_path;
+    cache->packed = packed;
+    cache->rooms = mem_alloc(MEM_MAP, (size_t) capacity * sizeof(Room*));
+    cache->last_used = mem_alloc(MEM_MAP,
+                                 (size_t) capacity * sizeof(unsigned long));
+    cache->capacity = capacity;
+    cache->count = 0;
+    cache->clock = 0;
+    cache->next_id = 0;
+    cache->prompts = NULL;
+    cache->room_count = 0;
+    cache->map_kind = 'T';
+    cache->map_hash = 0;
+    cache->slot_of_name = NULL;
+    cache->slot_of_name_len = 0;
+
+    if (cache->rooms == NULL || cache->last_used == NULL)
+    {
+        fprintf(stderr, "Could not allocate a room cache of %d\n", capacity);
+        _RoomCache(cache);
+
+        return false;
+    }
+
+    return true;
+}
+
+// Destructor for `RoomCache`, which owns every `Room` in it
+void _RoomCache(RoomCache* cache)
+{
+    int i;
+    for (i = 0; i < cache->count; ++i)
+    {
+        _Room(cache->rooms[i]);
+        mem_free(cache->rooms[i]);
+    }
+
+    mem_free(cache->rooms);
+    mem_free(cache->last_used);
+    mem_free(cache->prompts);
+    mem_free(cache->slot_of_name);
+    cache->rooms = NULL;
+    cache->last_used = NULL;
+    cache->prompts = NULL;
+    cache->slot_of_name = NULL;
+    cache->slot_of_name_len = 0;
+    cache->count = 0;
+}
+
+// Find a cached `Room` by name and mark it as freshly used. `NULL` on a miss.
+// Names are dense ids, so this is one index whether the cache holds a few
+// dozen rooms or (eager) the whole map
+Room* cache_lookup(RoomCache* cache, name_id name)
+{
+    if (name < 0 || name >= cache->slot_of_name_len)
+    {
+        return NULL;
+    }
+
+    int slot = cache->slot_of_name[name];
+    if (slot == -1)
+    {
+        return NULL;
+    }
+    cache->last_used[slot] = ++cache->clock;
+
+    return cache->rooms[slot];
+}
+
+// Hand ownership of `room` over to the cache, evicting the least recently used
+// `Room` if we're full. Returns `room` for convenience, or `NULL` (after
+// freeing it) if we couldn't make room in the index for its name.
+Room* cache_insert(RoomCache* cache, Room* room)
+{
+    if (room->name >= cache->slot_of_name_len)
+    {
+        // Names keep getting interned as we go, so this grows in big steps
+        int len = cache->slot_of_name_len * 2;
+        if (len <= room->name)
+        {
+            len = room->name + 1024;
+        }
+        int* slot_of_name = mem_realloc(
+            MEM_MAP,
+            cache->slot_of_name,
+            (size_t) len * sizeof(int)
+        );
+        if (slot_of_name == NULL)
+        {
+            fprintf(stderr, "Could not index %d room names\n", len);
+            _Room(room);
+            mem_free(room);
+
+            return NULL;
+        }
+
+        int i;
+        for (i = cache->slot_of_name_len; i < len; ++i)
+        {
+            slot_of_name[i] = -1;
+        }
+        cache->slot_of_name = slot_of_name;
+        cache->slot_of_name_len = len;
+    }
+
+    // Rooms that trickle in lazily get their prompt rendered on the way in.
+    // Eager ones wait for `render_prompts` to do them all in one buffer
+    bool lazy = cache->dir_path != NULL || cache->packed != NULL;
+    if (room->prompt == NULL && lazy)
+    {
+        char buffer[64 + (MAX_CONNECTIONS + 1) * (MAX_ROOM_NAME_LEN + 2)];
+        size_t prompt_len = render_prompt(room, buffer);
+        room->prompt = mem_alloc(MEM_STRINGS, prompt_len);
+        if (room->prompt == NULL)
+        {
+            fprintf(stderr, "Not enough memory for a prompt\n");
+            _Room(room);
+            mem_free(room);
+
+            return NULL;
+        }
+        memcpy(room->prompt, buffer, prompt_len);
+        room->prompt_len = prompt_len;
+        room->owns_prompt = true;
+    }
+
+    int slot = cache->count;
+    if (cache->count < cache->capacity)
+    {
+        cache->count++;
+    }
+    else
+    {
+        // Everyone's here already, so the stalest one has to go
+        slot = 0;
+        int i;
+        for (i = 1; i < cache->count; ++i)
+        {
+            if (cache->last_used[i] < cache->last_used[slot])
+            {
+                slot = i;
+            }
+        }
+
+        cache->slot_of_name[cache->rooms[slot]->name] = -1;
+        _Room(cache->rooms[slot]);
+        mem_free(cache->rooms[slot]);
+    }
+
+    cache->rooms[slot] = room;
+    cache->last_used[slot] = ++cache->clock;
+    cache->slot_of_name[room->name] = slot;
+
+    return room;
+}
+
+// Get the `Room` called `name`, going to disk (or the packed map) for it if
+// we're lazy and it isn't cached. `NULL` means it doesn't exist or couldn't
+// be parsed.
+Room* get_room(RoomCache* cache, name_id name)
+{
+    Room* room = cache_lookup(cache, name);
+    if (room != NULL || name == NO_NAME)
+    {
+        return room;
+    }
+
+    if (cache->packed != NULL)
+    {
+        int index = find_packed_room(cache->packed, name_text(name));
+        if (index == -1)
+        {
+            return NULL;
+        }
+
+        room = room_from_packed(cache->packed, index);
+
+        return room == NULL ? NULL : cache_insert(cache, room);
+    }
+    if (cache->dir_path == NULL)
+    {
+        return NULL;
+    }
+
+    // Room files are named after the room, so there's no need to go looking
+    char rel_path_buffer[256];
+    snprintf(rel_path_buffer, 256, "%s/%s", cache->dir_path, name_text(name));
+
+    room = load_room_file(rel_path_buffer, cache->next_id);
+    if (room == NULL)
+    {
+        return NULL;
+    }
+    if (room->name != name)
+    {
+        fprintf(
+            stderr,
+            "%s claims to be named %s\n",
+            rel_path_buffer,
+            name_text(room->name)
+        );
+        _Room(room);
+        mem_free(room);
+
+        return NULL;
+    }
+    cache->next_id++;
+
+    return cache_insert(cache, room);
+}
+
+// Lazy mode doesn't know where the START_ROOM is up front. Maps that have a
+// `START_FILE_NAME` tell us, so that's one file to read; older ones (or a
+// `.start` that's gone stale) mean digging through the room files until we
+// trip over it. Everything we parse on the way gets cached, since it has to
+// be somewhere nearby in the first place
+Room* find_start_room(RoomCache* cache)
+{
+    if (cache->packed != NULL)
+    {
+        // No digging required here, since types are at the front of every
+        // record. It's almost always room 0 anyway, thanks to the BFS order
+        int i;
+        for (i = 0; i < cache->packed->room_count; ++i)
+        {
+            const unsigned char* record =
+                &cache->packed->bytes[packed_offset(cache->packed, i)];
+            if (record[0] == START_ROOM)
+            {
+                Room* room = room_from_packed(cache->packed, i);
+
+                return room == NULL ? NULL : cache_insert(cache, room);
+            }
+        }
+
+        fprintf(stderr, "None of the packed rooms are starting rooms\n");
+
+        return NULL;
+    }
+
+    char rel_path_buffer[512];
+    snprintf(rel_path_buffer, 512, "%s/%s", cache->dir_path, START_FILE_NAME);
+    FILE* start_file = fopen(rel_path_buffer, "r");
+    if (start_file != NULL)
+    {
+        char name[MAX_ROOM_NAME_LEN + 2];
+        bool got_name = fgets(name, sizeof(name), start_file) != NULL;
+        fclose(start_file);
+        if (got_name)
+        {
+            name[strcspn(name, "\n")] = '\0';
+            Room* room = get_room(cache, intern_name(name));
+            if (room != NULL && room->type == START_ROOM)
+            {
+                return room;
+            }
+        }
+    }
+
+    DIR* dir = opendir(cache->dir_path);
+    if (dir == NULL)
+    {
+        fprintf(
+            stderr,
+            "opendir(\"%s\") failed with: \"%s\"\n",
+            cache->dir_path,
+            strerror(errno)
+        );
+
+        return NULL;
+    }
+
+    Room* start_room = NULL;
+
+    struct dirent* entity = readdir(dir);
+    while (entity != NULL && start_room == NULL)
+    {
+        if (entity->d_name[0] != '.')
+        {
+            snprintf(
+                rel_path_buffer,
+                512,
+                "%s/%s",
+                cache->dir_path,
+                entity->d_name
+            );
+
+            Room* room = cache_lookup(cache, find_name(entity->d_name));
+            if (room == NULL)
+            {
+                room = load_room_file(rel_path_buffer, cache->next_id);
+                if (room == NULL)
+                {
+                    closedir(dir);
+
+                    return NULL;
+                }
+                cache->next_id++;
+                room = cache_insert(cache, room);
+                if (room == NULL)
+                {
+                    closedir(dir);
+
+                    return NULL;
+                }
+            }
+
+            if (room->type == START_ROOM)
+            {
+                start_room = room;
+            }
+        }
+
+        entity = readdir(dir);
+    }
+
+    closedir(dir);
+
+    if (start_room == NULL)
+    {
+        fprintf(stderr, "None of the rooms in %s are starting rooms\n",
+                cache->dir_path);
+    }
+
+    return start_room;
+}
+
+// Open and parse a single room file. Returns `NULL` (after saying why) on
+// failure, otherwise the caller owns the returned `Room`
+Room* load_room_file(const char* path, int room_id)
+{
+    FILE* file_handle = fopen(path, "r");
+    if (file_handle == NULL)
+    {
+        fprintf(
+            stderr,
+            "fopen(\"%s\", \"r\") failed with: \"%s\"\n",
+            path,
+            strerror(errno)
+        );
+
+        return NULL;
+    }
+
+    bool parse_succeeded = true;
+    trace_begin("parse_file");
+    Room* room = parse_file(file_handle, room_id, &parse_succeeded);
+    trace_end("parse_file");
+    fclose(file_handle);
+    if (!parse_succeeded)
+    {
+        fprintf(stderr, "Parse failure was in %s\n", path);
+        mem_free(room); // `parse_file` already ran `_Room` on it
+
+        return NULL;
+    }
+
+    return room;
+}
+
+// Render the block of text the game shows when you're in `room` into
+// `buffer` (no NUL), returning its length. `buffer` needs room for the
+// three labels plus seven names and separators.
+size_t render_prompt(const Room* room, char* buffer)
+{
+    size_t len = (size_t) sprintf(buffer, "CURRENT LOCATION: %s\n",
+                                  name_text(room->name));
+    len += (size_t) sprintf(&buffer[len], "POSSIBLE CONNECTIONS: %s",
+                            name_text(room->connections[0]));
+    int i;
+    for (i = 1; i < room->connection_count; ++i)
+    {
+        len += (size_t) sprintf(&buffer[len], ", %s",
+                                name_text(room->connections[i]));
+    }
+    len += (size_t) sprintf(&buffer[len], ".\nWHERE TO? >");
+
+    return len;
+}
+
+// Render the prompt of every room in an eager `RoomCache` into one
+// contiguous buffer, so a turn is just a `write` of the right slice of it
+bool render_prompts(RoomCache* cache)
+{
+    char buffer[64 + (MAX_CONNECTIONS + 1) * (MAX_ROOM_NAME_LEN + 2)];
+
+    size_t total = 0;
+    int i;
+    for (i = 0; i < cache->count; ++i)
+    {
+        total += render_prompt(cache->rooms[i], buffer);
+    }
+
+    // Plus one for the NUL that `sprintf` leaves after the last prompt
+    cache->prompts = mem_alloc(MEM_STRINGS, total + 1);
+    if (cache->prompts == NULL)
+    {
+        fprintf(stderr, "Not enough memory for %lu bytes of prompts\n",
+                (unsigned long) total);
+
+        return false;
+    }
+
+    size_t offset = 0;
+    for (i = 0; i < cache->count; ++i)
+    {
+        Room* room = cache->rooms[i];
+        if (room->owns_prompt)
+        {
+            mem_free(room->prompt);
+        }
+
+        room->prompt = &cache->prompts[offset];
+        room->prompt_len = render_prompt(room, room->prompt);
+        room->owns_prompt = false;
+        offset += room->prompt_len;
+    }
+
+    return true;
+}
+
+// Set up an empty `OutBuf` that will eventually `write` to `fd`
+bool init_out_buf(OutBuf* out, int fd)
+{
+    out->fd = fd;
+    out->len = 0;
+    out->cap = 4096;
+    out->data = mem_alloc(MEM_IO, out->cap);
+
+    return out->data != NULL;
+}
+
+// Destructor for `OutBuf`. Doesn't flush, so do that first if you care
+void _OutBuf(OutBuf* out)
+{
+    mem_free(out->data);
+    out->data = NULL;
+}
+
+// Make sure there's room for `len` more bytes. `false` (after saying so) if
+// we can't get it, in which case what's there already is left alone
+bool out_reserve(OutBuf* out, size_t len)
+{
+    if (out->len + len <= out->cap)
+    {
+        return true;
+    }
+
+    size_t cap = out->cap;
+    while (out->len + len > cap)
+    {
+        cap *= 2;
+    }
+    char* data = mem_realloc(MEM_IO, out->data, cap);
+    if (data == NULL)
+    {
+        fprintf(stderr, "Not enough memory to say %zu more bytes, so they "
+                        "go unsaid\n", len);
+
+        return false;
+    }
+    out->data = data;
+    out->cap = cap;
+
+    return true;
+}
+
+// Tack `len` bytes onto the end of what we're going to say this turn
+void out_append(OutBuf* out, const char* data, size_t len)
+{
+    if (!out_reserve(out, len))
+    {
+        return;
+    }
+
+    memcpy(&out->data[out->len], data, len);
+    out->len += len;
+}
+
+// `printf`, but into an `OutBuf`
+void out_printf(OutBuf* out, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int needed = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (needed < 0)
+    {
+        return;
+    }
+
+    if (!out_reserve(out, (size_t) needed + 1))
+    {
+        return;
+    }
+
+    va_start(args, format);
+    vsnprintf(&out->data[out->len], (size_t) needed + 1, format, args);
+    va_end(args);
+    out->len += (size_t) needed;
+}
+
+// Write out everything we've gathered. That's one `write` unless the kernel
+// only takes part of it (or a signal gets in the way). `false` means the
+// other end is gone or broken.
+bool out_flush(OutBuf* out)
+{
+    size_t written = 0;
+    while (written < out->len)
+    {
+        ssize_t result = write(out->fd, &out->data[written],
+                               out->len - written);
+        if (result == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            fprintf(stderr, "write() failed with: \"%s\"\n", strerror(errno));
+            out->len = 0;
+
+            return false;
+        }
+
+        written += (size_t) result;
+    }
+
+    out->len = 0;
+
+    return true;
+}
+
+// Like `out_flush`, but for a socket that doesn't block: write whatever it
+// will take right now, and keep the rest for next time. `false` means the
+// other end is gone or broken.
+bool out_send(OutBuf* out)
+{
+    size_t written = 0;
+    while (written < out->len)
+    {
+        ssize_t result = write(out->fd, &out->data[written],
+                               out->len - written);
+        if (result == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+
+            out->len = 0;
+
+            return false;
+        }
+
+        written += (size_t) result;
+    }
+
+    memmove(out->data, &out->data[written], out->len - written);
+    out->len -= written;
+
+    return true;
+}
+
+// FNV-1a, which is about as simple as a decent string hash gets
+unsigned long hash_name(const char* name)
+{
+    return hash_bytes(14695981039346656037UL, name, strlen(name));
+}
+
+// Flatten parsed `Room`s into a `MapStore`, resolving every connection name
+// to an index once so that nobody has to do it again. Room `i` of the store
+// is `room_buffer[i]`. Returns `false` if we run out of memory, or if a
+// connection doesn't name a room, unless we're told to `allow_dangling`
+// ones, in which case they're left as -1 for somebody else to complain about.
+bool build_map_store(
+    Room**    room_buffer,
+    int       room_count,
+    bool      allow_dangling,
+    MapStore* store
+) {
+    size_t count = (size_t) room_count;
+
+    // Every name this map uses was interned by the time its rooms were
+    // parsed, so they're all below this
+    int i;
+    store->room_of_name_len = 0;
+    for (i = 0; i < room_count; ++i)
+    {
+        const Room* room = room_buffer[i];
+        if (room->name >= store->room_of_name_len)
+        {
+            store->room_of_name_len = room->name + 1;
+        }
+        int j;
+        for (j = 0; j < room->connection_count; ++j)
+        {
+            if (room->connections[j] >= store->room_of_name_len)
+            {
+                store->room_of_name_len = room->connections[j] + 1;
+            }
+        }
+    }
+
+    store->room_count = room_count;
+    store->types = mem_alloc(MEM_MAP, count * sizeof(unsigned char));
+    store->degrees = mem_alloc(MEM_MAP, count * sizeof(unsigned char));
+    store->names = mem_alloc(MEM_MAP, count * sizeof(name_id));
+    store->neighbors = mem_alloc(MEM_MAP,
+                                 count * MAX_CONNECTIONS * sizeof(int));
+    store->room_of_name = mem_alloc(
+        MEM_MAP,
+        (size_t) store->room_of_name_len * sizeof(int)
+    );
+    if (
+        store->types        == NULL ||
+        store->degrees      == NULL ||
+        store->names        == NULL ||
+        store->neighbors    == NULL ||
+        store->room_of_name == NULL
+    ) {
+        fprintf(stderr, "Not enough memory for a store of %d rooms\n",
+                room_count);
+        _MapStore(store);
+
+        return false;
+    }
+
+    // First pass: everything but the neighbors, which need `room_of_name`
+    for (i = 0; i < store->room_of_name_len; ++i)
+    {
+        store->room_of_name[i] = -1;
+    }
+    for (i = 0; i < room_count; ++i)
+    {
+        const Room* room = room_buffer[i];
+        store->types[i] = (unsigned char) room->type;
+        store->degrees[i] = (unsigned char) room->connection_count;
+        store->names[i] = room->name;
+        store->room_of_name[room->name] = i;
+    }
+
+    // Second pass: resolve connections
+    for (i = 0; i < room_count; ++i)
+    {
+        const Room* room = room_buffer[i];
+        int j;
+        for (j = 0; j < room->connection_count; ++j)
+        {
+            int neighbor = find_room_index(store, room->connections[j]);
+            if (neighbor == -1 && !allow_dangling)
+            {
+                fprintf(
+                    stderr,
+                    "%s has a connection to %s, which doesn't exist\n",
+                    name_text(room->name),
+                    name_text(room->connections[j])
+                );
+                _MapStore(store);
+
+                return false;
+            }
+
+            store->neighbors[(size_t) i * MAX_CONNECTIONS + (size_t) j] =
+                neighbor;
+        }
+    }
+
+    return true;
+}
+
+// Destructor for `MapStore`
+void _MapStore(MapStore* store)
+{
+    mem_free(store->types);
+    mem_free(store->degrees);
+    mem_free(store->names);
+    mem_free(store->neighbors);
+    mem_free(store->room_of_name);
+    store->types = NULL;
+    store->degrees = NULL;
+    store->names = NULL;
+    store->neighbors = NULL;
+    store->room_of_name = NULL;
+}
+
+// Index of the room called `name`, or -1 if there isn't one
+int find_room_index(const MapStore* store, name_id name)
+{
+    if (name < 0 || name >= store->room_of_name_len)
+    {
+        return -1;
+    }
+
+    return store->room_of_name[name];
+}
+
+// Milliseconds since `start`
+double elapsed_ms(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double) (now.tv_sec - start->tv_sec) * 1e3 +
+           (double) (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Turn every `Room`'s connections from names into room indices in `store`
+// (`to_indices`) or back again. Only `run_benchmarks` wants this
+void swap_connection_ids(
+    Room**          room_buffer,
+    int             room_count,
+    const MapStore* store,
+    bool            to_indices
+) {
+    int i;
+    for (i = 0; i < room_count; ++i)
+    {
+        Room* room = room_buffer[i];
+        int j;
+        for (j = 0; j < room->connection_count; ++j)
+        {
+            room->connections[j] = to_indices
+                ? find_room_index(store, room->connections[j])
+                : store->names[room->connections[j]];
+        }
+    }
+}
+
+// Time a breadth-first search from the START_ROOM and a long random walk on
+// both the `Room*` layout that the game uses and the `MapStore`. This is
+// meant to compare layouts and nothing else, so while the clock runs every
+// `Room`'s connections hold room indices instead of names (they get their
+// names back before we return): both sides follow an edge by reading an
+// `int` and indexing with it. Both sides do identical work and print a
+// checksum to prove it. If there's a `PackedMap` too, we BFS over
+// that as well, decoding as we go; its rooms are renumbered, so only the BFS
+// checksum is comparable.
+void run_benchmarks(
+    Room**           room_buffer,
+    int              room_count,
+    const MapStore*  store,
+    const PackedMap* packed
+) {
+    size_t count = (size_t) room_count;
+    int* queue = mem_alloc(MEM_MAP, count * sizeof(int));
+    int* distance = mem_alloc(MEM_MAP, count * sizeof(int));
+    if (queue == NULL || distance == NULL)
+    {
+        fprintf(stderr, "Not enough memory to benchmark %d rooms\n",
+                room_count);
+        mem_free(queue);
+        mem_free(distance);
+
+        return;
+    }
+
+    int start = 0;
+    while (start < room_count && store->types[start] != START_ROOM)
+    {
+        start++;
+    }
+    if (start == room_count)
+    {
+        start = 0;
+    }
+
+    int reps = BENCH_WORK / room_count;
+    if (reps < 1)
+    {
+        reps = 1;
+    }
+
+    printf("%d rooms, BFS repeated %d times, %d random walk steps\n",
+           room_count, reps, BENCH_WORK);
+    swap_connection_ids(room_buffer, room_count, store, true);
+
+    // BFS over `Room*`s
+    struct timespec t0;
+    long checksum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int rep;
+    for (rep = 0; rep < reps; ++rep)
+    {
+        int i;
+        for (i = 0; i < room_count; ++i)
+        {
+            distance[i] = -1;
+        }
+        int head = 0;
+        int tail = 0;
+        queue[tail++] = start;
+        distance[start] = 0;
+        while (head < tail)
+        {
+            const Room* room = room_buffer[queue[head++]];
+            for (i = 0; i < room->connection_count; ++i)
+            {
+                const Room* next = room_buffer[room->connections[i]];
+                if (distance[next->id] == -1)
+                {
+                    distance[next->id] = distance[room->id] + 1;
+                    queue[tail++] = next->id;
+                }
+            }
+        }
+        checksum += tail;
+    }
+    printf("BFS, Room* layout:   %10.2f ms (checksum %ld)\n",
+           elapsed_ms(&t0), checksum);
+
+    // BFS over the store
+    checksum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (rep = 0; rep < reps; ++rep)
+    {
+        int i;
+        for (i = 0; i < room_count; ++i)
+        {
+            distance[i] = -1;
+        }
+        int head = 0;
+        int tail = 0;
+        queue[tail++] = start;
+        distance[start] = 0;
+        while (head < tail)
+        {
+            int room = queue[head++];
+            const int* neighbors =
+                &store->neighbors[(size_t) room * MAX_CONNECTIONS];
+            for (i = 0; i < store->degrees[room]; ++i)
+            {
+                int next = neighbors[i];
+                if (distance[next] == -1)
+                {
+                    distance[next] = distance[room] + 1;
+                    queue[tail++] = next;
+                }
+            }
+        }
+        checksum += tail;
+    }
+    printf("BFS, MapStore:       %10.2f ms (checksum %ld)\n",
+           elapsed_ms(&t0), checksum);
+
+    // Random walks, both driven by the same xorshift sequence so that they
+    // take exactly the same steps
+    unsigned long rng = 88172645463325252UL;
+    const Room* walker = room_buffer[start];
+    checksum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int step;
+    for (step = 0; step < BENCH_WORK; ++step)
+    {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        walker = room_buffer[
+            walker->connections[rng % (unsigned long) walker->connection_count]
+        ];
+        checksum += walker->id;
+    }
+    printf("Walk, Room* layout:  %10.2f ms (checksum %ld)\n",
+           elapsed_ms(&t0), checksum);
+
+    rng = 88172645463325252UL;
+    int room = start;
+    checksum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (step = 0; step < BENCH_WORK; ++step)
+    {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        room = store->neighbors[
+            (size_t) room * MAX_CONNECTIONS +
+            rng % (unsigned long) store->degrees[room]
+        ];
+        checksum += room;
+    }
+    printf("Walk, MapStore:      %10.2f ms (checksum %ld)\n",
+           elapsed_ms(&t0), checksum);
+
+    if (packed != NULL && packed->room_count == room_count)
+    {
+        int packed_start = 0;
+        while (
+            packed_start < room_count &&
+            packed->bytes[packed_offset(packed, packed_start)] != START_ROOM
+        ) {
+            packed_start++;
+        }
+
+        checksum = 0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (rep = 0; rep < reps; ++rep)
+        {
+            int i;
+            for (i = 0; i < room_count; ++i)
+            {
+                distance[i] = -1;
+            }
+            int head = 0;
+            int tail = 0;
+            queue[tail++] = packed_start;
+            distance[packed_start] = 0;
+            while (head < tail)
+            {
+                int here = queue[head++];
+                int neighbors[MAX_CONNECTIONS];
+                int degree = packed_neighbors(packed, here, neighbors);
+                for (i = 0; i < degree; ++i)
+                {
+                    if (distance[neighbors[i]] == -1)
+                    {
+                        distance[neighbors[i]] = distance[here] + 1;
+                        queue[tail++] = neighbors[i];
+                    }
+                }
+            }
+            checksum += tail;
+        }
+        printf("BFS, PackedMap:      %10.2f ms (checksum %ld)\n",
+               elapsed_ms(&t0), checksum);
+    }
+
+    swap_connection_ids(room_buffer, room_count, store, false);
+    mem_free(queue);
+    mem_free(distance);
+}
+
+// Read an unsigned LEB128 varint out of `bytes` at `*pos`, moving `*pos` past
+// it. Returns `false` if it runs off the end or is too long to be real.
+bool get_varint(
+    const unsigned char* bytes,
+    size_t               bytes_len,
+    size_t*              pos,
+    unsigned long*       value
+) {
+    *value = 0;
+    unsigned int shift = 0;
+    while (*pos < bytes_len && shift < 64)
+    {
+        unsigned char byte = bytes[(*pos)++];
+        *value |= (unsigned long) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+        shift += 7;
+    }
+
+    return false;
+}
+
+// Read `dir_path`'s compressed adjacency section into `map`. The whole thing
+// gets checked here, once, so that decoding a room later doesn't have to
+// worry about running off the end or pointing at rooms that don't exist.
+bool load_packed_map(const char* dir_path, PackedMap* map)
+{
+    memset(map, 0, sizeof(PackedMap));
+
+    char path_buffer[512];
+    snprintf(path_buffer, 512, "%s/%s", dir_path, ADJACENCY_FILE_NAME);
+
+    FILE* file_handle = fopen(path_buffer, "rb");
+    struct stat sb;
+    if (file_handle == NULL || fstat(fileno(file_handle), &sb) == -1)
+    {
+        fprintf(
+            stderr,
+            "Could not open \"%s\": \"%s\" (buildrooms --adjacency writes it)\n",
+            path_buffer,
+            strerror(errno)
+        );
+        if (file_handle != NULL)
+        {
+            fclose(file_handle);
+        }
+
+        return false;
+    }
+
+    map->bytes_len = (size_t) sb.st_size;
+    map->bytes = mem_alloc(MEM_MAP, map->bytes_len);
+    bool read_ok = map->bytes != NULL &&
+        fread(map->bytes, 1, map->bytes_len, file_handle) == map->bytes_len;
+    fclose(file_handle);
+    if (map->bytes == NULL)
+    {
+        fprintf(stderr, "Not enough memory to load \"%s\"\n", path_buffer);
+        _PackedMap(map);
+
+        return false;
+    }
+
+    unsigned long room_count = 0;
+    size_t pos = 5;
+    if (
+        !read_ok                                      ||
+        map->bytes_len < 5                            ||
+        memcmp(map->bytes, "CADJ", 4) != 0            ||
+        map->bytes[4] != ADJACENCY_VERSION            ||
+        !get_varint(map->bytes, map->bytes_len, &pos, &room_count) ||
+        room_count == 0 || room_count > 0x7fffffffUL
+    ) {
+        fprintf(stderr, "\"%s\" is not a version %d adjacency file\n",
+                path_buffer, ADJACENCY_VERSION);
+        _PackedMap(map);
+
+        return false;
+    }
+
+    map->room_count = (int) room_count;
+    size_t block_count = (room_count + PACKED_BLOCK - 1) / PACKED_BLOCK;
+    map->block_offsets = mem_alloc(MEM_MAP, block_count * sizeof(size_t));
+    map->room_offsets = mem_alloc(MEM_MAP,
+                                  room_count * sizeof(unsigned short));
+    // Becomes `rooms_by_hash` once it's sorted
+    PackedNameKey* keys = mem_alloc(MEM_MAP,
+                                    room_count * sizeof(PackedNameKey));
+    if (
+        map->block_offsets == NULL || map->room_offsets == NULL ||
+        keys == NULL
+    ) {
+        fprintf(stderr, "Not enough memory for %lu packed rooms\n",
+                room_count);
+        mem_free(keys);
+        _PackedMap(map);
+
+        return false;
+    }
+
+    // Walk every record once to find where it starts and sanity check it
+    int room;
+    for (room = 0; room < map->room_count; ++room)
+    {
+        size_t block_start = pos;
+        if (room % PACKED_BLOCK == 0)
+        {
+            map->block_offsets[room / PACKED_BLOCK] = pos;
+        }
+        else
+        {
+            block_start = map->block_offsets[room / PACKED_BLOCK];
+        }
+        map->room_offsets[room] = (unsigned short) (pos - block_start);
+
+        unsigned long name_len = 0;
+        bool ok = pos < map->bytes_len && map->bytes[pos] <= END_ROOM &&
+                  pos - block_start <= 0xffff; // Fits `room_offsets`
+        pos++;
+        ok = ok && get_varint(map->bytes, map->bytes_len, &pos, &name_len) &&
+             name_len > 0 && name_len <= MAX_ROOM_NAME_LEN &&
+             pos + name_len < map->bytes_len;
+        if (ok)
+        {
+            char name[MAX_ROOM_NAME_LEN + 1];
+            memcpy(name, &map->bytes[pos], name_len);
+            name[name_len] = '\0';
+            pos += name_len;
+
+            keys[room].hash = (unsigned int) hash_name(name);
+            keys[room].room = room;
+
+            int degree = map->bytes[pos++];
+            ok = degree <= MAX_CONNECTIONS;
+            long neighbor = room;
+            int i;
+            for (i = 0; ok && i < degree; ++i)
+            {
+                // Anything bigger than the map can't be a real step, and
+                // would overflow `neighbor` if it were big enough
+                unsigned long encoded;
+                ok = get_varint(map->bytes, map->bytes_len, &pos, &encoded) &&
+                     encoded <= 2 * (unsigned long) map->room_count;
+                if (!ok)
+                {
+                    break;
+                }
+                if (i == 0)
+                {
+                    neighbor += (encoded & 1) ? -(long) ((encoded + 1) >> 1)
+                                              : (long) (encoded >> 1);
+                }
+                else
+                {
+                    neighbor += (long) encoded + 1;
+                }
+                ok = ok && neighbor >= 0 && neighbor < map->room_count;
+            }
+        }
+
+        if (!ok)
+        {
+            fprintf(stderr, "Record %d of \"%s\" is corrupt\n", room,
+                    path_buffer);
+            mem_free(keys);
+            _PackedMap(map);
+
+            return false;
+        }
+    }
+
+    // Squeeze the rooms down to the front of the same buffer (room `i` only
+    // ever moves to somewhere at or before key `i`), and give back the rest
+    qsort(keys, room_count, sizeof(PackedNameKey), compare_packed_keys);
+    int* rooms = (int*) keys;
+    for (room = 0; room < map->room_count; ++room)
+    {
+        rooms[room] = keys[room].room;
+    }
+    map->rooms_by_hash = mem_realloc(MEM_MAP, keys, room_count * sizeof(int));
+    if (map->rooms_by_hash == NULL)
+    {
+        map->rooms_by_hash = rooms; // Shrinking failed, so it's just bigger
+    }
+
+    return true;
+}
+
+// Orders `PackedNameKey`s by hash, for `qsort`
+int compare_packed_keys(const void* a, const void* b)
+{
+    const PackedNameKey* key_a = a;
+    const PackedNameKey* key_b = b;
+    if (key_a->hash != key_b->hash)
+    {
+        return key_a->hash < key_b->hash ? -1 : 1;
+    }
+
+    return key_a->room - key_b->room;
+}
+
+// Where `room`'s record starts in `map->bytes`
+size_t packed_offset(const PackedMap* map, int room)
+{
+    return map->block_offsets[room / PACKED_BLOCK] + map->room_offsets[room];
+}
+
+// `hash_name` of packed room `room`'s name, cut down to what
+// `rooms_by_hash` is sorted by
+unsigned int packed_name_hash(const PackedMap* map, int room)
+{
+    size_t pos = packed_offset(map, room) + 1;
+    unsigned long name_len;
+    get_varint(map->bytes, map->bytes_len, &pos, &name_len);
+
+    return (unsigned int) hash_bytes(14695981039346656037UL, &map->bytes[pos],
+                                     name_len);
+}
+
+// Destructor for `PackedMap`
+void _PackedMap(PackedMap* map)
+{
+    mem_free(map->bytes);
+    mem_free(map->block_offsets);
+    mem_free(map->room_offsets);
+    mem_free(map->rooms_by_hash);
+    map->bytes = NULL;
+    map->block_offsets = NULL;
+    map->room_offsets = NULL;
+    map->rooms_by_hash = NULL;
+}
+
+// Decode the neighbors of `room` into `neighbors` (which needs room for
+// `MAX_CONNECTIONS` `int`s), returning how many there are. No bounds checks
+// here since `load_packed_map` already did them all.
+int packed_neighbors(const PackedMap* map, int room, int* neighbors)
+{
+    size_t pos = packed_offset(map, room) + 1;
+    unsigned long value;
+    get_varint(map->bytes, map->bytes_len, &pos, &value);
+    pos += value; // Skip the name
+
+    int degree = map->bytes[pos++];
+    long neighbor = room;
+    int i;
+    for (i = 0; i < degree; ++i)
+    {
+        get_varint(map->bytes, map->bytes_len, &pos, &value);
+        if (i == 0)
+        {
+            neighbor += (value & 1) ? -(long) ((value + 1) >> 1)
+                                    : (long) (value >> 1);
+        }
+        else
+        {
+            neighbor += (long) value + 1;
+        }
+        neighbors[i] = (int) neighbor;
+    }
+
+    return degree;
+}
+
+// Index of the packed room called `name`, or -1 if there isn't one
+int find_packed_room(const PackedMap* map, const char* name)
+{
+    size_t name_len = strlen(name);
+    unsigned int hash = (unsigned int) hash_name(name);
+
+    // First room whose name hashes to at least `hash`
+    int low = 0;
+    int high = map->room_count;
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        if (packed_name_hash(map, map->rooms_by_hash[middle]) < hash)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    // Then every room with that hash, which is almost always just the one
+    int i;
+    for (i = low; i < map->room_count; ++i)
+    {
+        int room = map->rooms_by_hash[i];
+        if (packed_name_hash(map, room) != hash)
+        {
+            break;
+        }
+
+        size_t pos = packed_offset(map, room) + 1;
+        unsigned long len;
+        get_varint(map->bytes, map->bytes_len, &pos, &len);
+        if (len == name_len && memcmp(&map->bytes[pos], name, name_len) == 0)
+        {
+            return room;
+        }
+    }
+
+    return -1;
+}
+
+// Decode a packed room into a regular old `Room`, which the caller owns.
+// `NULL` if we run out of memory for it or for interning its names
+Room* room_from_packed(const PackedMap* map, int room)
+{
+    Room* result = mem_alloc(MEM_MAP, sizeof(Room));
+    if (result == NULL)
+    {
+        return NULL;
+    }
+    result->id = room;
+    result->connection_count = 0;
+    result->prompt = NULL;
+    result->prompt_len = 0;
+    result->owns_prompt = false;
+
+    char name[MAX_ROOM_NAME_LEN + 1];
+    size_t pos = packed_offset(map, room);
+    result->type = (room_type) map->bytes[pos++];
+    unsigned long name_len;
+    get_varint(map->bytes, map->bytes_len, &pos, &name_len);
+    memcpy(name, &map->bytes[pos], name_len);
+    name[name_len] = '\0';
+    result->name = intern_name(name);
+    bool ok = result->name != NO_NAME;
+
+    int neighbors[MAX_CONNECTIONS];
+    int degree = packed_neighbors(map, room, neighbors);
+    int i;
+    for (i = 0; ok && i < degree; ++i)
+    {
+        pos = packed_offset(map, neighbors[i]) + 1;
+        get_varint(map->bytes, map->bytes_len, &pos, &name_len);
+        memcpy(name, &map->bytes[pos], name_len);
+        name[name_len] = '\0';
+        result->connections[i] = intern_name(name);
+        result->connection_count++;
+        ok = result->connections[i] != NO_NAME;
+    }
+
+    if (!ok)
+    {
+        mem_free(result);
+
+        return NULL;
+    }
+
+    return result;
+}
+
+// Spawns the child thread, giving it the mutex and returning `false` in case
+// of failure.
+bool spawn_child(pthread_t* thread, pthread_mutex_t* mutex)
+{
+    // No options, just pass the mutex so we don't have to keep it as a global
+    // variable
+    trace_begin("spawn_child");
+    int thread_spawn_result = pthread_create(
+        thread,
+        NULL,
+        try_to_write_date,
+        (void*) mutex
+    );
+    trace_end("spawn_child");
+    if (thread_spawn_result != 0)
+    {
+        fprintf(
+            stderr,
+            "Failed to spawn child thread, result code: %d\n",
+            thread_spawn_result
+        );
+        return false;
+    }
+
+    return true;
+}
+
+// This is the entry point/environment for the single child thread of this
+// program. It waits for the main thread to unlock the given mutex and then
+// greedily writes the current time to a file that the main thread can then
+// read.
+void try_to_write_date(void* mutex_ptr)
+{
+    pthread_mutex_t* mutex = (pthread_mutex_t*) mutex_ptr;
+
+    // Every time gets a new child, so each one is its own row in the trace
+    trace_thread_name("time child");
+
+    // Waiting for the parent thread to let us do the thing
+    pthread_mutex_lock(mutex);
+    trace_begin("try_to_write_date");
+
+    // We got the lock, so it's time to write the time to a file.
+    // First, let's get the date as a string
+    char time_str[64];
+    format_current_time(time_str);
+
+    // Alright, now we write
+    FILE* time_file = fopen("currentTime.txt", "w");
+    if (time_file == NULL)
+    {
+        fprintf(
+            stderr,
+            "Failed to open currentTime.txt for writing. errno: %s\n",
+            strerror(errno)
+        );
+
+        exit(2); // Exit the program with extreme violence, no mercy, and
+                 // no cleanup
+    }
+
+    fprintf(time_file, "%s", time_str);
+
+    fclose(time_file);
+    trace_end("try_to_write_date");
+
+    // We're done, so we can cede control back to the parent thread by
+    // releasing the mutex
+    pthread_mutex_unlock(mutex);
+}
+
+// Write the current time into `buffer` (64 bytes will do), the way the game
+// has always shown it
+void format_current_time(char* buffer)
+{
+    time_t current_timestamp = time(NULL);
+    struct tm* time_struct = localtime(&current_timestamp);
+
+    strftime(buffer, 64, "%I:%M%p, %A, %B %e, %Y", time_struct);
+    // The above ALMOST works, except that %p prints in uppercase and
+    // %I is zero-padded (not space-padded). So, in lieu of fixing that
+    buffer[0] = ' ';
+    if (buffer[5] == 'A') // AM
+    {
+        buffer[5] = 'a';
+    }
+    else                  // PM
+    {
+        buffer[5] = 'p';
+    }
+    buffer[6] = 'm';
+}
+
+// Get path of most recently modified room file directory. `false` signifies
+// failure.
+bool get_fresh_dir_path(char* path_buffer)
+{
+    const char* dir_prefix = "comitoz.rooms.";
+    const int dir_prefix_len = 14;
+
+    DIR* cwd = opendir(".");
+    if (cwd == NULL)
+    {
+        fprintf(
+            stderr,
+            "opendir(\".\") failed with: \"%s\"\n",
+            strerror(errno)
+        );
+
+        return false;
+    }
+
+    struct stat sb;
+    time_t freshest_path_time = 0;
+
+    // Loop over the entities in the current dir
+    struct dirent* entity = readdir(cwd);
+    while (entity != NULL)
+    {
+        // Check to see if the entity's name starts with "comitoz.rooms."
+        char* entity_name = entity->d_name;
+        bool matching_prefix = true;
+        int i;
+        for (i = 0; i < dir_prefix_len; ++i)
+        {
+            if (entity_name[i] == '\0' || entity_name[i] != dir_prefix[i])
+            {
+                matching_prefix = false;
+
+                break;
+            }
+        }
+
+        if (matching_prefix)
+        {
+            if (stat(entity_name, &sb) == -1)
+            {
+                fprintf(
+                    stderr,
+                    "stat(%s, &sb) failed with: \"%s\"\n",
+                    entity_name,
+                    strerror(errno)
+                );
+
+                closedir(cwd);
+
+                return false;
+            }
+
+            // Accumulate on the largest time (i.e. most recent)
+            time_t last_time = sb.st_mtime;
+            if (last_time > freshest_path_time)
+            {
+                freshest_path_time = last_time;
+                strcpy(path_buffer, entity_name);
+            }
+        }
+
+        // Get the next entity
+        entity = readdir(cwd);
+    }
+
+    // Free directory resource
+    closedir(cwd);
+
+    if (freshest_path_time == 0)
+    {
+        fprintf(
+            stderr,
+            "Did not find any directories of the form `comitoz.rooms.*` in the current dir\n"
+        );
+
+        return false;
+    }
+
+    return true;
+}
+
+// `--check` thread entry point: parse this job's share of the room files. A
+// file that doesn't parse leaves a `NULL` behind and counts as a problem.
+void* check_parse_worker(void* job_ptr)
+{
+    CheckJob* job = (CheckJob*) job_ptr;
+    char rel_path_buffer[512];
+    trace_thread_name("check parser");
+    trace_begin("check_parse_worker");
+
+    int i;
+    for (i = job->first; i < job->last; ++i)
+    {
+        const char* file_name = job->file_names[i];
+        snprintf(rel_path_buffer, 512, "%s/%s", job->dir_path, file_name);
+
+        Room* room = load_room_file(rel_path_buffer, i);
+        if (room == NULL)
+        {
+            // `load_room_file` already said what went wrong
+            job->problems++;
+        }
+        else if (room->name != find_name(file_name))
+        {
+            // Lazy loading finds rooms by file name, so this matters
+            printf(
+                "%s: file is named %s but the room is named %s\n",
+                rel_path_buffer,
+                file_name,
+                name_text(room->name)
+            );
+            job->problems++;
+        }
+
+        job->rooms[i] = room;
+    }
+
+    trace_end("check_parse_worker");
+
+    return NULL;
+}
+
+// `--check` thread entry point: check the connections of this job's share of
+// the rooms. Each room has at most 6 neighbors with at most 6 neighbors
+// apiece, so this is all linear in the size of the map.
+void* check_connections_worker(void* job_ptr)
+{
+    CheckJob* job = (CheckJob*) job_ptr;
+    const MapStore* store = job->store;
+    trace_thread_name("check connector");
+    trace_begin("check_connections_worker");
+
+    int i;
+    for (i = job->first; i < job->last; ++i)
+    {
+        const Room* room = job->rooms[i];
+
+        int owner = find_room_index(store, room->name);
+        if (owner != i)
+        {
+            printf("%s: more than one room has this name\n",
+                   name_text(room->name));
+            job->problems++;
+        }
+
+        const int* neighbors = &store->neighbors[(size_t) i * MAX_CONNECTIONS];
+        int j;
+        for (j = 0; j < store->degrees[i]; ++j)
+        {
+            int neighbor = neighbors[j];
+            if (neighbor == -1)
+            {
+                printf(
+                    "%s: CONNECTION %d names %s, which isn't a room\n",
+                    name_text(room->name),
+                    j + 1,
+                    name_text(room->connections[j])
+                );
+                job->problems++;
+
+                continue;
+            }
+            if (neighbor == i)
+            {
+                printf("%s: CONNECTION %d is to itself\n",
+                       name_text(room->name), j + 1);
+                job->problems++;
+
+                continue;
+            }
+
+            int k;
+            bool duplicate = false;
+            for (k = 0; k < j && !duplicate; ++k)
+            {
+                duplicate = neighbors[k] == neighbor;
+            }
+            if (duplicate)
+            {
+                printf(
+                    "%s: CONNECTION %d to %s is a duplicate\n",
+                    name_text(room->name),
+                    j + 1,
+                    name_text(room->connections[j])
+                );
+                job->problems++;
+
+                continue;
+            }
+
+            // Connections are supposed to go both ways
+            const int* back =
+                &store->neighbors[(size_t) neighbor * MAX_CONNECTIONS];
+            bool symmetric = false;
+            for (k = 0; k < store->degrees[neighbor] && !symmetric; ++k)
+            {
+                symmetric = back[k] == i;
+            }
+            if (!symmetric)
+            {
+                printf(
+                    "%s: CONNECTION %d goes to %s, which doesn't connect back\n",
+                    name_text(room->name),
+                    j + 1,
+                    name_text(room->connections[j])
+                );
+                job->problems++;
+            }
+        }
+    }
+
+    trace_end("check_connections_worker");
+
+    return NULL;
+}
+
+// Run `worker` over every one of `jobs` on its own thread (falling back to
+// this thread if one won't start) and add up the problems they found
+long run_check_threads(
+    CheckJob* jobs,
+    int       threads,
+    void*     (*worker)(void*)
+) {
+    pthread_t* handles = mem_alloc(MEM_MAP,
+                                   (size_t) threads * sizeof(pthread_t));
+    bool* started = mem_alloc(MEM_MAP, (size_t) threads * sizeof(bool));
+    if (started == NULL)
+    {
+        // Nowhere to keep track of threads, so it's all this one
+        mem_free(handles);
+        handles = NULL;
+    }
+
+    long problems = 0;
+    int i;
+    for (i = 0; started == NULL && i < threads; ++i)
+    {
+        jobs[i].problems = 0;
+        worker(&jobs[i]);
+        problems += jobs[i].problems;
+    }
+    for (i = 0; started != NULL && i < threads; ++i)
+    {
+        jobs[i].problems = 0;
+        started[i] = handles != NULL &&
+                     pthread_create(&handles[i], NULL, worker, &jobs[i]) == 0;
+        if (!started[i])
+        {
+            worker(&jobs[i]);
+        }
+    }
+
+    for (i = 0; started != NULL && i < threads; ++i)
+    {
+        if (started[i])
+        {
+            pthread_join(handles[i], NULL);
+        }
+        problems += jobs[i].problems;
+    }
+
+    mem_free(handles);
+    mem_free(started);
+
+    return problems;
+}
+
+// Check everything about the map in `dir_path` that the game relies on but
+// nobody checks while parsing: every connection names a real room and goes
+// both ways, names are unique and match their files, there's exactly one
+// START_ROOM and one END_ROOM, and you can actually get from one to the
+// other. Parsing and connection checks are split over `threads` threads.
+// Prints a line per problem and returns how many there were (or -1 if we
+// couldn't even get that far).
+int check_map(const char* dir_path, int threads)
+{
+    // First just collect the file names, so they can be split between threads
+    char** file_names;
+    int file_count = list_room_files(dir_path, &file_names);
+    if (file_count == -1)
+    {
+        return -1;
+    }
+
+    if (threads > file_count)
+    {
+        threads = file_count > 0 ? file_count : 1;
+    }
+
+    Room** rooms = mem_alloc(
+        MEM_MAP,
+        (size_t) (file_count > 0 ? file_count : 1) * sizeof(Room*)
+    );
+    CheckJob* jobs = mem_alloc(MEM_MAP, (size_t) threads * sizeof(CheckJob));
+    if (rooms == NULL || jobs == NULL)
+    {
+        fprintf(stderr, "Not enough memory to check %d rooms\n", file_count);
+        _FileNames(file_names, file_count);
+        mem_free(rooms);
+        mem_free(jobs);
+
+        return -1;
+    }
+    int i;
+    for (i = 0; i < threads; ++i)
+    {
+        jobs[i].dir_path = dir_path;
+        jobs[i].file_names = file_names;
+        jobs[i].rooms = rooms;
+        jobs[i].store = NULL;
+        jobs[i].first = (int) ((long) file_count * i / threads);
+        jobs[i].last = (int) ((long) file_count * (i + 1) / threads);
+    }
+
+    long problems = run_check_threads(jobs, threads, check_parse_worker);
+
+    // Squeeze out anything that didn't parse, and renumber what's left
+    int room_count = 0;
+    for (i = 0; i < file_count; ++i)
+    {
+        if (rooms[i] != NULL)
+        {
+            rooms[i]->id = room_count;
+            rooms[room_count++] = rooms[i];
+        }
+    }
+
+    MapStore store;
+    long edge_ends = 0;
+    if (room_count == 0)
+    {
+        printf("%s: no rooms\n", dir_path);
+        problems++;
+    }
+    else if (build_map_store(rooms, room_count, true, &store))
+    {
+        for (i = 0; i < threads; ++i)
+        {
+            jobs[i].store = &store;
+            jobs[i].first = (int) ((long) room_count * i / threads);
+            jobs[i].last = (int) ((long) room_count * (i + 1) / threads);
+        }
+        problems += run_check_threads(jobs, threads, check_connections_worker);
+
+        // The rest is quick enough that there's no point in threads
+        int start = -1;
+        int end = -1;
+        int start_count = 0;
+        int end_count = 0;
+        for (i = 0; i < room_count; ++i)
+        {
+            edge_ends += store.degrees[i];
+            if (store.types[i] == START_ROOM)
+            {
+                start = i;
+                start_count++;
+            }
+            else if (store.types[i] == END_ROOM)
+            {
+                end = i;
+                end_count++;
+            }
+        }
+        if (start_count != 1)
+        {
+            printf("%s: %d START_ROOMs, should be 1\n", dir_path, start_count);
+            problems++;
+        }
+        if (end_count != 1)
+        {
+            printf("%s: %d END_ROOMs, should be 1\n", dir_path, end_count);
+            problems++;
+        }
+
+        if (start_count == 1 && end_count == 1)
+        {
+            // BFS from the start, skipping connections that didn't resolve
+            char* seen = mem_calloc(MEM_MAP, (size_t) room_count, sizeof(char));
+            int* queue = mem_alloc(MEM_MAP, (size_t) room_count * sizeof(int));
+            if (seen == NULL || queue == NULL)
+            {
+                fprintf(stderr, "Not enough memory to search %d rooms\n",
+                        room_count);
+                problems = -1;
+            }
+            else
+            {
+                int head = 0;
+                int tail = 0;
+                queue[tail++] = start;
+                seen[start] = 1;
+                while (head < tail && !seen[end])
+                {
+                    int room = queue[head++];
+                    int j;
+                    for (j = 0; j < store.degrees[room]; ++j)
+                    {
+                        int next =
+                            store.neighbors[(size_t) room * MAX_CONNECTIONS +
+                                            (size_t) j];
+                        if (next != -1 && !seen[next])
+                        {
+                            seen[next] = 1;
+                            queue[tail++] = next;
+                        }
+                    }
+                }
+                if (!seen[end])
+                {
+                    printf(
+                        "%s: END_ROOM %s can't be reached from START_ROOM "
+                        "%s\n",
+                        dir_path,
+                        name_text(rooms[end]->name),
+                        name_text(rooms[start]->name)
+                    );
+                    problems++;
+                }
+            }
+            mem_free(seen);
+            mem_free(queue);
+        }
+
+        _MapStore(&store);
+    }
+    else
+    {
+        problems = -1;
+    }
+
+    if (problems >= 0)
+    {
+        printf(
+            "%s: %d rooms, %ld connections, %ld problem%s\n",
+            dir_path,
+            room_count,
+            edge_ends / 2,
+            problems,
+            problems == 1 ? "" : "s"
+        );
+    }
+
+    for (i = 0; i < room_count; ++i)
+    {
+        _Room(rooms[i]);
+        mem_free(rooms[i]);
+    }
+    _FileNames(file_names, file_count);
+    mem_free(rooms);
+    mem_free(jobs);
+
+    return problems > 0x7fffffffL ? 0x7fffffff : (int) problems;
+}
+
+// Collect the names of the room files in `dir_path` (everything but the
+// dotfiles) into a freshly allocated `*file_names`, which goes back with
+// `_FileNames`. Returns how many there are, or -1 (after saying why) if the
+// directory won't open or we run out of memory
+int list_room_files(const char* dir_path, char*** file_names)
+{
+    DIR* dir = opendir(dir_path);
+    if (dir == NULL)
+    {
+        fprintf(
+            stderr,
+            "opendir(\"%s\") failed with: \"%s\"\n",
+            dir_path,
+            strerror(errno)
+        );
+
+        return -1;
+    }
+
+    int file_count = 0;
+    int file_cap = 16;
+    *file_names = mem_alloc(MEM_MAP, (size_t) file_cap * sizeof(char*));
+    bool ok = *file_names != NULL;
+    struct dirent* entity = ok ? readdir(dir) : NULL;
+    while (entity != NULL)
+    {
+        if (entity->d_name[0] != '.')
+        {
+            if (file_count >= file_cap)
+            {
+                char** bigger = mem_realloc(
+                    MEM_MAP,
+                    *file_names,
+                    (size_t) file_cap * 2 * sizeof(char*)
+                );
+                if (bigger == NULL)
+                {
+                    ok = false;
+
+                    break;
+                }
+                *file_names = bigger;
+                file_cap *= 2;
+            }
+            char* name = mem_alloc(MEM_STRINGS, strlen(entity->d_name) + 1);
+            if (name == NULL)
+            {
+                ok = false;
+
+                break;
+            }
+            strcpy(name, entity->d_name);
+            (*file_names)[file_count++] = name;
+        }
+
+        entity = readdir(dir);
+    }
+    closedir(dir);
+
+    if (!ok)
+    {
+        fprintf(stderr, "Not enough memory to list the rooms in \"%s\"\n",
+                dir_path);
+        if (*file_names != NULL)
+        {
+            _FileNames(*file_names, file_count);
+        }
+        *file_names = NULL;
+
+        return -1;
+    }
+
+    return file_count;
+}
+
+// Destructor for what `list_room_files` hands out
+void _FileNames(char** file_names, int file_count)
+{
+    int i;
+    for (i = 0; i < file_count; ++i)
+    {
+        mem_free(file_names[i]);
+    }
+    mem_free(file_names);
+}
+
+// Read directory for room files and parse each one into a `Room`, storing
+// them in a freshly allocated `*room_buffer` that the caller must `free`
+// (along with every `Room` in it). The files are read through an io_uring
+// if we can get one, and with plain old `fopen` if not.
+// This returns the number of `Room`s that were parsed, or -1 on failure.
+int parse_room_dir(const char* dir_path, Room*** room_buffer)
+{
+    char** file_names;
+    int file_count = list_room_files(dir_path, &file_names);
+    if (file_count == -1)
+    {
+        *room_buffer = NULL;
+
+        return -1;
+    }
+
+    *room_buffer = mem_calloc(MEM_MAP, (size_t) file_count + 1, sizeof(Room*));
+    if (*room_buffer == NULL)
+    {
+        fprintf(stderr, "Not enough memory for %d rooms\n", file_count);
+        _FileNames(file_names, file_count);
+
+        return -1;
+    }
+    bool parsed = true;
+    load_rooms_uring(dir_path, file_names, file_count, *room_buffer, &parsed);
+
+    // Whatever the ring didn't get to goes the slow way, which also gives
+    // proper error messages for files that are missing or unreadable
+    char rel_path_buffer[512];
+    int i;
+    for (i = 0; parsed && i < file_count; ++i)
+    {
+        if ((*room_buffer)[i] == NULL)
+        {
+            snprintf(rel_path_buffer, 512, "%s/%s", dir_path, file_names[i]);
+            (*room_buffer)[i] = load_room_file(rel_path_buffer, i);
+            parsed = (*room_buffer)[i] != NULL;
+        }
+    }
+    _FileNames(file_names, file_count);
+
+    if (!parsed) // D'oh
+    {
+        // Always clean up after yourself, and eat your vegetables
+        for (i = 0; i < file_count; ++i)
+        {
+            if ((*room_buffer)[i] != NULL)
+            {
+                _Room((*room_buffer)[i]);
+                mem_free((*room_buffer)[i]);
+            }
+        }
+        mem_free(*room_buffer);
+        *room_buffer = NULL;
+
+        return -1;
+    }
+
+    // `readdir` order is up to the file system, so sort by name to give every
+    // room an id that's the same wherever the map gets loaded
+    qsort(*room_buffer, (size_t) file_count, sizeof(Room*),
+          compare_room_names);
+    for (i = 0; i < file_count; ++i)
+    {
+        (*room_buffer)[i]->id = i;
+    }
+
+    return file_count;
+}
+
+// Parse a room file that's already been read into `text`. Returns `NULL`
+// (after saying why) if it doesn't parse, otherwise the caller owns the
+// returned `Room`
+Room* parse_room_text(char* text, size_t len, int room_id)
+{
+    FILE* file_handle = fmemopen(text, len, "r");
+    if (file_handle == NULL)
+    {
+        fprintf(stderr, "fmemopen() failed with: \"%s\"\n", strerror(errno));
+
+        return NULL;
+    }
+
+    bool parse_succeeded = true;
+    trace_begin("parse_file");
+    Room* room = parse_file(file_handle, room_id, &parse_succeeded);
+    trace_end("parse_file");
+    fclose(file_handle);
+    if (!parse_succeeded)
+    {
+        mem_free(room); // `parse_file` already ran `_Room` on it
+
+        return NULL;
+    }
+
+    return room;
+}
+
+// Set up an io_uring for `load_rooms_uring`, with a file table for it to
+// open room files into. `false` if the kernel won't give us one, or if
+// `--no-uring` said not to ask; that's quiet, since there's a fallback,
+// unless the kernel has io_uring but can't open into the file table
+bool open_room_ring(RoomRing* ring)
+{
+    memset(ring, 0, sizeof(RoomRing));
+    ring->fd = -1;
+    if (uring_disabled)
+    {
+        return false;
+    }
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int) syscall(SYS_io_uring_setup, URING_ENTRIES, &params);
+    if (ring->fd == -1 || params.cq_entries < URING_OPS * URING_SLOTS)
+    {
+        _RoomRing(ring); // ENOSYS, or EPERM if it's been switched off
+
+        return false;
+    }
+
+    ring->sq_ring_len = params.sq_off.array +
+                        params.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_len = params.cq_off.cqes +
+                        params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap && ring->cq_ring_len > ring->sq_ring_len)
+    {
+        ring->sq_ring_len = ring->cq_ring_len;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_SQ_RING);
+    if (single_mmap)
+    {
+        ring->cq_ring = ring->sq_ring;
+        ring->cq_ring_len = 0; // So it only gets unmapped once
+    }
+    else
+    {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring->fd,
+                             IORING_OFF_CQ_RING);
+    }
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (
+        ring->sq_ring == MAP_FAILED ||
+        ring->cq_ring == MAP_FAILED ||
+        ring->sqes    == MAP_FAILED
+    ) {
+        _RoomRing(ring);
+
+        return false;
+    }
+
+    char* sq = ring->sq_ring;
+    char* cq = ring->cq_ring;
+    ring->sq_tail = (unsigned int*) &sq[params.sq_off.tail];
+    ring->sq_mask = (unsigned int*) &sq[params.sq_off.ring_mask];
+    ring->cq_head = (unsigned int*) &cq[params.cq_off.head];
+    ring->cq_tail = (unsigned int*) &cq[params.cq_off.tail];
+    ring->cq_mask = (unsigned int*) &cq[params.cq_off.ring_mask];
+    ring->cqes = (struct io_uring_cqe*) &cq[params.cq_off.cqes];
+
+    // Entry `i` of the submission queue always goes in as itself
+    unsigned int* sq_array = (unsigned int*) &sq[params.sq_off.array];
+    unsigned int i;
+    for (i = 0; i < params.sq_entries; ++i)
+    {
+        sq_array[i] = i;
+    }
+
+    // An empty file table, for the opens to fill in
+    int files[URING_SLOTS];
+    for (i = 0; i < URING_SLOTS; ++i)
+    {
+        files[i] = -1;
+    }
+    if (
+        syscall(SYS_io_uring_register, ring->fd, IORING_REGISTER_FILES,
+                files, URING_SLOTS) == -1
+    ) {
+        _RoomRing(ring);
+
+        return false;
+    }
+    if (!probe_fixed_open(ring))
+    {
+        fprintf(stderr, "io_uring can't open files into its file table "
+                "here, so room files get read one at a time\n");
+        _RoomRing(ring);
+
+        return false;
+    }
+
+    // Opens and reads that miss the page cache block, so the kernel hands
+    // them to worker threads, of which it only allows a few per CPU unless
+    // asked. With every slot waiting on the disk at once, the disk gets to
+    // sort out the order. Old kernels don't know how to be asked, which just
+    // makes them slower
+    unsigned int workers[2] = {URING_SLOTS, 0}; // Bounded, and leave the
+    syscall(SYS_io_uring_register, ring->fd,     // unbounded ones be
+            IORING_REGISTER_IOWQ_MAX_WORKERS, workers, 2);
+
+    return true;
+}
+
+// Opening straight into the file table, and closing out of it, is Linux
+// 5.15. Older kernels ignore `file_index`: the open hands back a plain fd
+// instead, and the close takes its fd of 0 to mean stdin. So open something
+// that's always there into the first slot, make sure that comes back as 0
+// rather than an fd, and close it the same way `queue_room_file` would.
+// `false` if any of that didn't work out. This is only the first half:
+// `load_rooms_uring` checks the whole chain on its first file, since a read
+// linked to the open that fills its slot needs more than this (5.17)
+bool probe_fixed_open(RoomRing* ring)
+{
+    struct io_uring_sqe* sqe = ring_next_sqe(ring);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (unsigned long) "/";
+    sqe->open_flags = O_RDONLY | O_DIRECTORY;
+    sqe->file_index = 1;
+    int res;
+    if (!ring_complete_one(ring, &res))
+    {
+        return false;
+    }
+    if (res != 0)
+    {
+        if (res > 0)
+        {
+            close(res);
+        }
+
+        return false;
+    }
+
+    sqe = ring_next_sqe(ring);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = 1;
+
+    return ring_complete_one(ring, &res) && res == 0;
+}
+
+// Destructor for `RoomRing`. Closing it also closes anything left in its
+// file table
+void _RoomRing(RoomRing* ring)
+{
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+    {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    if (ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED &&
+        ring->cq_ring_len > 0)
+    {
+        munmap(ring->cq_ring, ring->cq_ring_len);
+    }
+    if (ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED)
+    {
+        munmap(ring->sq_ring, ring->sq_ring_len);
+    }
+    if (ring->fd != -1)
+    {
+        close(ring->fd);
+    }
+    memset(ring, 0, sizeof(RoomRing));
+    ring->fd = -1;
+}
+
+// A blank submission queue entry to fill in. The caller makes sure there's
+// room, which there always is, since slots only get refilled after all three
+// of their entries have come back
+struct io_uring_sqe* ring_next_sqe(RoomRing* ring)
+{
+    unsigned int tail = *ring->sq_tail + ring->queued++;
+    struct io_uring_sqe* sqe = &ring->sqes[tail & *ring->sq_mask];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+    return sqe;
+}
+
+// Hand everything queued up to the kernel and wait for at least `wait`
+// completions. Returns what `io_uring_enter` does
+int ring_submit(RoomRing* ring, unsigned int wait)
+{
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->queued,
+                     __ATOMIC_RELEASE);
+    unsigned int queued = ring->queued;
+    ring->queued = 0;
+
+    return (int) syscall(SYS_io_uring_enter, ring->fd, queued, wait,
+                         IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+// Submit whatever is queued and wait for the next completion, putting its
+// result in `*res`. `false` if `io_uring_enter` fails
+bool ring_complete_one(RoomRing* ring, int* res)
+{
+    int submitted = ring_submit(ring, 1);
+    while (*ring->cq_head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        if (submitted == -1 && errno != EINTR)
+        {
+            return false;
+        }
+        submitted = ring_submit(ring, 1);
+    }
+
+    *res = ring->cqes[*ring->cq_head & *ring->cq_mask].res;
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+// Queue up the open, read and close of `file_name` (in `dir_fd`) into
+// `slot`. If the open fails the other two are cancelled, but the close is
+// hard linked to the read, so the file is closed even if the read fails.
+// Every one of the three completes either way, cancelled or not.
+void queue_room_file(
+    RoomRing*   ring,
+    int         dir_fd,
+    const char* file_name,
+    int         slot,
+    char*       buffer
+) {
+    unsigned long data = (unsigned long) slot * URING_OPS;
+
+    struct io_uring_sqe* sqe = ring_next_sqe(ring);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->fd = dir_fd;
+    sqe->addr = (unsigned long) file_name;
+    sqe->open_flags = O_RDONLY;
+    sqe->file_index = (unsigned int) slot + 1; // 0 would mean a regular fd
+    sqe->user_data = data + URING_OPEN;
+
+    sqe = ring_next_sqe(ring);
+    sqe->opcode = IORING_OP_READ;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+    sqe->fd = slot;
+    sqe->addr = (unsigned long) buffer;
+    sqe->len = ROOM_FILE_MAX;
+    sqe->off = 0;
+    sqe->user_data = data + URING_READ;
+
+    sqe = ring_next_sqe(ring);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = (unsigned int) slot + 1;
+    sqe->user_data = data + URING_CLOSE;
+}
+
+// Read and parse every one of `file_names` in `dir_path` through an
+// io_uring, each one as soon as its read comes back, putting room `i` in
+// `rooms[i]`. Rooms it couldn't read are left `NULL` for the caller to load
+// some other way. `*parsed` goes `false` if a file was read but wouldn't
+// parse (we stop there and say why). Returns `false`, having done nothing,
+// if there's no io_uring to be had.
+bool load_rooms_uring(
+    const char* dir_path,
+    char**      file_names,
+    int         file_count,
+    Room**      rooms,
+    bool*       parsed
+) {
+    *parsed = true;
+
+    RoomRing ring;
+    if (!open_room_ring(&ring))
+    {
+        return false;
+    }
+
+    int dir_fd = open(dir_path, O_RDONLY | O_DIRECTORY);
+    char* buffers = mem_alloc(MEM_IO, (size_t) URING_SLOTS * ROOM_FILE_MAX);
+    if (dir_fd == -1 || buffers == NULL)
+    {
+        // The regular path will have something to say about it
+        if (dir_fd != -1)
+        {
+            close(dir_fd);
+        }
+        mem_free(buffers);
+        _RoomRing(&ring);
+
+        return false;
+    }
+    trace_begin("load_rooms_uring");
+
+    int slot_file[URING_SLOTS]; // Which file each slot is working on
+    int slot_ops[URING_SLOTS];  // How many of its completions are back
+    int next_file = 0;
+    int in_flight = 0;
+    bool broken = false;
+
+    // The first file goes through alone, to make sure the kernel can run the
+    // whole open, read and close chain; one that can't fails every read with
+    // EBADF, and it's better to find that out once and say so
+    bool proven = false;
+    int probe_res[URING_OPS] = {0};
+    int slot;
+    if (file_count > 0)
+    {
+        slot_file[0] = next_file++;
+        slot_ops[0] = 0;
+        queue_room_file(&ring, dir_fd, file_names[0], 0, buffers);
+        in_flight++;
+    }
+
+    while (in_flight > 0)
+    {
+        if (ring_submit(&ring, 1) == -1 && errno != EINTR)
+        {
+            // Let the caller pick up the pieces
+            fprintf(stderr, "io_uring_enter() failed with: \"%s\"\n",
+                    strerror(errno));
+            broken = true;
+            break;
+        }
+
+        unsigned int head = *ring.cq_head;
+        unsigned int tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail)
+        {
+            const struct io_uring_cqe* cqe =
+                &ring.cqes[head & *ring.cq_mask];
+            slot = (int) (cqe->user_data / URING_OPS);
+            int file = slot_file[slot];
+            if (!proven)
+            {
+                probe_res[cqe->user_data % URING_OPS] = cqe->res;
+            }
+
+            // A full buffer might mean there's more to the file, so that
+            // one's left for the caller
+            if (
+                cqe->user_data % URING_OPS == URING_READ &&
+                cqe->res > 0 && cqe->res < ROOM_FILE_MAX && *parsed
+            ) {
+                rooms[file] = parse_room_text(
+                    &buffers[(size_t) slot * ROOM_FILE_MAX],
+                    (size_t) cqe->res,
+                    file
+                );
+                if (rooms[file] == NULL)
+                {
+                    fprintf(stderr, "Parse failure was in %s/%s\n", dir_path,
+                            file_names[file]);
+                    *parsed = false;
+                }
+            }
+
+            if (++slot_ops[slot] == URING_OPS)
+            {
+                in_flight--;
+                int last_free = slot + 1;
+                if (!proven)
+                {
+                    proven = probe_res[URING_OPEN] == 0 &&
+                             probe_res[URING_READ] >= 0 &&
+                             probe_res[URING_CLOSE] == 0;
+                    if (!proven)
+                    {
+                        fprintf(
+                            stderr,
+                            "io_uring couldn't read %s/%s (open %d, read %d, "
+                            "close %d), so room files get read one at a "
+                            "time\n",
+                            dir_path,
+                            file_names[file],
+                            probe_res[URING_OPEN],
+                            probe_res[URING_READ],
+                            probe_res[URING_CLOSE]
+                        );
+                    }
+                    last_free = URING_SLOTS; // The rest can get going now
+                }
+
+                for (
+                    ;
+                    proven && slot < last_free && next_file < file_count &&
+                    *parsed;
+                    ++slot
+                ) {
+                    slot_file[slot] = next_file;
+                    slot_ops[slot] = 0;
+                    queue_room_file(&ring, dir_fd, file_names[next_file], slot,
+                                    &buffers[(size_t) slot * ROOM_FILE_MAX]);
+                    next_file++;
+                    in_flight++;
+                }
+            }
+
+            head++;
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    trace_end("load_rooms_uring");
+    _RoomRing(&ring);
+    close(dir_fd);
+    if (!broken) // Otherwise reads might still land in them after `close`
+    {
+        mem_free(buffers);
+    }
+
+    return true;
+}
+
+// `qsort` comparator for `Room*`s, by name
+int compare_room_names(const void* a, const void* b)
+{
+    const Room* room_a = *(const Room* const*) a;
+    const Room* room_b = *(const Room* const*) b;
+
+    return strcmp(name_text(room_a->name), name_text(room_b->name));
+}
+
+// Keep FNV-1a-ing `len` more bytes into `hash`
+unsigned long hash_bytes(unsigned long hash, const void* data, size_t len)
+{
+    const unsigned char* bytes = (const unsigned char*) data;
+    size_t i;
+    for (i = 0; i < len; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211UL;
+    }
+
+    return hash;
+}
+
+// Fingerprint a parsed map: every name, type and connection, in id order
+unsigned long hash_rooms(Room** room_buffer, int room_count)
+{
+    unsigned long hash = 14695981039346656037UL;
+    int i;
+    for (i = 0; i < room_count; ++i)
+    {
+        const Room* room = room_buffer[i];
+        // Ids depend on what else this process has seen, so hash the text
+        const char* name = name_text(room->name);
+        hash = hash_bytes(hash, name, strlen(name) + 1);
+        hash = hash_bytes(hash, &room->type, sizeof(room->type));
+        int j;
+        for (j = 0; j < room->connection_count; ++j)
+        {
+            name = name_text(room->connections[j]);
+            hash = hash_bytes(hash, name, strlen(name) + 1);
+        }
+    }
+
+    return hash;
+}
+
+// Get a `Room` by its id. Only works when the cache knows the whole map,
+// since otherwise ids are just the order rooms happened to get loaded in.
+// `NULL` if there's no such room.
+Room* get_room_by_id(RoomCache* cache, int id)
+{
+    if (id < 0 || id >= cache->room_count)
+    {
+        return NULL;
+    }
+
+    if (cache->packed == NULL)
+    {
+        // Eager: everything went in in id order and nothing ever leaves
+        return cache->rooms[id];
+    }
+
+    int i;
+    for (i = 0; i < cache->count; ++i)
+    {
+        if (cache->rooms[i]->id == id)
+        {
+            cache->last_used[i] = ++cache->clock;
+
+            return cache->rooms[i];
+        }
+    }
+
+    Room* room = room_from_packed(cache->packed, id);
+
+    return room == NULL ? NULL : cache_insert(cache, room);
+}
+
+// The name of room `id`, without dragging the whole room into the cache.
+// `NO_NAME` if there's no such room.
+name_id get_room_name_by_id(const RoomCache* cache, int id)
+{
+    if (id < 0 || id >= cache->room_count)
+    {
+        return NO_NAME;
+    }
+
+    if (cache->packed == NULL)
+    {
+        return cache->rooms[id]->name;
+    }
+
+    const PackedMap* map = cache->packed;
+    char buffer[MAX_ROOM_NAME_LEN + 1];
+    size_t pos = packed_offset(map, id) + 1;
+    unsigned long name_len;
+    get_varint(map->bytes, map->bytes_len, &pos, &name_len);
+    memcpy(buffer, &map->bytes[pos], name_len);
+    buffer[name_len] = '\0';
+
+    return intern_name(buffer);
+}
+
+// Start with an empty `PathHistory`. Nothing is allocated until the first
+// step, so this can't fail
+void init_path_history(PathHistory* path)
+{
+    path->cap = 0;
+    path->len = 0;
+    path->names = NULL;
+    path->ids = NULL;
+}
+
+// Destructor for `PathHistory`
+void _PathHistory(PathHistory* path)
+{
+    mem_free(path->names);
+    mem_free(path->ids);
+    path->names = NULL;
+    path->ids = NULL;
+    path->len = 0;
+}
+
+// Add a step to the path. `false` (with the path as it was) if there's no
+// memory for it
+bool path_push(PathHistory* path, name_id name, int id)
+{
+    if (path->len >= path->cap)
+    {
+        // Reallocate more storage for the history if necessary. Each array
+        // is only swapped in once it's grown, so a failure leaves the path
+        // whole (if with one array roomier than the other)
+        int cap = path->cap > 0 ? path->cap * 2 : 16;
+        name_id* names = mem_realloc(MEM_SESSION, path->names,
+                                     (size_t) cap * sizeof(name_id));
+        if (names == NULL)
+        {
+            return false;
+        }
+        path->names = names;
+        int* ids = mem_realloc(MEM_SESSION, path->ids,
+                               (size_t) cap * sizeof(int));
+        if (ids == NULL)
+        {
+            return false;
+        }
+        path->ids = ids;
+        path->cap = cap;
+    }
+
+    path->names[path->len] = name;
+    path->ids[path->len] = id;
+    path->len++;
+
+    return true;
+}
+
+// Write `value` into `buffer` as an unsigned LEB128 varint, returning how
+// many bytes that took (10 at most). Same as the one in *.buildrooms.c
+size_t put_varint(unsigned char* buffer, unsigned long value)
+{
+    size_t len = 0;
+    while (value >= 0x80)
+    {
+        buffer[len++] = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    buffer[len++] = (unsigned char) value;
+
+    return len;
+}
+
+// Save where the player is and how they got there to `file_path`. The whole
+// thing is encoded into memory and then written in one go to a temporary
+// file that gets renamed over the real one, so a crash mid-save can't leave
+// half a checkpoint behind. Returns `false` (after saying why) on failure.
+bool save_checkpoint(
+    const char*        file_path,
+    const RoomCache*   cache,
+    const Room*        current_room,
+    const PathHistory* path
+) {
+    if (cache->room_count == 0)
+    {
+        fprintf(stderr, "Can't save without room ids (are you --lazy?)\n");
+
+        return false;
+    }
+
+    // Header, three varints, then up to 10 bytes per step
+    size_t cap = 14 + 30 + 10 * (size_t) path->len;
+    unsigned char* buffer = mem_alloc(MEM_IO, cap);
+    if (buffer == NULL)
+    {
+        fprintf(stderr, "Not enough memory to save a %d step path\n",
+                path->len);
+
+        return false;
+    }
+
+    size_t len = 0;
+    memcpy(buffer, "CSAV", 4);
+    len += 4;
+    buffer[len++] = CHECKPOINT_VERSION;
+    buffer[len++] = (unsigned char) cache->map_kind;
+    int i;
+    for (i = 0; i < 8; ++i)
+    {
+        buffer[len++] = (unsigned char) (cache->map_hash >> (8 * i));
+    }
+    len += put_varint(&buffer[len], (unsigned long) cache->room_count);
+    len += put_varint(&buffer[len], (unsigned long) current_room->id);
+    len += put_varint(&buffer[len], (unsigned long) path->len);
+
+    long previous = 0;
+    for (i = 0; i < path->len; ++i)
+    {
+        long delta = (long) path->ids[i] - previous;
+        len += put_varint(
+            &buffer[len],
+            delta < 0 ? ((unsigned long) -delta << 1) - 1
+                      : (unsigned long) delta << 1
+        );
+        previous = path->ids[i];
+    }
+
+    char temp_path[512];
+    snprintf(temp_path, 512, "%s.tmp", file_path);
+    FILE* file_handle = fopen(temp_path, "wb");
+    if (file_handle == NULL)
+    {
+        fprintf(
+            stderr,
+            "fopen(\"%s\", \"wb\") failed with: \"%s\"\n",
+            temp_path,
+            strerror(errno)
+        );
+        mem_free(buffer);
+
+        return false;
+    }
+
+    bool ok = fwrite(buffer, 1, len, file_handle) == len;
+    ok = fclose(file_handle) == 0 && ok;
+    ok = ok && rename(temp_path, file_path) == 0;
+    if (!ok)
+    {
+        fprintf(
+            stderr,
+            "Saving to \"%s\" failed with: \"%s\"\n",
+            file_path,
+            strerror(errno)
+        );
+        remove(temp_path);
+    }
+
+    mem_free(buffer);
+
+    return ok;
+}
+
+// Read the checkpoint at `file_path`, check that it belongs to the map in
+// `cache`, and replace `path` with the one it holds. Returns the room the
+// player was in, or `NULL` (after saying why, and leaving `path` alone) if
+// the checkpoint is unreadable or for some other map.
+Room* load_checkpoint(
+    const char*  file_path,
+    RoomCache*   cache,
+    PathHistory* path
+) {
+    if (cache->room_count == 0)
+    {
+        fprintf(stderr, "Can't load without room ids (are you --lazy?)\n");
+
+        return NULL;
+    }
+
+    FILE* file_handle = fopen(file_path, "rb");
+    struct stat sb;
+    if (file_handle == NULL || fstat(fileno(file_handle), &sb) == -1)
+    {
+        fprintf(
+            stderr,
+            "Could not open checkpoint \"%s\": \"%s\"\n",
+            file_path,
+            strerror(errno)
+        );
+        if (file_handle != NULL)
+        {
+            fclose(file_handle);
+        }
+
+        return NULL;
+    }
+
+    size_t bytes_len = (size_t) sb.st_size;
+    unsigned char* bytes = mem_alloc(MEM_IO, bytes_len > 0 ? bytes_len : 1);
+    bool ok = bytes != NULL &&
+              fread(bytes, 1, bytes_len, file_handle) == bytes_len;
+    fclose(file_handle);
+
+    unsigned long map_hash = 0;
+    int i;
+    for (i = 0; ok && bytes_len >= 14 && i < 8; ++i)
+    {
+        map_hash |= (unsigned long) bytes[6 + i] << (8 * i);
+    }
+
+    size_t pos = 14;
+    unsigned long room_count = 0;
+    unsigned long current_id = 0;
+    unsigned long path_len = 0;
+    if (bytes == NULL)
+    {
+        fprintf(stderr, "Not enough memory to load \"%s\"\n", file_path);
+    }
+    else if (
+        !ok || bytes_len < 14 || memcmp(bytes, "CSAV", 4) != 0 ||
+        bytes[4] != CHECKPOINT_VERSION
+    ) {
+        fprintf(stderr, "\"%s\" is not a version %d checkpoint\n",
+                file_path, CHECKPOINT_VERSION);
+        ok = false;
+    }
+    else if (
+        bytes[5] != (unsigned char) cache->map_kind ||
+        map_hash != cache->map_hash
+    ) {
+        fprintf(
+            stderr,
+            "\"%s\" was saved on a different map (%c/%016lx, this is "
+            "%c/%016lx)\n",
+            file_path,
+            bytes[5],
+            map_hash,
+            cache->map_kind,
+            cache->map_hash
+        );
+        ok = false;
+    }
+    else if (
+        !get_varint(bytes, bytes_len, &pos, &room_count) ||
+        !get_varint(bytes, bytes_len, &pos, &current_id) ||
+        !get_varint(bytes, bytes_len, &pos, &path_len) ||
+        room_count != (unsigned long) cache->room_count ||
+        current_id >= room_count ||
+        path_len > bytes_len // Every step takes at least a byte
+    ) {
+        fprintf(stderr, "\"%s\" is corrupt\n", file_path);
+        ok = false;
+    }
+
+    PathHistory loaded;
+    init_path_history(&loaded);
+    name_id name = NO_NAME;
+    long previous = 0;
+    unsigned long step;
+    for (step = 0; ok && step < path_len; ++step)
+    {
+        unsigned long encoded;
+        ok = get_varint(bytes, bytes_len, &pos, &encoded);
+        previous += (encoded & 1) ? -(long) ((encoded + 1) >> 1)
+                                  : (long) (encoded >> 1);
+        if (ok && previous >= 0 && previous < (long) room_count)
+        {
+            name = get_room_name_by_id(cache, (int) previous);
+        }
+        ok = ok && name != NO_NAME;
+        if (!ok)
+        {
+            fprintf(stderr, "Step %lu of \"%s\" is corrupt\n", step,
+                    file_path);
+        }
+        else if (!path_push(&loaded, name, (int) previous))
+        {
+            fprintf(stderr, "Not enough memory for step %lu of \"%s\"\n",
+                    step, file_path);
+            ok = false;
+        }
+    }
+    mem_free(bytes);
+
+    Room* current_room = ok ? get_room_by_id(cache, (int) current_id) : NULL;
+    if (current_room == NULL)
+    {
+        _PathHistory(&loaded);
+
+        return NULL;
+    }
+
+    _PathHistory(path);
+    *path = loaded;
+
+    return current_room;
+}
+
+// Use file handle to parse file contents into a `Room*`. Caller must `free`
+// the returned pointer
+Room* parse_file(FILE* file_handle, int room_id, bool* parse_succeeded)
+{
+    char* line = NULL;
+    size_t getline_buffer_len = 0;
+
+    // Initialize `Room` to be returned
+    Room* room = mem_alloc(MEM_MAP, sizeof(Room));
+    if (room == NULL)
+    {
+        fprintf(stderr, "Parsing failed: not enough memory for a room\n");
+        *parse_succeeded = false;
+
+        return NULL;
+    }
+    room->id = room_id;
+    room->name = NO_NAME;
+    room->connection_count = 0;
+    room->prompt = NULL;
+    room->prompt_len = 0;
+    room->owns_prompt = false;
+
+    // Parsing state
+    bool got_name = false;
+    bool got_type = false;
+
+    ssize_t chars_read = mem_getline(&line, &getline_buffer_len,
+                                     file_handle);
+    while (chars_read != -1)
+    {
+        if (chars_read == 0)
+        {
+            // Ignore empty lines
+            chars_read = mem_getline(&line, &getline_buffer_len, file_handle);
+
+            continue;
+        }
+
+        // Classic `sscanf`. This relies on the format to not incur buffer
+        // overflow, so uh, make sure no one tampered with your room
+        // files since you last checked.
+        char second_token[6];
+        char property_value[MAX_ROOM_NAME_LEN + 1];
+        int sscanf_result = sscanf(
+            line,
+            "%*s %5s %23s\n",
+            second_token, property_value
+        );
+        if (sscanf_result == 2)
+        {
+            // We only need the first character of the second token of the
+            // property name to distinguish them due to the format
+            switch (second_token[0])
+            {
+                case 'N': // ROOM NAME: ...
+                {
+                    if (got_name)
+                    {
+                        _Room(room);
+                        fprintf(
+                            stderr,
+                            "Parsing failed: saw 'N' but already parsed ROOM NAME\n"
+                        );
+                        *parse_succeeded = false;
+                        mem_free(line);
+
+                        return room;
+                    }
+
+                    room->name = intern_name(property_value);
+                    if (room->name == NO_NAME)
+                    {
+                        _Room(room);
+                        fprintf(stderr, "Parsing failed: couldn't intern %s\n",
+                                property_value);
+                        *parse_succeeded = false;
+                        mem_free(line);
+
+                        return room;
+                    }
+                    got_name = true;
+                    break;
+                }
+                case 'T': // ROOM TYPE: ...
+                {
+                    // There is too much error handling here but I suppose
+                    // there's no reason to remove it and make it harder to
+                    // fix anyways
+                    if (!got_name || room->connection_count < 3)
+                    {
+                        _Room(room);
+                        if (!got_name)
+                        {
+                            fprintf(
+                                stderr,
+                                "Parsing failed: saw 'T' but no ROOM NAME yet\n"
+                            );
+                        }
+                        else
+                        {
+                            fprintf(
+                                stderr,
+                                "Parsing failed: saw 'T' but only %d CONNECTIONs so far\n",
+                                room->connection_count
+                            );
+                        }
+                        *parse_succeeded = false;
+                        mem_free(line);
+
+                        return room;
+                    }
+
+                    // Due to the format, again, we only need the first
+                    // character of the room type token
+                    switch (property_value[0])
+                    {
+                        case 'S': // START_ROOM
+                            room->type = START_ROOM;
+                            break;
+                        case 'M': // MID_ROOM
+                            room->type = MID_ROOM;
+                            break;
+                        default:  // END_ROOM
+                            room->type = END_ROOM;
+                            break;
+                    }
+                    got_type = true;
+                    break;
+                }
+                default:  // CONNECTION #: ...
+                {
+                    if (!got_name || room->connection_count >= MAX_CONNECTIONS)
+                    {
+                        _Room(room);
+                        if (!got_name)
+                        {
+                            fprintf(
+                                stderr,
+                                "Parsing failed: saw %c, but no ROOM NAME yet\n",
+                                second_token[0]
+                            );
+                        }
+                        else
+                        {
+                            fprintf(
+                                stderr,
+                                "Parsing failed: saw %c, but there's already %d connections\n",
+                                second_token[0],
+                                room->connection_count
+                            );
+                        }
+                        *parse_succeeded = false;
+                        mem_free(line);
+
+                        return room;
+                    }
+
+                    // Neighbors' names are interned too, so a connection is
+                    // just an id and matching the player's input against it
+                    // is an integer compare
+                    name_id connection_name = intern_name(property_value);
+                    if (connection_name == NO_NAME)
+                    {
+                        _Room(room);
+                        fprintf(stderr, "Parsing failed: couldn't intern %s\n",
+                                property_value);
+                        *parse_succeeded = false;
+                        mem_free(line);
+
+                        return room;
+                    }
+
+                    room->connections[room->connection_count] =
+                        connection_name;
+                    room->connection_count++;
+                    break;
+                }
+            }
+        }
+
+        // Consume the next line 'fore we go 'round again
+        chars_read = mem_getline(&line, &getline_buffer_len, file_handle);
+    }
+
+    mem_free(line); // I have ethical objections to nonfree lines
+
+    // `mem_getline` gives up without reaching the end if it runs out of
+    // memory, and a room missing its last lines mustn't look like a whole one
+    if (!feof(file_handle))
+    {
+        _Room(room);
+        fprintf(stderr, "Parsing failed: couldn't read to the end\n");
+        *parse_succeeded = false;
+
+        return room;
+    }
+    if (!got_type) // Otherwise `room->type` is whatever was lying around
+    {
+        _Room(room);
+        fprintf(stderr, "Parsing failed: never saw a ROOM TYPE\n");
+        *parse_succeeded = false;
+
+        return room;
+    }
+    *parse_succeeded = true;
+
+    return room;
+}
+
+// Convert `room_type` enum into its string representation
+const char* room_type_to_str(room_type rt)
+{
+    switch (rt)
+    {
+        case START_ROOM:
+            return "START_ROOM";
+        case MID_ROOM:
+            return "MID_ROOM";
+        case END_ROOM:
+            return "END_ROOM";
+        default:
+            return "wat"; // If you get this you almost certainly have
+                          // uninitialized memory or some other sort of nasal
+                          // demon
+    }
+}
+
+// Start a game in `start_room`
+void init_session(Session* session, RoomCache* rooms, const Room* start_room)
+{
+    session->rooms = rooms;
+    session->current_room = start_room->name;
+    init_path_history(&session->path);
+    session->turns = 0;
+    session->won = start_room->type == END_ROOM;
+    session->id = 0;
+}
+
+// Destructor for `Session`. The rooms belong to the cache, not to us
+void _Session(Session* session)
+{
+    _PathHistory(&session->path);
+    session->current_room = NO_NAME;
+}
+
+// The `Room` that `session` is in, which another session might have gotten
+// evicted since the last time, so this can mean loading it again. Only good
+// until the cache takes in another room. `NULL` if it won't load
+Room* session_room(const Session* session)
+{
+    return get_room(session->rooms, session->current_room);
+}
+
+// Append what the player should see now: the current room's prompt, or the
+// victory lap if they've made it. Everything after the first turn is set off
+// from the reply before it by a blank line. `false` if the current room
+// won't load
+bool engine_render(const Session* session, OutBuf* out)
+{
+    const Room* room = session->won ? NULL : session_room(session);
+    if (!session->won && room == NULL)
+    {
+        return false;
+    }
+
+    if (session->turns > 0)
+    {
+        out_append(out, "\n", 1);
+    }
+
+    if (!session->won)
+    {
+        // The prompt was rendered when the room was loaded, so this is just
+        // a copy
+        out_append(out, room->prompt, room->prompt_len);
+
+        return true;
+    }
+
+    out_printf(out, "YOU HAVE FOUND THE END ROOM. CONGRATULATIONS!\n");
+    out_printf(
+        out,
+        "YOU TOOK %d STEPS. YOUR PATH TO VICTORY WAS:\n",
+        session->path.len
+    );
+    int i;
+    for (i = 0; i < session->path.len; ++i)
+    {
+        out_printf(out, "%s\n", name_text(session->path.names[i]));
+    }
+
+    return true;
+}
+
+// Walk `session` into `next_room`, which the caller has already made sure is
+// next door, and say whether that won the game. If there's no memory to
+// remember the step, they stay put and it's a `STEP_ERROR`
+void engine_move(Session* session, Room* next_room, StepResult* result)
+{
+    if (!path_push(&session->path, next_room->name, next_room->id))
+    {
+        result->code = STEP_ERROR;
+
+        return;
+    }
+    session->current_room = next_room->name;
+    session->won = next_room->type == END_ROOM;
+    result->code = session->won ? STEP_WON : STEP_MOVED;
+}
+
+// Take one command (without its '\n') and do what it says, filling `result`
+// and appending any reply to `out`. Never blocks on anything but a lazy
+// cache miss. The time, saving and loading are left to the caller, since
+// those need a clock or a disk. `STEP_ERROR` means the map itself is broken
+// (or we're out of memory), and `STEP_OVER` that the game was already won.
+void engine_step(
+    Session*    session,
+    const char* command,
+    StepResult* result,
+    OutBuf*     out
+) {
+    result->code = STEP_ERROR;
+    result->arg = NULL;
+    if (session->won)
+    {
+        result->code = STEP_OVER;
+
+        return;
+    }
+    session->turns++;
+
+    if (strcmp(command, "time") == 0)
+    {
+        result->code = STEP_TIME;
+
+        return;
+    }
+    if (strcmp(command, "memory") == 0)
+    {
+        // What the whole process is using, not just this session
+        char report[MEM_REPORT_LEN];
+        out_append(out, "\n", 1);
+        out_append(out, report, format_mem_report(report));
+        result->code = STEP_MEMORY;
+
+        return;
+    }
+    if (
+        (strncmp(command, "save", 4) == 0 || strncmp(command, "load", 4) == 0)
+        && (command[4] == '\0' || command[4] == ' ')
+    ) {
+        // "save" or "save <file>", and the same for "load"
+        result->code = command[0] == 's' ? STEP_SAVE : STEP_LOAD;
+        result->arg = command[4] == ' ' ? &command[5] : DEFAULT_CHECKPOINT_PATH;
+
+        return;
+    }
+
+    // Loop through possible connections the player can move to. If what
+    // they typed was never interned it can't be any room's name, so there's
+    // no need to look. Loading the next room might evict this one, so it's
+    // done with by then
+    const Room* current_room = session_room(session);
+    if (current_room == NULL)
+    {
+        return;
+    }
+    name_id choice = find_name(command);
+    int i;
+    for (i = 0; choice != NO_NAME && i < current_room->connection_count; ++i)
+    {
+        // Did they choose this one?
+        if (current_room->connections[i] == choice)
+        {
+            // Ok, they did, so we have to now find the actual corresponding
+            // `Room` struct (which may mean reading it off the disk if we're
+            // being lazy)
+            Room* next_room = get_room(session->rooms, choice);
+            if (next_room != NULL)
+            {
+                engine_move(session, next_room, result);
+            }
+
+            return;
+        }
+    }
+
+    // No dice
+    static const char huh[] =
+        "\nHUH? I DON'T UNDERSTAND THAT ROOM. TRY AGAIN.\n";
+    out_append(out, huh, sizeof(huh) - 1);
+    result->code = STEP_UNKNOWN;
+}
+
+// Save the session to `file_path` and tell the player how that went
+bool engine_save(Session* session, const char* file_path, OutBuf* out)
+{
+    const Room* current_room = session_room(session);
+    if (
+        current_room != NULL &&
+        save_checkpoint(file_path, session->rooms, current_room, &session->path)
+    ) {
+        out_printf(out, "\nGAME SAVED TO %s.\n", file_path);
+
+        return true;
+    }
+
+    out_printf(out, "\nCOULD NOT SAVE TO %s.\n", file_path);
+
+    return false;
+}
+
+// Replace the session with the one saved at `file_path`, and tell the player
+// how that went. A failed load leaves the session as it was
+bool engine_load(Session* session, const char* file_path, OutBuf* out)
+{
+    Room* loaded_room = load_checkpoint(
+        file_path,
+        session->rooms,
+        &session->path
+    );
+    if (loaded_room == NULL)
+    {
+        if (out != NULL)
+        {
+            out_printf(out, "\nCOULD NOT LOAD FROM %s.\n", file_path);
+        }
+
+        return false;
+    }
+
+    session->current_room = loaded_room->name;
+    session->won = loaded_room->type == END_ROOM;
+    if (out != NULL)
+    {
+        out_printf(out, "\nGAME LOADED FROM %s.\n", file_path);
+    }
+
+    return true;
+}
+
+// Open (or create) the journal at `file_path` for appending, and start up
+// its writer thread. `false` (after saying why) on failure.
+bool open_journal(Journal* journal, const char* file_path)
+{
+    // Other games might be opening it at the same moment, and only one of us
+    // gets to write the header. Holding the lock until that's done also
+    // keeps everyone else's records from landing in front of it
+    journal->fd = open(file_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    struct stat sb;
+    if (
+        journal->fd == -1 ||
+        flock(journal->fd, LOCK_EX) == -1 ||
+        fstat(journal->fd, &sb) == -1
+    ) {
+        fprintf(
+            stderr,
+            "Could not open journal \"%s\": \"%s\"\n",
+            file_path,
+            strerror(errno)
+        );
+        if (journal->fd != -1)
+        {
+            close(journal->fd);
+        }
+
+        return false;
+    }
+
+    // Brand new journals get a header
+    if (sb.st_size == 0)
+    {
+        unsigned char header[8] = {
+            'C', 'J', 'N', 'L',
+            JOURNAL_VERSION,
+            (unsigned char) sizeof(JournalRecord),
+            0, 0
+        };
+        if (write(journal->fd, header, sizeof(header)) != sizeof(header))
+        {
+            fprintf(stderr, "Could not write the journal header\n");
+            close(journal->fd);
+
+            return false;
+        }
+    }
+    flock(journal->fd, LOCK_UN);
+
+    journal->ring = mem_alloc(MEM_IO,
+                              JOURNAL_RING_SIZE * sizeof(JournalRecord));
+    if (journal->ring == NULL)
+    {
+        fprintf(stderr, "Could not allocate the journal ring\n");
+        close(journal->fd);
+
+        return false;
+    }
+    // Touch every page now, so the first lap around the ring doesn't take
+    // page faults on the game's time
+    memset(journal->ring, 0, JOURNAL_RING_SIZE * sizeof(JournalRecord));
+
+    journal->head = 0;
+    journal->tail = 0;
+    journal->stalls = 0;
+    journal->stopping = 0;
+    journal->failed = 0;
+    if (pthread_create(&journal->writer, NULL, journal_writer, journal) != 0)
+    {
+        fprintf(stderr, "Could not start the journal writer\n");
+        mem_free(journal->ring);
+        close(journal->fd);
+
+        return false;
+    }
+
+    return true;
+}
+
+// Let the writer flush whatever's left, then shut it all down
+void close_journal(Journal* journal)
+{
+    __atomic_store_n(&journal->stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(journal->writer, NULL);
+
+    close(journal->fd);
+    mem_free(journal->ring);
+    journal->ring = NULL;
+
+    // Only worth mentioning if the writer couldn't keep up
+    if (journal->stalls > 0)
+    {
+        fprintf(stderr, "The journal ring filled up %lu times\n",
+                journal->stalls);
+    }
+}
+
+// Entry point for the journal's writer thread. Every interval it takes
+// whatever the game has appended since last time and commits it as one
+// group: one `writev` (two pieces if it wraps around the ring) and one
+// `fdatasync`. The ring slots are only handed back once they're on disk. A
+// batch that fails to write stays in the ring and goes again next interval,
+// picking up after whatever part of it did make it, for `JOURNAL_RETRIES`
+// intervals. After that, or if `fdatasync` fails (which leaves no telling
+// what's on disk), the journal is marked failed and the writer quits
+void* journal_writer(void* journal_ptr)
+{
+    Journal* journal = (Journal*) journal_ptr;
+    struct timespec nap = {0, JOURNAL_INTERVAL_NS};
+    trace_thread_name("journal writer");
+
+    size_t done = 0; // Bytes from `tail` on that are already in the file
+    int failures = 0;
+    for (;;)
+    {
+        // Check this before `head`, so the last batch has everything that was
+        // appended before we were told to stop
+        int stopping = __atomic_load_n(&journal->stopping, __ATOMIC_ACQUIRE);
+        unsigned long head = __atomic_load_n(&journal->head, __ATOMIC_ACQUIRE);
+        unsigned long tail = journal->tail;
+
+        if (head != tail)
+        {
+            trace_begin("journal flush");
+            size_t batch_len = (head - tail) * sizeof(JournalRecord);
+            ssize_t written = write_journal_batch(journal, tail, head, done);
+            int error = written == -1 ? errno : 0;
+            if (written > 0)
+            {
+                done += (size_t) written;
+            }
+            bool synced = done == batch_len && fdatasync(journal->fd) == 0;
+            if (done == batch_len && !synced)
+            {
+                error = errno;
+                failures = JOURNAL_RETRIES; // No point in trying again
+            }
+            trace_end("journal flush");
+
+            if (synced)
+            {
+                done = 0;
+                failures = 0;
+                __atomic_store_n(&journal->tail, head, __ATOMIC_RELEASE);
+            }
+            else if (++failures >= JOURNAL_RETRIES)
+            {
+                fprintf(
+                    stderr,
+                    "The journal failed (\"%s\"), so its last %lu records "
+                    "may be lost and nothing after them gets recorded\n",
+                    error != 0 ? strerror(error) : "short write",
+                    head - tail
+                );
+                __atomic_store_n(&journal->failed, 1, __ATOMIC_RELEASE);
+
+                break;
+            }
+        }
+
+        if (stopping && head == __atomic_load_n(&journal->tail,
+                                                __ATOMIC_RELAXED))
+        {
+            break;
+        }
+
+        nanosleep(&nap, NULL);
+    }
+
+    return NULL;
+}
+
+// Write the records from `tail` up to `head`, less the first `skip` bytes of
+// them (which made it last time), with one `writev`. Returns what it does
+ssize_t write_journal_batch(
+    const Journal* journal,
+    unsigned long  tail,
+    unsigned long  head,
+    size_t         skip
+) {
+    size_t first = tail & (JOURNAL_RING_SIZE - 1);
+    size_t count = head - tail;
+    size_t before_wrap = JOURNAL_RING_SIZE - first;
+    if (before_wrap > count)
+    {
+        before_wrap = count;
+    }
+
+    struct iovec pieces[2];
+    pieces[0].iov_base = &journal->ring[first];
+    pieces[0].iov_len = before_wrap * sizeof(JournalRecord);
+    pieces[1].iov_base = journal->ring;
+    pieces[1].iov_len = (count - before_wrap) * sizeof(JournalRecord);
+
+    int piece = 0;
+    if (skip >= pieces[0].iov_len)
+    {
+        skip -= pieces[0].iov_len;
+        piece = 1;
+    }
+    pieces[piece].iov_base = (char*) pieces[piece].iov_base + skip;
+    pieces[piece].iov_len -= skip;
+
+    return writev(journal->fd, &pieces[piece], 2 - piece);
+}
+
+// Record one command. This is on the game's hot path, so it's a clock read
+// and a few copies into the ring, and it only waits if the writer has fallen
+// a whole ring behind. `false` if the journal has failed, in which case
+// there's no point in calling this again.
+bool journal_append(
+    Journal*    journal,
+    unsigned int session,
+    step_code   code,
+    const char* from,
+    const char* to,
+    const char* command
+) {
+    unsigned long head = journal->head;
+    if (
+        head - __atomic_load_n(&journal->tail, __ATOMIC_ACQUIRE) >=
+        JOURNAL_RING_SIZE
+    ) {
+        journal->stalls++;
+        while (
+            head - __atomic_load_n(&journal->tail, __ATOMIC_ACQUIRE) >=
+            JOURNAL_RING_SIZE &&
+            !__atomic_load_n(&journal->failed, __ATOMIC_ACQUIRE)
+        ) {
+            sched_yield();
+        }
+    }
+    if (__atomic_load_n(&journal->failed, __ATOMIC_ACQUIRE))
+    {
+        return false;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    JournalRecord* record = &journal->ring[head & (JOURNAL_RING_SIZE - 1)];
+    record->timestamp_ns =
+        (unsigned long) now.tv_sec * 1000000000UL + (unsigned long) now.tv_nsec;
+    record->session = session;
+    record->code = (unsigned char) code;
+    memset(record->padding, 0, sizeof(record->padding));
+    strncpy(record->from, from, sizeof(record->from)); // These zero pad, so
+    strncpy(record->to, to, sizeof(record->to));       // nothing stale leaks
+    record->from[MAX_ROOM_NAME_LEN] = '\0';            // into the file
+    record->to[MAX_ROOM_NAME_LEN] = '\0';
+    strncpy(record->command, command, JOURNAL_COMMAND_LEN);
+    record->command[JOURNAL_COMMAND_LEN - 1] = '\0';
+
+    __atomic_store_n(&journal->head, head + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+// Drive a `Session` from stdin and stdout until the player wins or stops
+// typing. This is the only part that knows about the terminal or the time
+// thread
+int game_loop(
+    RoomCache*       rooms,
+    Room*            current_room,
+    const char*      resume_path,
+    Journal*         journal,
+    pthread_mutex_t* mutex,
+    pthread_t*       child
+) {
+    // `getline` stuff
+    char* line = NULL;
+    size_t getline_buffer_size = 0;
+    ssize_t chars_read;
+
+    // Where this turn's output piles up until it's time to wait for input
+    OutBuf out;
+    if (!init_out_buf(&out, STDOUT_FILENO))
+    {
+        fprintf(stderr, "Could not allocate the output buffer\n");
+        return 1;
+    }
+
+    Session session;
+    init_session(&session, rooms, current_room);
+    session.id = (unsigned int) getpid();
+
+    // Pick up where some earlier game left off, if we were asked to
+    if (resume_path != NULL && !engine_load(&session, resume_path, NULL))
+    {
+        _Session(&session);
+        _OutBuf(&out);
+
+        return 1;
+    }
+
+    int result = 0;
+    for (;;)
+    {
+        // The whole turn goes out in one `write`
+        if (!engine_render(&session, &out))
+        {
+            fprintf(stderr, "Could not load room %s\n",
+                    name_text(session.current_room));
+            result = 1;
+
+            break;
+        }
+        if (!out_flush(&out) || session.won)
+        {
+            break;
+        }
+
+        chars_read = mem_getline(&line, &getline_buffer_size, stdin);
+        if (chars_read == -1 && !feof(stdin) && !ferror(stdin))
+        {
+            fprintf(stderr, "Not enough memory to read a command\n");
+            result = 1;
+
+            break;
+        }
+        if (chars_read == -1)
+        {
+            break; // They left without winning
+        }
+        if (line[chars_read - 1] == '\n')
+        {
+            line[chars_read - 1] = '\0'; // Overwriting captured '\n'
+        }
+
+        name_id from = session.current_room;
+
+        StepResult step;
+        engine_step(&session, line, &step, &out);
+        if (step.code == STEP_LOAD)
+        {
+            // Before the record is made, so it says where this put them
+            engine_load(&session, step.arg, &out);
+        }
+
+        if (
+            journal != NULL &&
+            !journal_append(
+                journal,
+                session.id,
+                step.code,
+                name_text(from),
+                name_text(session.current_room),
+                line
+            )
+        ) {
+            journal = NULL; // The writer has already said why
+        }
+        if (step.code == STEP_TIME)
+        {
+            trace_begin("time");
+            pthread_mutex_unlock(mutex); // The child now gets the lock and
+                                         // uses it to write the date
+            void* res; // Dummy variable
+            pthread_join(*child, &res); // Wait for the child to finish writing
+            // Get the mutex back and bring the child back up
+            pthread_mutex_lock(mutex);
+            if (!spawn_child(child, mutex))
+            {
+                trace_end("time");
+                result = 1;
+
+                break;
+            }
+
+            // Read what the child just wrote and display it to the user
+            FILE* time_file = fopen("currentTime.txt", "r");
+            if (time_file == NULL)
+            {
+                fprintf(
+                    stderr,
+                    "Failed to open currentTime.txt for reading. errno: %s\n",
+                    strerror(errno)
+                );
+                trace_end("time");
+                result = 1;
+
+                break;
+            }
+
+            char* time_str = NULL;
+            size_t buf_size = 0;
+            bool got_time =
+                mem_getline(&time_str, &buf_size, time_file) != -1;
+            if (got_time)
+            {
+                out_printf(&out, "\n%s\n", time_str); // Print date
+            }
+            else
+            {
+                fprintf(stderr, "getline() failed on currentTime.txt\n");
+            }
+
+            // Cleanup
+            mem_free(time_str);
+            fclose(time_file);
+            trace_end("time");
+
+            if (!got_time)
+            {
+                result = 1; // R.I.P.
+
+                break;
+            }
+        }
+        else if (step.code == STEP_SAVE)
+        {
+            engine_save(&session, step.arg, &out);
+        }
+        else if (step.code == STEP_ERROR)
+        {
+            fprintf(stderr, "Could not move to room %s\n", line);
+            result = 1;
+
+            break;
+        }
+    }
+
+    // Cleanup
+    _Session(&session);
+
+    mem_free(line);
+    _OutBuf(&out);
+
+    return result;
+}
+
+// Ids of the rooms `room` connects to, in the order it lists them, written to
+// `ids` (room for `MAX_CONNECTIONS`). Only maps with real ids will do: a
+// packed one, or else the eager rooms' `store`
+int neighbor_ids(
+    const RoomCache* cache,
+    const MapStore*  store,
+    const Room*      room,
+    int*             ids
+) {
+    if (cache->packed != NULL)
+    {
+        return packed_neighbors(cache->packed, room->id, ids);
+    }
+
+    int degree = store->degrees[room->id];
+    memcpy(
+        ids,
+        &store->neighbors[(size_t) room->id * MAX_CONNECTIONS],
+        (size_t) degree * sizeof(int)
+    );
+
+    return degree;
+}
+
+// Append the record for where `session` is now (see `machine_loop`) and keep
+// the neighbors' ids in `ids` for the next move. Returns how many there are,
+// or -1 if the current room won't load
+int machine_report(
+    const Session*  session,
+    const MapStore* store,
+    int*            ids,
+    OutBuf*         out
+) {
+    const Room* room = session_room(session);
+    if (room == NULL)
+    {
+        return -1;
+    }
+    int degree = neighbor_ids(session->rooms, store, room, ids);
+    if (session->won)
+    {
+        out_printf(out, "W %d %d\n", room->id, session->path.len);
+
+        return degree;
+    }
+
+    out_printf(
+        out,
+        "R %d %c %d",
+        room->id,
+        room->type == START_ROOM ? 'S' : room->type == MID_ROOM ? 'M' : 'E',
+        degree
+    );
+    int i;
+    for (i = 0; i < degree; ++i)
+    {
+        out_printf(out, " %d", ids[i]);
+    }
+    out_append(out, "\n", 1);
+
+    return degree;
+}
+
+// Do one `--machine` request (without its '\n') and append its reply.
+// `ids` and `degree` are the current room's neighbors, and get updated if we
+// move. `false` only if the map is broken
+bool machine_step(
+    Session*        session,
+    const MapStore* store,
+    int*            ids,
+    int*            degree,
+    char*           line,
+    Journal*        journal,
+    OutBuf*         out
+) {
+    session->turns++;
+    name_id from = session->current_room;
+
+    // "#<id>" picks a neighbor by id, plain digits by where it is in the list
+    bool by_id = line[0] == '#';
+    const char* digits = by_id ? &line[1] : line;
+    char* end = NULL;
+    long value = -1;
+    if (digits[0] >= '0' && digits[0] <= '9')
+    {
+        value = strtol(digits, &end, 10);
+    }
+
+    int next_id = -1;
+    if (end != NULL && *end == '\0')
+    {
+        int i;
+        for (i = 0; i < *degree && next_id == -1; ++i)
+        {
+            if (by_id ? ids[i] == value : i == value)
+            {
+                next_id = ids[i];
+            }
+        }
+    }
+
+    StepResult step;
+    step.code = STEP_UNKNOWN;
+    step.arg = NULL;
+    if (next_id == -1)
+    {
+        const Room* room = session_room(session);
+        if (room == NULL)
+        {
+            fprintf(stderr, "Could not load room %s\n", name_text(from));
+
+            return false;
+        }
+        out_printf(out, "X %d\n", room->id);
+    }
+    else
+    {
+        Room* next_room = get_room_by_id(session->rooms, next_id);
+        if (next_room == NULL)
+        {
+            fprintf(stderr, "Could not load room %d\n", next_id);
+
+            return false;
+        }
+
+        engine_move(session, next_room, &step);
+        if (step.code == STEP_ERROR)
+        {
+            fprintf(stderr, "Not enough memory to move to room %d\n",
+                    next_id);
+
+            return false;
+        }
+        *degree = machine_report(session, store, ids, out);
+        if (*degree == -1)
+        {
+            fprintf(stderr, "Could not load room %d\n", next_id);
+
+            return false;
+        }
+    }
+
+    if (journal != NULL)
+    {
+        journal_append(
+            journal,
+            session->id,
+            step.code,
+            name_text(from),
+            name_text(session->current_room),
+            line
+        );
+    }
+
+    return true;
+}
+
+// `game_loop` for bots, who'd rather not read prompts meant for people. Each
+// request is a line holding either the index of a connection (in the order
+// the room lists them) or '#' and the id of a neighboring room, and gets
+// exactly one line back:
+//
+//     R <id> <type> <n> <neighbor ids>...  You're in <id> now (S, M or E)
+//     W <id> <steps>                       ...and that was the END room
+//     X <id>                               Not a move, you're still in <id>
+//
+// plus an `R` for the start before anything is asked. Replies don't depend on
+// anything but the requests, so a bot can send as many moves as it likes
+// without waiting; we answer everything that's arrived so far in one `write`.
+// The game ends after the `W`, and any moves still in flight are dropped.
+// Ids and the order of connections are whatever the map says, so the same
+// rooms can come out differently with and without --compressed.
+int machine_loop(
+    RoomCache*      rooms,
+    Room*           current_room,
+    const MapStore* store,
+    const char*     resume_path,
+    Journal*        journal
+) {
+    OutBuf out;
+    if (!init_out_buf(&out, STDOUT_FILENO))
+    {
+        fprintf(stderr, "Could not allocate the output buffer\n");
+        return 1;
+    }
+
+    Session session;
+    init_session(&session, rooms, current_room);
+    session.id = (unsigned int) getpid();
+
+    if (resume_path != NULL && !engine_load(&session, resume_path, NULL))
+    {
+        _Session(&session);
+        _OutBuf(&out);
+
+        return 1;
+    }
+
+    int ids[MAX_CONNECTIONS];
+    int degree = machine_report(&session, store, ids, &out);
+    if (degree == -1)
+    {
+        fprintf(stderr, "Could not load room %s\n",
+                name_text(session.current_room));
+        _Session(&session);
+        _OutBuf(&out);
+
+        return 1;
+    }
+
+    char input[MACHINE_MAX_INPUT];
+    size_t input_len = 0;
+    bool at_eof = false;
+    int result = 0;
+    while (out_flush(&out) && !session.won && !at_eof)
+    {
+        ssize_t got = read(STDIN_FILENO, &input[input_len],
+                           sizeof(input) - input_len);
+        if (got == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            // A last request without a '\n' still counts
+            at_eof = true;
+            if (input_len == 0)
+            {
+                break;
+            }
+            input[input_len++] = '\n';
+        }
+        else
+        {
+            input_len += (size_t) got;
+        }
+
+        // Everything that's complete, leaving any partial line for next time
+        size_t start = 0;
+        char* newline;
+        while (
+            !session.won &&
+            (newline = memchr(&input[start], '\n', input_len - start)) != NULL
+        ) {
+            *newline = '\0';
+            if (
+                !machine_step(&session, store, ids, &degree, &input[start],
+                              journal, &out)
+            ) {
+                result = 1;
+
+                break;
+            }
+            start = (size_t) (newline - input) + 1;
+        }
+        if (result != 0)
+        {
+            break;
+        }
+
+        input_len -= start;
+        memmove(input, &input[start], input_len);
+        if (input_len == sizeof(input))
+        {
+            fprintf(stderr, "Request longer than %d bytes\n",
+                    MACHINE_MAX_INPUT);
+            result = 1;
+
+            break;
+        }
+    }
+
+    _Session(&session);
+    _OutBuf(&out);
+
+    return result;
+}
+
+// Split the map into `shard_count` regions of (nearly) equal size with as
+// few connections between them as we can manage cheaply. The seeds are
+// spread out farthest-point style: each one is the room the most hops away
+// from every seed so far. Then every region grows breadth-first from its
+// seed, one room per region per round, until it's full; BFS keeps regions
+// compact, and compact regions have short borders. Rooms left over once the
+// regions fill up (pockets boxed in by full regions, or parts of the map
+// that can't be reached) join whichever neighboring region is smallest, and
+// last of all rooms on the borders get to switch sides if that cuts edges.
+// The first seed is `start_room`. Returns each room's shard, or `NULL` if we
+// ran out of memory.
+int* partition_map(const MapStore* store, int shard_count, int start_room)
+{
+    int room_count = store->room_count;
+    size_t count = (size_t) room_count;
+    int* shard_of = mem_alloc(MEM_MAP, count * sizeof(int));
+    int* distance = mem_alloc(MEM_MAP, count * sizeof(int));
+    int* queue = mem_alloc(MEM_MAP, count * sizeof(int));
+    int* seeds = mem_alloc(MEM_MAP, (size_t) shard_count * sizeof(int));
+    int* sizes = mem_calloc(MEM_MAP, (size_t) shard_count, sizeof(int));
+    int* heads = mem_calloc(MEM_MAP, (size_t) shard_count, sizeof(int));
+    int** frontiers = mem_calloc(MEM_MAP, (size_t) shard_count, sizeof(int*));
+    int* frontier_lens = mem_calloc(MEM_MAP, (size_t) shard_count, sizeof(int));
+    int* frontier_caps = mem_calloc(MEM_MAP, (size_t) shard_count, sizeof(int));
+    bool ok = shard_of != NULL && distance != NULL && queue != NULL &&
+              seeds != NULL && sizes != NULL && heads != NULL &&
+              frontiers != NULL && frontier_lens != NULL &&
+              frontier_caps != NULL;
+
+    int i;
+    int k;
+    for (i = 0; ok && i < room_count; ++i)
+    {
+        shard_of[i] = -1;
+    }
+    if (ok)
+    {
+        seeds[0] = start_room;
+    }
+
+    // Farthest-point seeds, with a multi-source BFS from the seeds so far
+    for (k = 1; ok && k < shard_count; ++k)
+    {
+        for (i = 0; i < room_count; ++i)
+        {
+            distance[i] = -1;
+        }
+        int tail = 0;
+        int j;
+        for (j = 0; j < k; ++j)
+        {
+            distance[seeds[j]] = 0;
+            queue[tail++] = seeds[j];
+        }
+        int head = 0;
+        while (head < tail)
+        {
+            int room = queue[head++];
+            const int* neighbors = &store->neighbors[
+                (size_t) room * MAX_CONNECTIONS
+            ];
+            for (j = 0; j < store->degrees[room]; ++j)
+            {
+                if (distance[neighbors[j]] == -1)
+                {
+                    distance[neighbors[j]] = distance[room] + 1;
+                    queue[tail++] = neighbors[j];
                 }
-                case 'T': // ROOM TYPE: ...
+            }
+        }
+
+        // Anything unreachable is as far away as it gets
+        int farthest = queue[tail - 1];
+        for (i = 0; i < room_count && tail < room_count; ++i)
+        {
+            if (distance[i] == -1)
+            {
+                farthest = i;
+
+                break;
+            }
+        }
+        seeds[k] = farthest;
+    }
+
+    // Grow the regions in lockstep, none of them past its fair share
+    int fair_share = (room_count + shard_count - 1) / shard_count;
+    for (k = 0; ok && k < shard_count; ++k)
+    {
+        frontier_caps[k] = 64;
+        frontiers[k] = mem_alloc(MEM_MAP,
+                                 (size_t) frontier_caps[k] * sizeof(int));
+        ok = frontiers[k] != NULL;
+        if (ok && shard_of[seeds[k]] == -1) // Tiny maps can repeat seeds
+        {
+            shard_of[seeds[k]] = k;
+            sizes[k] = 1;
+            frontiers[k][frontier_lens[k]++] = seeds[k];
+        }
+    }
+
+    bool grew = ok;
+    while (grew && ok)
+    {
+        grew = false;
+        for (k = 0; ok && k < shard_count; ++k)
+        {
+            if (sizes[k] >= fair_share || heads[k] >= frontier_lens[k])
+            {
+                continue;
+            }
+
+            int room = frontiers[k][heads[k]++];
+            const int* neighbors = &store->neighbors[
+                (size_t) room * MAX_CONNECTIONS
+            ];
+            int j;
+            for (j = 0; j < store->degrees[room] && sizes[k] < fair_share;
+                 ++j)
+            {
+                int neighbor = neighbors[j];
+                if (shard_of[neighbor] != -1)
                 {
-                    // There is too much error handling here but I suppose
-                    // there's no reason to remove it and make it harder to
-                    // fix anyways
-                    if (!got_name || room->connection_count < 3)
+                    continue;
+                }
+
+                if (frontier_lens[k] >= frontier_caps[k])
+                {
+                    int* bigger = mem_realloc(
+                        MEM_MAP,
+                        frontiers[k],
+                        (size_t) frontier_caps[k] * 2 * sizeof(int)
+                    );
+                    if (bigger == NULL)
                     {
-                        _Room(room);
-                        if (!got_name)
-                        {
-                            fprintf(
-                                stderr,
-                                "Parsing failed: saw 'T' but no ROOM NAME yet\n"
-                            );
-                        }
-                        else
-                        {
-                            fprintf(
-                                stderr,
-                                "Parsing failed: saw 'T' but only %d CONNECTIONs so far\n",
-                                room->connection_count
-                            );
-                        }
-                        *parse_succeeded = false;
+                        ok = false;
+
+                        break;
+                    }
+                    frontiers[k] = bigger;
+                    frontier_caps[k] *= 2;
+                }
+                shard_of[neighbor] = k;
+                sizes[k]++;
+                frontiers[k][frontier_lens[k]++] = neighbor;
+            }
+            grew = true;
+        }
+    }
+
+    // Leftovers join their smallest neighboring region, a layer at a time.
+    // If none of them has a neighbor with a region, they're off on their own
+    // and the smallest region overall takes one in to get things going again
+    int left = 0;
+    for (i = 0; ok && i < room_count; ++i)
+    {
+        left += shard_of[i] == -1;
+    }
+    while (ok && left > 0)
+    {
+        int placed = 0;
+        for (i = 0; i < room_count; ++i)
+        {
+            if (shard_of[i] != -1)
+            {
+                continue;
+            }
+
+            int best = -1;
+            const int* neighbors = &store->neighbors[
+                (size_t) i * MAX_CONNECTIONS
+            ];
+            int j;
+            for (j = 0; j < store->degrees[i]; ++j)
+            {
+                int shard = shard_of[neighbors[j]];
+                if (shard != -1 && (best == -1 || sizes[shard] < sizes[best]))
+                {
+                    best = shard;
+                }
+            }
+            if (best != -1)
+            {
+                shard_of[i] = best;
+                sizes[best]++;
+                placed++;
+            }
+        }
+
+        if (placed == 0)
+        {
+            int smallest = 0;
+            for (k = 1; k < shard_count; ++k)
+            {
+                smallest = sizes[k] < sizes[smallest] ? k : smallest;
+            }
+            for (i = 0; shard_of[i] != -1; ++i)
+            {
+            }
+            shard_of[i] = smallest;
+            sizes[smallest]++;
+            placed = 1;
+        }
+        left -= placed;
+    }
+
+    // Then smooth out the borders: a room with more neighbors in some other
+    // region than in its own moves over, as long as that doesn't push either
+    // region more than about 3% off its fair share. Every move cuts at least
+    // one connection, so this can't go on forever, but a few passes get
+    // nearly all of it
+    int slack = fair_share / 32 + 1;
+    int pass;
+    int moved = ok;
+    for (pass = 0; pass < 8 && moved > 0; ++pass)
+    {
+        moved = 0;
+        for (i = 0; i < room_count; ++i)
+        {
+            int own = shard_of[i];
+            if (sizes[own] <= fair_share - slack)
+            {
+                continue;
+            }
+
+            const int* neighbors = &store->neighbors[
+                (size_t) i * MAX_CONNECTIONS
+            ];
+            int own_count = 0;
+            int j;
+            for (j = 0; j < store->degrees[i]; ++j)
+            {
+                own_count += shard_of[neighbors[j]] == own;
+            }
+
+            int best = own;
+            int best_count = own_count;
+            for (j = 0; j < store->degrees[i]; ++j)
+            {
+                int shard = shard_of[neighbors[j]];
+                if (shard == best || sizes[shard] >= fair_share + slack)
+                {
+                    continue;
+                }
+
+                int count_here = 0;
+                int l;
+                for (l = 0; l < store->degrees[i]; ++l)
+                {
+                    count_here += shard_of[neighbors[l]] == shard;
+                }
+                if (count_here > best_count)
+                {
+                    best = shard;
+                    best_count = count_here;
+                }
+            }
+
+            if (best != own)
+            {
+                shard_of[i] = best;
+                sizes[own]--;
+                sizes[best]++;
+                moved++;
+            }
+        }
+    }
+
+    // Cleanup
+    for (k = 0; frontiers != NULL && k < shard_count; ++k)
+    {
+        mem_free(frontiers[k]);
+    }
+    mem_free(frontiers);
+    mem_free(frontier_lens);
+    mem_free(frontier_caps);
+    mem_free(heads);
+    mem_free(sizes);
+    mem_free(seeds);
+    mem_free(queue);
+    mem_free(distance);
+
+    if (!ok)
+    {
+        fprintf(stderr, "Not enough memory to partition %d rooms\n",
+                room_count);
+        mem_free(shard_of);
+
+        return NULL;
+    }
+
+    return shard_of;
+}
+
+// How many connections go between two different shards
+long count_cut_edges(const MapStore* store, const int* shard_of)
+{
+    long cut = 0;
+    int i;
+    for (i = 0; i < store->room_count; ++i)
+    {
+        const int* neighbors = &store->neighbors[(size_t) i * MAX_CONNECTIONS];
+        int j;
+        for (j = 0; j < store->degrees[i]; ++j)
+        {
+            cut += shard_of[neighbors[j]] != shard_of[i];
+        }
+    }
+
+    return cut / 2; // Every connection got counted from both ends
+}
+
+// Partition the map in `dir_path` into `shard_count` shards, write the
+// result to `.shards` and say how it went. Returns 0 on success
+int run_partition(const char* dir_path, int shard_count)
+{
+    Room** room_buffer = NULL;
+    int room_count = parse_room_dir(dir_path, &room_buffer);
+    if (room_count <= 0)
+    {
+        mem_free(room_buffer);
+
+        return 1;
+    }
+
+    MapStore store;
+    bool ok = build_map_store(room_buffer, room_count, false, &store);
+    int i;
+    for (i = 0; i < room_count; ++i)
+    {
+        _Room(room_buffer[i]);
+        mem_free(room_buffer[i]);
+    }
+    mem_free(room_buffer);
+    if (!ok)
+    {
+        return 1;
+    }
+
+    // Everybody starts in the START_ROOM, so that's where the first shard
+    // grows from (and the table says which one it is)
+    int start_room = -1;
+    int start_count = 0;
+    for (i = 0; i < room_count; ++i)
+    {
+        if (store.types[i] == START_ROOM)
+        {
+            start_room = i;
+            start_count++;
+        }
+    }
+    if (start_count != 1)
+    {
+        fprintf(stderr, "%s: %d START_ROOMs, should be 1 (try --check)\n",
+                dir_path, start_count);
+        _MapStore(&store);
+
+        return 1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int* shard_of = partition_map(&store, shard_count, start_room);
+    double partition_ms = elapsed_ms(&start);
+    if (shard_of == NULL)
+    {
+        _MapStore(&store);
+
+        return 1;
+    }
+
+    char path_buffer[512];
+    snprintf(path_buffer, 512, "%s/%s", dir_path, SHARD_FILE_NAME);
+    FILE* file_handle = fopen(path_buffer, "wb");
+    if (file_handle == NULL)
+    {
+        fprintf(
+            stderr,
+            "fopen(\"%s\", \"wb\") failed with: \"%s\"\n",
+            path_buffer,
+            strerror(errno)
+        );
+        mem_free(shard_of);
+        _MapStore(&store);
+
+        return 1;
+    }
+
+    unsigned char header[4 + 1 + 3 * 10];
+    size_t len = 0;
+    memcpy(header, "CSHD", 4);
+    len += 4;
+    header[len++] = SHARD_VERSION;
+    len += put_varint(&header[len], (unsigned long) shard_count);
+    len += put_varint(&header[len], (unsigned long) room_count);
+    len += put_varint(&header[len], (unsigned long) start_room);
+    fwrite(header, 1, len, file_handle);
+
+    // Rooms are already in name order, courtesy of `parse_room_dir`
+    int* sizes = mem_calloc(MEM_MAP, (size_t) shard_count, sizeof(int));
+    for (i = 0; i < room_count; ++i)
+    {
+        fputc(shard_of[i], file_handle);
+        const char* name = name_text(store.names[i]);
+        fwrite(name, 1, strlen(name) + 1, file_handle);
+        if (sizes != NULL)
+        {
+            sizes[shard_of[i]]++;
+        }
+    }
+
+    if (fclose(file_handle) != 0)
+    {
+        fprintf(stderr, "Writing \"%s\" failed with: \"%s\"\n", path_buffer,
+                strerror(errno));
+        ok = false;
+    }
+
+    // How it compares to just dealing rooms out in name order, which is
+    // what you'd get by hashing names
+    long cut = count_cut_edges(&store, shard_of);
+    for (i = 0; i < room_count; ++i)
+    {
+        shard_of[i] = i % shard_count;
+    }
+    long dealt_cut = count_cut_edges(&store, shard_of);
+
+    long edges = 0;
+    for (i = 0; i < room_count; ++i)
+    {
+        edges += store.degrees[i];
+    }
+    edges /= 2;
+
+    int smallest = room_count;
+    int largest = 0;
+    for (i = 0; sizes != NULL && i < shard_count; ++i)
+    {
+        smallest = sizes[i] < smallest ? sizes[i] : smallest;
+        largest = sizes[i] > largest ? sizes[i] : largest;
+    }
+
+    if (ok)
+    {
+        printf(
+            "%d rooms into %d shards of %d to %d rooms in %.1f ms\n",
+            room_count,
+            shard_count,
+            smallest,
+            largest,
+            partition_ms
+        );
+        printf(
+            "Cut edges: %ld of %ld (%.2f%%), vs %ld (%.2f%%) dealt out by "
+            "name\n",
+            cut,
+            edges,
+            100.0 * (double) cut / (double) edges,
+            dealt_cut,
+            100.0 * (double) dealt_cut / (double) edges
+        );
+    }
+
+    mem_free(sizes);
+    mem_free(shard_of);
+    _MapStore(&store);
+
+    return ok ? 0 : 1;
+}
+
+// Read `.shards` from `dir_path`. `false` (after saying why) on failure
+bool load_shard_table(const char* dir_path, ShardTable* table)
+{
+    memset(table, 0, sizeof(ShardTable));
+
+    char path_buffer[512];
+    snprintf(path_buffer, 512, "%s/%s", dir_path, SHARD_FILE_NAME);
+    FILE* file_handle = fopen(path_buffer, "rb");
+    struct stat sb;
+    if (file_handle == NULL || fstat(fileno(file_handle), &sb) == -1)
+    {
+        fprintf(
+            stderr,
+            "Could not open \"%s\": \"%s\" (--partition writes it)\n",
+            path_buffer,
+            strerror(errno)
+        );
+        if (file_handle != NULL)
+        {
+            fclose(file_handle);
+        }
+
+        return false;
+    }
+
+    size_t bytes_len = (size_t) sb.st_size;
+    table->bytes = mem_alloc(MEM_MAP, bytes_len + 1);
+    bool ok = table->bytes != NULL &&
+              fread(table->bytes, 1, bytes_len, file_handle) == bytes_len;
+    fclose(file_handle);
+    if (table->bytes != NULL)
+    {
+        table->bytes[bytes_len] = '\0'; // So a truncated name still ends
+    }
+
+    size_t pos = 5;
+    unsigned long shard_count = 0;
+    unsigned long room_count = 0;
+    unsigned long start_room = 0;
+    ok = ok && bytes_len >= 5 && memcmp(table->bytes, "CSHD", 4) == 0 &&
+         table->bytes[4] == SHARD_VERSION &&
+         get_varint(table->bytes, bytes_len, &pos, &shard_count) &&
+         get_varint(table->bytes, bytes_len, &pos, &room_count) &&
+         get_varint(table->bytes, bytes_len, &pos, &start_room) &&
+         shard_count >= 1 && shard_count <= MAX_SHARDS &&
+         start_room < room_count && room_count <= bytes_len;
+    bool out_of_memory = table->bytes == NULL;
+    if (ok)
+    {
+        table->shard_count = (int) shard_count;
+        table->room_count = (int) room_count;
+        table->start_room = (int) start_room;
+        table->name_offsets = mem_alloc(MEM_MAP, room_count * sizeof(size_t));
+        out_of_memory = table->name_offsets == NULL;
+        ok = !out_of_memory;
+    }
+
+    // Each record is a shard byte and a name that runs up to its NUL.
+    // `find_shard` binary searches them, so the names have to be in strictly
+    // increasing order
+    unsigned long room;
+    for (room = 0; ok && room < room_count; ++room)
+    {
+        ok = pos + 1 < bytes_len && table->bytes[pos] < shard_count;
+        if (ok)
+        {
+            table->name_offsets[room] = pos + 1;
+            pos += 1 + strlen((const char*) &table->bytes[pos + 1]) + 1;
+            ok = room == 0 || strcmp(
+                (const char*) &table->bytes[table->name_offsets[room - 1]],
+                (const char*) &table->bytes[table->name_offsets[room]]
+            ) < 0;
+        }
+    }
 
-                        return room;
-                    }
+    if (!ok)
+    {
+        if (out_of_memory)
+        {
+            fprintf(stderr, "Not enough memory to load \"%s\"\n",
+                    path_buffer);
+        }
+        else
+        {
+            fprintf(stderr, "\"%s\" is not a version %d shard table\n",
+                    path_buffer, SHARD_VERSION);
+        }
+        _ShardTable(table);
+    }
 
-                    // Due to the format, again, we only need the first
-                    // character of the room type token
-                    switch (property_value[0])
-                    {
-                        case 'S': // START_ROOM
-                            room->type = START_ROOM;
-                            break;
-                        case 'M': // MID_ROOM
-                            room->type = MID_ROOM;
-                            break;
-                        default:  // END_ROOM
-                            room->type = END_ROOM;
-                            break;
-                    }
-                    break;
-                }
-                default:  // CONNECTION #: ...
-                {
-                    if (!got_name || room->connection_count >= 6)
-                    {
-                        _Room(room);
-                        if (!got_name)
-                        {
-                            fprintf(
-                                stderr,
-                                "Parsing failed: saw %c, but no ROOM NAME yet\n",
-                                second_token[0]
-                            );
-                        }
-                        else
-                        {
-                            fprintf(
-                                stderr,
-                                "Parsing failed: saw %c, but there's already %d connections\n",
-                                second_token[0],
-                                room->connection_count
-                            );
-                        }
-                        *parse_succeeded = false;
+    return ok;
+}
 
-                        return room;
-                    }
+// Destructor for `ShardTable`
+void _ShardTable(ShardTable* table)
+{
+    mem_free(table->bytes);
+    mem_free(table->name_offsets);
+    table->bytes = NULL;
+    table->name_offsets = NULL;
+}
+
+// Which shard the room called `name` is in, or -1 if it isn't anywhere.
+// Binary search, since the table is in name order
+int find_shard(const ShardTable* table, const char* name)
+{
+    int low = 0;
+    int high = table->room_count - 1;
+    while (low <= high)
+    {
+        int middle = low + (high - low) / 2;
+        size_t offset = table->name_offsets[middle];
+        int order = strcmp((const char*) &table->bytes[offset], name);
+        if (order == 0)
+        {
+            return table->bytes[offset - 1];
+        }
+        if (order < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+
+    return -1;
+}
+
+// Where shard `shard`'s socket of the given `kind` ("sock" for players,
+// "handoff" for the other shards) lives. `buffer` has to fit a
+// `sockaddr_un` path
+void shard_socket_path(
+    char*       buffer,
+    const char* socket_dir,
+    int         shard,
+    const char* kind
+) {
+    struct sockaddr_un address;
+    snprintf(buffer, sizeof(address.sun_path), "%s/comitoz.shard.%d.%s",
+             socket_dir, shard, kind);
+}
+
+// Bind this shard's two sockets. `false` (after saying why) on failure
+bool open_shard_server(ShardServer* server)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    server->handoff_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (server->listen_fd == -1 || server->handoff_fd == -1)
+    {
+        fprintf(stderr, "socket() failed with: \"%s\"\n", strerror(errno));
+
+        return false;
+    }
+
+    // Sockets left over from a server that died are fair game
+    shard_socket_path(address.sun_path, server->socket_dir, server->shard,
+                      "sock");
+    unlink(address.sun_path);
+    if (
+        bind(server->listen_fd, (struct sockaddr*) &address,
+             sizeof(address)) == -1 ||
+        listen(server->listen_fd, 128) == -1
+    ) {
+        fprintf(stderr, "Could not listen on \"%s\": \"%s\"\n",
+                address.sun_path, strerror(errno));
+
+        return false;
+    }
+
+    shard_socket_path(address.sun_path, server->socket_dir, server->shard,
+                      "handoff");
+    unlink(address.sun_path);
+    if (
+        bind(server->handoff_fd, (struct sockaddr*) &address,
+             sizeof(address)) == -1
+    ) {
+        fprintf(stderr, "Could not bind \"%s\": \"%s\"\n", address.sun_path,
+                strerror(errno));
+
+        return false;
+    }
+
+    return true;
+}
+
+// Start serving a player on `fd` who's standing in `room`. Returns `NULL`
+// (and closes `fd`) if we're out of memory
+ShardClient* add_shard_client(ShardServer* server, int fd, Room* room)
+{
+    ShardClient* client = mem_alloc(MEM_SESSION, sizeof(ShardClient));
+    if (client != NULL)
+    {
+        client->input_cap = 256;
+        client->input = mem_alloc(MEM_IO, client->input_cap);
+        if (client->input == NULL || !init_out_buf(&client->output, fd))
+        {
+            mem_free(client->input);
+            client->input = NULL;
+        }
+    }
+    bool have_slot = server->client_count < server->client_cap;
+    if (client != NULL && !have_slot)
+    {
+        int cap = server->client_cap == 0 ? 16 : server->client_cap * 2;
+        ShardClient** clients = mem_realloc(
+            MEM_SESSION,
+            server->clients,
+            (size_t) cap * sizeof(ShardClient*)
+        );
+        if (clients != NULL)
+        {
+            server->clients = clients;
+            server->client_cap = cap;
+            have_slot = true;
+        }
+    }
+    if (client == NULL || client->input == NULL || !have_slot)
+    {
+        fprintf(stderr, "Not enough memory for another player\n");
+        if (client != NULL && client->input != NULL)
+        {
+            mem_free(client->input);
+            _OutBuf(&client->output);
+        }
+        mem_free(client);
+        close(fd);
+
+        return NULL;
+    }
+
+    // Handed-in sockets are already this way, since the flag belongs to the
+    // socket rather than to the fd, but new ones aren't
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    client->fd = fd;
+    client->input_len = 0;
+    client->typed_ahead = false;
+    client->closing = false;
+    init_session(&client->session, server->rooms, room);
+    client->session.id = (unsigned int) fd;
+    server->clients[server->client_count++] = client;
+
+    return client;
+}
+
+// Forget about client `index`, without closing its socket (it might be
+// somebody else's now)
+void drop_shard_client(ShardServer* server, int index)
+{
+    ShardClient* client = server->clients[index];
+    _Session(&client->session);
+    mem_free(client->input);
+    _OutBuf(&client->output);
+    mem_free(client);
+
+    server->clients[index] = server->clients[--server->client_count];
+}
+
+// Send the player on `fd` to the shard that owns `room_name`: their session
+// (with `room_name` as where they are now) goes into a memfd, which goes
+// across with their socket in one `sendmsg`. `pending` is input they've
+// already sent that we haven't gotten to, and `unsent` (if not `NULL`) is
+// output their socket hasn't taken yet, which the other shard sends before
+// anything of its own. We close our copy of `fd` either way. Returns `false`
+// (after saying why) if the handoff failed. Names go across as text, since
+// every process interns its own.
+bool hand_off_client(
+    ShardServer* server,
+    int          fd,
+    name_id      room_name,
+    const Session* session,
+    const char*  pending,
+    size_t       pending_len,
+    const OutBuf* unsent
+) {
+    int shard = find_shard(server->table, name_text(room_name));
+    size_t unsent_len = unsent != NULL ? unsent->len : 0;
+
+    // Turns, the path, where they are, what they've typed and what they
+    // haven't been told yet. A memfd has no size limit, unlike the datagram
+    // itself, so long games are fine
+    size_t cap = 64 + pending_len + unsent_len +
+                 (size_t) session->path.len * (MAX_ROOM_NAME_LEN + 10);
+    unsigned char* state = mem_alloc(MEM_SESSION, cap);
+    int state_fd = (int) syscall(SYS_memfd_create, "comitoz-handoff", 0);
+    bool ok = state != NULL && state_fd != -1 && shard != -1;
+    if (ok)
+    {
+        size_t len = 0;
+        len += put_varint(&state[len], (unsigned long) session->turns);
+        len += put_varint(&state[len], (unsigned long) session->path.len);
+        int i;
+        for (i = 0; i < session->path.len; ++i)
+        {
+            const char* name = name_text(session->path.names[i]);
+            size_t name_len = strlen(name);
+            len += put_varint(&state[len], name_len);
+            memcpy(&state[len], name, name_len);
+            len += name_len;
+        }
+        const char* name = name_text(room_name);
+        size_t name_len = strlen(name);
+        len += put_varint(&state[len], name_len);
+        memcpy(&state[len], name, name_len);
+        len += name_len;
+        len += put_varint(&state[len], pending_len);
+        memcpy(&state[len], pending, pending_len);
+        len += pending_len;
+        len += put_varint(&state[len], unsent_len);
+        if (unsent_len > 0)
+        {
+            memcpy(&state[len], unsent->data, unsent_len);
+            len += unsent_len;
+        }
+
+        ok = write(state_fd, state, len) == (ssize_t) len;
+    }
+
+    if (ok)
+    {
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        shard_socket_path(address.sun_path, server->socket_dir, shard,
+                          "handoff");
+
+        unsigned char version = SHARD_VERSION;
+        struct iovec payload = {&version, 1};
+        union
+        {
+            char           buffer[CMSG_SPACE(2 * sizeof(int))];
+            struct cmsghdr align;
+        } control;
+        memset(&control, 0, sizeof(control));
+
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_name = &address;
+        message.msg_namelen = sizeof(address);
+        message.msg_iov = &payload;
+        message.msg_iovlen = 1;
+        message.msg_control = control.buffer;
+        message.msg_controllen = sizeof(control.buffer);
+
+        struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(2 * sizeof(int));
+        int fds[2] = {fd, state_fd};
+        memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+        // Datagram queues are short, and the shard we're sending to might
+        // be stuck sending to us at this very moment, so rather than block
+        // we take in whoever's waiting for us and try again
+        int tries = 0;
+        ok = sendmsg(server->handoff_fd, &message, MSG_DONTWAIT) == 1;
+        while (
+            !ok && (errno == EAGAIN || errno == EINTR) &&
+            ++tries < HANDOFF_TRIES && !shard_server_stopping
+        ) {
+            receive_handoff(server);
+            struct pollfd handoff = {server->handoff_fd, POLLIN, 0};
+            poll(&handoff, 1, HANDOFF_RETRY_MS);
+            ok = sendmsg(server->handoff_fd, &message, MSG_DONTWAIT) == 1;
+        }
+        if (!ok)
+        {
+            fprintf(stderr, "Handing off to shard %d failed with: \"%s\"\n",
+                    shard, strerror(errno));
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Could not hand off a player headed for %s\n",
+                name_text(room_name));
+    }
+
+    mem_free(state);
+    if (state_fd != -1)
+    {
+        close(state_fd);
+    }
+    close(fd);
+    server->handoffs_out += ok;
+
+    return ok;
+}
+
+// Take in a player that another shard sent us (see `hand_off_client`), and
+// show them where they are
+void receive_handoff(ShardServer* server)
+{
+    unsigned char version;
+    struct iovec payload = {&version, 1};
+    union
+    {
+        char           buffer[CMSG_SPACE(2 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &payload;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    if (recvmsg(server->handoff_fd, &message, MSG_DONTWAIT) != 1)
+    {
+        return;
+    }
+
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    if (
+        header == NULL || header->cmsg_type != SCM_RIGHTS ||
+        header->cmsg_len != CMSG_LEN(2 * sizeof(int))
+    ) {
+        fprintf(stderr, "Got a handoff without a player in it\n");
+
+        return;
+    }
+    int fds[2];
+    memcpy(fds, CMSG_DATA(header), sizeof(fds));
+    int fd = fds[0];
+
+    struct stat sb;
+    unsigned char* state = NULL;
+    size_t state_len = 0;
+    if (fstat(fds[1], &sb) == 0)
+    {
+        state_len = (size_t) sb.st_size;
+        state = mem_alloc(MEM_SESSION, state_len + 1);
+    }
+    bool ok = state != NULL && version == SHARD_VERSION &&
+              pread(fds[1], state, state_len, 0) == (ssize_t) state_len;
+    close(fds[1]);
+
+    // Decode the session
+    size_t pos = 0;
+    unsigned long turns = 0;
+    unsigned long path_len = 0;
+    ok = ok && get_varint(state, state_len, &pos, &turns) &&
+         get_varint(state, state_len, &pos, &path_len) &&
+         path_len <= state_len;
+
+    PathHistory path;
+    init_path_history(&path);
+    char text[MAX_ROOM_NAME_LEN + 1];
+    name_id name = NO_NAME;
+    unsigned long step;
+    unsigned long name_len = 0;
+    for (step = 0; ok && step <= path_len; ++step)
+    {
+        // The last name is where they are now
+        ok = get_varint(state, state_len, &pos, &name_len) &&
+             name_len <= MAX_ROOM_NAME_LEN && pos + name_len <= state_len;
+        if (ok)
+        {
+            memcpy(text, &state[pos], name_len);
+            text[name_len] = '\0';
+            pos += name_len;
+            name = intern_name(text);
+            ok = name != NO_NAME;
+        }
+        if (ok && step < path_len)
+        {
+            ok = path_push(&path, name, -1);
+        }
+    }
+    unsigned long pending_len = 0;
+    unsigned long unsent_len = 0;
+    size_t unsent_pos = 0;
+    ok = ok && get_varint(state, state_len, &pos, &pending_len) &&
+         pos + pending_len <= state_len &&
+         pending_len <= SHARD_MAX_INPUT;
+    if (ok)
+    {
+        unsent_pos = pos + pending_len;
+        ok = get_varint(state, state_len, &unsent_pos, &unsent_len) &&
+             unsent_pos + unsent_len <= state_len;
+    }
+
+    Room* room = ok ? get_room(server->rooms, name) : NULL;
+    ShardClient* client = room != NULL
+                              ? add_shard_client(server, fd, room) : NULL;
+    if (client == NULL)
+    {
+        fprintf(stderr, "Dropping a player we couldn't take in\n");
+        _PathHistory(&path);
+        mem_free(state);
+        if (room == NULL)
+        {
+            close(fd);
+        }
+
+        return;
+    }
+
+    _PathHistory(&client->session.path);
+    client->session.path = path;
+    client->session.turns = (int) turns;
+    if (pending_len > client->input_cap)
+    {
+        char* input = mem_realloc(MEM_IO, client->input, pending_len);
+        if (input == NULL)
+        {
+            // They'll have to retype whatever they typed ahead
+            pending_len = 0;
+        }
+        else
+        {
+            client->input = input;
+            client->input_cap = pending_len;
+        }
+    }
+    memcpy(client->input, &state[pos], pending_len);
+    client->input_len = pending_len;
+    server->handoffs_in++;
+
+    // Same output as if they'd never left the process they started in, with
+    // whatever the last shard didn't get to send first
+    out_append(&client->output, (const char*) &state[unsent_pos],
+               unsent_len);
+    mem_free(state);
+    bool rendered = engine_render(&client->session, &client->output);
+
+    // What they typed ahead might already be a whole command, and nothing
+    // new is going to show up on their socket to tell `poll`
+    client->typed_ahead = client->input_len > 0;
+    client->closing = client->session.won || !rendered;
+    send_client_output(server, server->client_count - 1);
+}
+
+// Send client `index` whatever of their output their socket will take. Once
+// a client we're done with has had all of theirs, they're dropped. Returns
+// `false` if they've been dropped
+bool send_client_output(ShardServer* server, int index)
+{
+    ShardClient* client = server->clients[index];
+    if (
+        !out_send(&client->output) ||
+        (client->closing && client->output.len == 0)
+    ) {
+        close(client->fd);
+        drop_shard_client(server, index);
+
+        return false;
+    }
+
+    return true;
+}
+
+// Read whatever client `index` sent (without waiting for more) and handle
+// every complete line of it, with all the replies going out in one write
+// (or as much of it as their socket takes). Returns `false` if the client
+// is gone (hung up, won, or got handed off), in which case they've been
+// dropped, or will be once they've been sent the rest of their output.
+bool serve_client_input(ShardServer* server, int index)
+{
+    ShardClient* client = server->clients[index];
+    client->typed_ahead = false;
+    if (client->input_len + 512 > client->input_cap)
+    {
+        char* input = mem_realloc(MEM_IO, client->input,
+                                  client->input_cap * 2);
+        if (input == NULL)
+        {
+            fprintf(stderr, "Not enough memory for a client's input\n");
+            close(client->fd);
+            drop_shard_client(server, index);
+
+            return false;
+        }
+        client->input = input;
+        client->input_cap *= 2;
+    }
+
+    ssize_t got = recv(client->fd, &client->input[client->input_len],
+                       client->input_cap - client->input_len, MSG_DONTWAIT);
+    if (got > 0)
+    {
+        client->input_len += (size_t) got;
+    }
+    // If they've stopped typing, we still owe them replies to what they
+    // typed before that
+    bool hung_up = got == 0 || (got == -1 && errno != EAGAIN &&
+                                errno != EINTR);
+    bool gone = false;
+    OutBuf* out = &client->output;
+
+    size_t used = 0;
+    while (!gone)
+    {
+        char* line = &client->input[used];
+        char* newline = memchr(line, '\n', client->input_len - used);
+        if (newline == NULL)
+        {
+            break;
+        }
+        *newline = '\0';
+        used = (size_t) (newline - client->input) + 1;
+
+        Session* session = &client->session;
+        const Room* room = session_room(session);
+        if (room == NULL)
+        {
+            gone = true;
+
+            break;
+        }
+
+        // Walking into another shard means going to its server, with
+        // whatever they typed after this
+        name_id choice = find_name(line);
+        int i;
+        for (i = 0; i < room->connection_count; ++i)
+        {
+            if (room->connections[i] == choice)
+            {
+                break;
+            }
+        }
+        if (
+            i < room->connection_count &&
+            find_shard(server->table, line) != server->shard
+        ) {
+            session->turns++;
+            if (!path_push(&session->path, choice, -1))
+            {
+                fprintf(stderr, "Not enough memory to hand a player off\n");
+                gone = true;
+
+                break;
+            }
+            hand_off_client(server, client->fd, choice, session,
+                            &client->input[used], client->input_len - used,
+                            out);
+            drop_shard_client(server, index);
+
+            return false;
+        }
+
+        StepResult step;
+        engine_step(session, line, &step, out);
+        if (step.code == STEP_TIME)
+        {
+            char time_str[64];
+            format_current_time(time_str);
+            out_printf(out, "\n%s\n", time_str);
+        }
+        else if (step.code == STEP_SAVE)
+        {
+            engine_save(session, step.arg, out);
+        }
+        else if (step.code == STEP_LOAD)
+        {
+            engine_load(session, step.arg, out);
+        }
+        else if (step.code == STEP_ERROR || step.code == STEP_OVER)
+        {
+            gone = true;
+
+            break;
+        }
+        if (!engine_render(session, out))
+        {
+            gone = true;
+
+            break;
+        }
+        if (session->won)
+        {
+            gone = true;
+        }
+    }
+
+    memmove(client->input, &client->input[used], client->input_len - used);
+    client->input_len -= used;
+    if (hung_up || client->input_len >= SHARD_MAX_INPUT) // That's no room
+    {                                                   // name
+        gone = true;
+    }
+
+    client->closing = gone;
+
+    return send_client_output(server, index) && !gone;
+}
+
+// A new player showed up. Everybody starts in the START_ROOM, so they
+// either stay here or go straight to the shard that has it
+void accept_shard_client(ShardServer* server)
+{
+    int fd = accept(server->listen_fd, NULL, NULL);
+    if (fd == -1)
+    {
+        return;
+    }
+
+    const ShardTable* table = server->table;
+    name_id start_name = intern_name(
+        (const char*) &table->bytes[table->name_offsets[table->start_room]]
+    );
+    if (start_name == NO_NAME)
+    {
+        close(fd);
+
+        return;
+    }
+    if (table->bytes[table->name_offsets[table->start_room] - 1] !=
+        server->shard)
+    {
+        Session fresh;
+        memset(&fresh, 0, sizeof(Session));
+        init_path_history(&fresh.path);
+        hand_off_client(server, fd, start_name, &fresh, NULL, 0, NULL);
+        _PathHistory(&fresh.path);
 
-                    // This looks sketchy but don't worry because we have the
-                    // `_Room` function which is basically a destructor that
-                    // takes care of this balogna
-                    char* connection_name = malloc(20 * sizeof(char));
-                    strcpy(connection_name, property_value);
+        return;
+    }
 
-                    room->connections[room->connection_count] =
-                        connection_name;
-                    room->connection_count++;
-                    break;
-                }
-            }
+    Room* room = get_room(server->rooms, start_name);
+    ShardClient* client = room != NULL
+                              ? add_shard_client(server, fd, room) : NULL;
+    if (client == NULL)
+    {
+        if (room == NULL)
+        {
+            close(fd);
         }
 
-        // Consume the next line 'fore we go 'round again
-        chars_read = getline(&line, &getline_buffer_len, file_handle);
+        return;
     }
 
-    free(line); // I have ethical objections to nonfree lines
-    *parse_succeeded = true;
+    client->closing = !engine_render(&client->session, &client->output);
+    send_client_output(server, server->client_count - 1);
+}
 
-    return room;
+// Signal handler for shard servers
+void stop_shard_server(int signal_number)
+{
+    (void) signal_number;
+    shard_server_stopping = 1;
 }
 
-// Convert `room_type` enum into its string representation
-const char* room_type_to_str(room_type rt)
+// Serve shard `options->serve_shard` of the map in `dir_path` until we're
+// told to stop. Rooms are loaded lazily, so only this shard's rooms (and at
+// most `options->cache_size` of them) are ever in memory. Returns 0 if it
+// was a clean exit
+int run_shard_server(const char* dir_path, const Options* options)
 {
-    switch (rt)
+    ShardTable table;
+    if (!load_shard_table(dir_path, &table))
     {
-        case START_ROOM:
-            return "START_ROOM";
-        case MID_ROOM:
-            return "MID_ROOM";
-        case END_ROOM:
-            return "END_ROOM";
-        default:
-            return "wat"; // If you get this you almost certainly have
-                          // uninitialized memory or some other sort of nasal
-                          // demon
+        return 1;
     }
-}
+    if (options->serve_shard >= table.shard_count)
+    {
+        fprintf(stderr, "The map only has %d shards\n", table.shard_count);
+        _ShardTable(&table);
 
-int game_loop(
-    Room**           room_buffer,
-    int              room_count,
-    Room*            current_room,
-    pthread_mutex_t* mutex,
-    pthread_t*       child
-) {
-    // `getline` stuff
-    char* line = NULL;
-    size_t getline_buffer_size = 0;
-    ssize_t chars_read;
+        return 1;
+    }
+
+    // A room that's been added since the table was made has no shard, and
+    // walking into it would lose the player. `--edit` deletes the table, but
+    // the map might have been changed some other way
+    char** file_names;
+    int file_count = list_room_files(dir_path, &file_names);
+    if (file_count != -1)
+    {
+        _FileNames(file_names, file_count);
+    }
+    if (file_count != -1 && file_count != table.room_count)
+    {
+        fprintf(stderr, "The shard table has %d rooms but the map has %d, "
+                "so run --partition again\n", table.room_count, file_count);
+    }
+    if (file_count != table.room_count)
+    {
+        _ShardTable(&table);
+
+        return 1;
+    }
+
+    RoomCache rooms;
+    if (!init_room_cache(&rooms, dir_path, NULL, options->cache_size))
+    {
+        _ShardTable(&table);
+
+        return 1;
+    }
 
-    // Path history storage
-    int path_history_cap = 16;
-    char** path_history = malloc(path_history_cap * sizeof(char*));
-    int path_history_len = 0;
+    ShardServer server;
+    memset(&server, 0, sizeof(ShardServer));
+    server.shard = options->serve_shard;
+    server.table = &table;
+    server.rooms = &rooms;
+    server.socket_dir = options->socket_dir;
+    bool ok = open_shard_server(&server);
 
-    bool changed_room = false;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_shard_server; // No SA_RESTART, so `poll` wakes
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN); // Players hang up whenever they like
 
-    do
+    struct pollfd* fds = NULL;
+    int fds_cap = 0;
+    while (ok && !shard_server_stopping)
     {
-        if (changed_room)
+        if (server.client_count + 2 > fds_cap)
         {
-            if (path_history_len >= path_history_cap)
+            int cap = 2 * (server.client_count + 2);
+            struct pollfd* bigger = mem_realloc(
+                MEM_IO,
+                fds,
+                (size_t) cap * sizeof(struct pollfd)
+            );
+            if (bigger == NULL)
             {
-                // Reallocate more storage for the history if necessary
-                path_history_cap *= 2;
-                path_history = realloc(
-                    path_history,
-                    path_history_cap * sizeof(char*)
-                );
-            }
-            // Update path history
-            char* current_path_point = malloc(20 * sizeof(char));
-            strcpy(current_path_point, current_room->name);
-            path_history[path_history_len] = current_path_point;
-            path_history_len++;
+                fprintf(stderr, "Not enough memory to poll %d players\n",
+                        server.client_count);
+                ok = false;
 
-            changed_room = false;
+                break;
+            }
+            fds = bigger;
+            fds_cap = cap;
         }
-
-        if (current_room->type == END_ROOM)
+        fds[0].fd = server.listen_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = server.handoff_fd;
+        fds[1].events = POLLIN;
+        int i;
+        for (i = 0; i < server.client_count; ++i)
         {
-            break;
+            fds[i + 2].fd = server.clients[i]->fd;
+            fds[i + 2].events = server.clients[i]->output.len > 0
+                                    ? POLLOUT : POLLIN;
         }
 
-        printf("CURRENT LOCATION: %s\n", current_room->name);
-        printf("POSSIBLE CONNECTIONS: %s", current_room->connections[0]);
-        int i;
-        for (i = 1; i < current_room->connection_count; ++i)
+        int poll_count = server.client_count + 2;
+        if (poll(fds, (nfds_t) poll_count, -1) == -1)
         {
-            printf(", %s", current_room->connections[i]);
-        }
-        printf(".\n");
-        printf("WHERE TO? >");
+            ok = errno == EINTR;
 
-        chars_read = getline(&line, &getline_buffer_size, stdin);
+            continue;
+        }
 
-        line[chars_read - 1] = '\0'; // Overwriting captured '\n'
-        if (strcmp(line, "time") == 0)
+        // Clients first, back to front, since handling one can drop it
+        // (which moves the last one into its place)
+        for (i = poll_count - 1; i >= 2; --i)
         {
-            pthread_mutex_unlock(mutex); // The child now gets the lock and
-                                         // uses it to write the date
-            void* res; // Dummy variable
-            pthread_join(*child, &res); // Wait for the child to finish writing
-            // Get the mutex back and bring the child back up
-            pthread_mutex_lock(mutex);
-            if (!spawn_child(child, mutex))
+            if (fds[i].revents != 0 && i - 2 < server.client_count &&
+                server.clients[i - 2]->fd == fds[i].fd)
             {
-                return 1;
+                if (fds[i].events == POLLOUT)
+                {
+                    send_client_output(&server, i - 2);
+                }
+                else
+                {
+                    serve_client_input(&server, i - 2);
+                }
             }
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            receive_handoff(&server);
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            accept_shard_client(&server);
+        }
 
-            // Read what the child just wrote and display it to the user
-            FILE* time_file = fopen("currentTime.txt", "r");
-            if (time_file == NULL)
+        // Players who showed up with commands already in hand. Serving one
+        // can hand someone else in, so go until nobody's left
+        bool served = true;
+        while (served)
+        {
+            served = false;
+            for (i = server.client_count - 1; i >= 0; --i)
             {
-                fprintf(
-                    stderr,
-                    "Failed to open currentTime.txt for reading. errno: %s\n",
-                    strerror(errno)
-                );
-                return 1;
+                if (
+                    i < server.client_count &&
+                    server.clients[i]->typed_ahead &&
+                    server.clients[i]->output.len == 0
+                ) {
+                    serve_client_input(&server, i);
+                    served = true;
+                }
             }
+        }
+    }
 
-            char* time_str = NULL;
-            size_t buf_size = 0;
-            if (getline(&time_str, &buf_size, time_file) != -1)
-            {
-                printf("\n%s\n", time_str); // Print date
-            }
-            else
-            {
-                fprintf(stderr, "getline() failed on currentTime.txt\n");
-                return 1; // R.I.P.
-            }
+    fprintf(
+        stderr,
+        "Shard %d: %d players still here, %lu handed in, %lu handed off\n",
+        server.shard,
+        server.client_count,
+        server.handoffs_in,
+        server.handoffs_out
+    );
 
-            // Cleanup
-            free(time_str);
+    // Cleanup
+    while (server.client_count > 0)
+    {
+        close(server.clients[0]->fd);
+        drop_shard_client(&server, 0);
+    }
+    mem_free(server.clients);
+    mem_free(fds);
 
-            fclose(time_file);
+    char path_buffer[sizeof(((struct sockaddr_un*) NULL)->sun_path)];
+    shard_socket_path(path_buffer, server.socket_dir, server.shard, "sock");
+    unlink(path_buffer);
+    shard_socket_path(path_buffer, server.socket_dir, server.shard, "handoff");
+    unlink(path_buffer);
+    if (server.listen_fd > 0)
+    {
+        close(server.listen_fd);
+    }
+    if (server.handoff_fd > 0)
+    {
+        close(server.handoff_fd);
+    }
+
+    _RoomCache(&rooms);
+    _ShardTable(&table);
+
+    return ok ? 0 : 1;
+}
+
+// Play on a shard server: pass stdin to the socket at `socket_path` and the
+// socket to stdout until the server hangs up. The server can hand our
+// connection to other shards as often as it likes and we'll never know
+int run_shard_client(const char* socket_path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (
+        fd == -1 ||
+        connect(fd, (struct sockaddr*) &address, sizeof(address)) == -1
+    ) {
+        fprintf(stderr, "Could not connect to \"%s\": \"%s\"\n", socket_path,
+                strerror(errno));
+        if (fd != -1)
+        {
+            close(fd);
         }
-        else
+
+        return 1;
+    }
+
+    struct pollfd fds[2];
+    fds[0].fd = STDIN_FILENO;
+    fds[0].events = POLLIN;
+    fds[1].fd = fd;
+    fds[1].events = POLLIN;
+
+    char buffer[4096];
+    for (;;)
+    {
+        if (poll(fds, 2, -1) == -1)
         {
-            // Loop through possible connections the player can move to
-            for (i = 0; i < current_room->connection_count; ++i)
+            if (errno == EINTR)
             {
-                // Did they choose this one?
-                if (strcmp(line, current_room->connections[i]) == 0)
-                {
-                    // Ok, they did, so we have to now find the actual
-                    // corresponding `Room` struct, so we just use a linear
-                    // search again
-                    int j;
-                    for (j = 0; j < room_count; ++j)
-                    {
-                        if (strcmp(line, room_buffer[j]->name) == 0)
-                        {
-                            current_room = room_buffer[j];
-                            changed_room = true;
+                continue;
+            }
 
-                            break;
-                        }
-                    }
+            break;
+        }
 
-                    break;
-                }
+        if (fds[1].revents != 0)
+        {
+            ssize_t got = read(fd, buffer, sizeof(buffer));
+            if (got <= 0)
+            {
+                break; // They're done with us
             }
-
-            if (!changed_room) // No dice
+            OutBuf out = {STDOUT_FILENO, buffer, (size_t) got, sizeof(buffer)};
+            out_flush(&out);
+        }
+        if (fds[0].revents != 0)
+        {
+            ssize_t got = read(STDIN_FILENO, buffer, sizeof(buffer));
+            if (got <= 0)
+            {
+                // Let the server know we're not typing anything else, and
+                // stop listening to stdin
+                shutdown(fd, SHUT_WR);
+                fds[0].fd = -1;
+            }
+            else if (write(fd, buffer, (size_t) got) != got)
             {
-                printf("\nHUH? I DON'T UNDERSTAND THAT ROOM. TRY AGAIN.\n");
+                break;
             }
         }
+    }
 
-        printf("\n");
-    } while (chars_read != -1);
+    close(fd);
 
-    // Looks like they won
-    printf("YOU HAVE FOUND THE END ROOM. CONGRATULATIONS!\n");
-    printf("YOU TOOK %d STEPS. YOUR PATH TO VICTORY WAS:\n", path_history_len);
-    int i;
-    for (i = 0; i < path_history_len; ++i)
+    return 0;
+}
+
+// Get room array, enter game loop
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parse_args(argc, argv, &options))
     {
-        printf("%s\n", path_history[i]);
+        return 1;
     }
 
-    // Cleanup
-    for (i = 0; i < path_history_len; ++i)
+    if (options.mem_report)
     {
-        free(path_history[i]);
+        atexit(print_mem_report);
+    }
+    atexit(free_names); // Also before the report, for the same reason
+    uring_disabled = options.no_uring;
+    if (options.trace_path != NULL)
+    {
+        start_trace(options.trace_path); // Written before the memory report,
+        trace_thread_name("main");       // which gets to see it cleaned up
     }
-    free(path_history);
-
-    free(line);
 
-    return 0;
-}
+    // Someone else has the map, we're just playing on it
+    if (options.connect_path != NULL)
+    {
+        return run_shard_client(options.connect_path);
+    }
 
-// Get room array, enter game loop
-int main(void)
-{
-    // Find the newest directory of files to play from
+    // Play from the dir we were told to, or else the newest one
     char path_buffer[256];
-    if (!get_fresh_dir_path(path_buffer))
+    if (options.dir_path != NULL)
     {
-        return 1;
+        snprintf(path_buffer, 256, "%s", options.dir_path);
+    }
+    else
+    {
+        trace_begin("get_fresh_dir_path");
+        bool found = get_fresh_dir_path(path_buffer);
+        trace_end("get_fresh_dir_path");
+        if (!found)
+        {
+            return 1;
+        }
     }
 
-    // Get our `Room`s into memory using the files in that dir
-    int room_count = 7;
-    Room* room_buffer[room_count];
-    int parse_result = parse_room_dir(path_buffer, room_buffer, room_count);
-    if (parse_result != 7)
+    if (options.check)
     {
-        fprintf(
-            stderr,
-            "Error: parse_room_dir() returned %d\n",
-            parse_result
+        return check_map(path_buffer, options.threads) == 0 ? 0 : 1;
+    }
+    if (options.partition_shards > 0)
+    {
+        return run_partition(path_buffer, options.partition_shards);
+    }
+    if (options.serve_shard != -1)
+    {
+        return run_shard_server(path_buffer, &options);
+    }
+
+    // Get our `Room`s into memory using the files in that dir, either all at
+    // once or, if we're lazy, just the START_ROOM for now
+    RoomCache rooms;
+    Room* current_room = NULL;
+    PackedMap packed;
+    memset(&packed, 0, sizeof(PackedMap)); // So `_PackedMap` is always safe
+    MapStore store; // Only for `--machine` on an eager map, which needs ids
+    memset(&store, 0, sizeof(MapStore));   // for every room's neighbors
+    if (options.lazy || options.compressed)
+    {
+        if (options.compressed && !load_packed_map(path_buffer, &packed))
+        {
+            return 1;
+        }
+
+        if (
+            !init_room_cache(
+                &rooms,
+                options.compressed ? NULL : path_buffer,
+                options.compressed ? &packed : NULL,
+                options.cache_size
+            )
+        ) {
+            _PackedMap(&packed);
+
+            return 1;
+        }
+
+        if (options.compressed)
+        {
+            // Packed rooms have real ids, so we can do checkpoints
+            rooms.room_count = packed.room_count;
+            rooms.map_kind = 'P';
+            rooms.map_hash = hash_bytes(
+                14695981039346656037UL,
+                packed.bytes,
+                packed.bytes_len
+            );
+        }
+
+        trace_begin("find_start_room");
+        current_room = find_start_room(&rooms);
+        trace_end("find_start_room");
+        if (current_room == NULL)
+        {
+            _RoomCache(&rooms);
+            _PackedMap(&packed);
+
+            return 1;
+        }
+    }
+    else
+    {
+        Room** room_buffer = NULL;
+        trace_begin("parse_room_dir");
+        int room_count = parse_room_dir(path_buffer, &room_buffer);
+        trace_end("parse_room_dir");
+        if (room_count <= 0)
+        {
+            fprintf(
+                stderr,
+                "Error: parse_room_dir() returned %d\n",
+                room_count
+            );
+            mem_free(room_buffer);
+
+            return room_count == 0 ? 100 : 1;
+        }
+
+        if (options.bench)
+        {
+            // Don't need a game for this, just the map
+            int bench_result = 1;
+            if (build_map_store(room_buffer, room_count, false, &store))
+            {
+                // The packed map is optional, since not every map has one
+                char adjacency_path[512];
+                snprintf(adjacency_path, 512, "%s/%s", path_buffer,
+                         ADJACENCY_FILE_NAME);
+                struct stat sb;
+                bool have_packed = stat(adjacency_path, &sb) == 0 &&
+                                   load_packed_map(path_buffer, &packed);
+
+                run_benchmarks(
+                    room_buffer,
+                    room_count,
+                    &store,
+                    have_packed ? &packed : NULL
+                );
+                _MapStore(&store);
+                _PackedMap(&packed);
+                bench_result = 0;
+            }
+
+            int i;
+            for (i = 0; i < room_count; ++i)
+            {
+                _Room(room_buffer[i]);
+                mem_free(room_buffer[i]);
+            }
+            mem_free(room_buffer);
+
+            return bench_result;
+        }
+
+        if (!init_room_cache(&rooms, NULL, NULL, room_count))
+        {
+            return 1;
+        }
+        rooms.room_count = room_count;
+        rooms.map_hash = hash_rooms(room_buffer, room_count);
+
+        // Find the start room while we hand the `Room`s over to the cache
+        int i;
+        bool inserted = true;
+        for (i = 0; i < room_count; ++i)
+        {
+            if (!inserted)
+            {
+                _Room(room_buffer[i]); // The cache has the rest
+                mem_free(room_buffer[i]);
+
+                continue;
+            }
+
+            inserted = cache_insert(&rooms, room_buffer[i]) != NULL;
+            if (inserted && room_buffer[i]->type == START_ROOM)
+            {
+                current_room = room_buffer[i];
+            }
+        }
+        bool stored = inserted && (
+            !options.machine ||
+            build_map_store(room_buffer, room_count, false, &store)
         );
+        mem_free(room_buffer);
+        if (!stored)
+        {
+            _RoomCache(&rooms);
+
+            return 1;
+        }
+
+        trace_begin("render_prompts");
+        bool rendered = render_prompts(&rooms);
+        trace_end("render_prompts");
+        if (!rendered)
+        {
+            _MapStore(&store);
+            _RoomCache(&rooms);
 
-        return parse_result == 0 ? 100 : parse_result;
+            return 1;
+        }
+
+        if (current_room == NULL)
+        {
+            fprintf(
+                stderr,
+                "None of the %d rooms are starting rooms",
+                room_count
+            );
+            _MapStore(&store);
+            _RoomCache(&rooms);
+
+            return 1;
+        }
     }
 
     // Create a mutex and start up child process to write date to file as
@@ -671,47 +6876,58 @@ int main(void)
     pthread_t child;
     if (!spawn_child(&child, &mutex))
     {
+        _MapStore(&store);
+        _RoomCache(&rooms);
+        _PackedMap(&packed);
+
         return 1;
     }
 
-    // Prepare game loop by obtaining start room and initializing variables
-    // for `getline` to use, as well as making memory for the path history
-    // to be stored in
-    int i = 0;
-    Room* current_room = room_buffer[i];
-    for (i = 1; i < room_count && current_room->type != START_ROOM; ++i)
-    {
-        current_room = room_buffer[i];
-    }
-    if (current_room->type != START_ROOM)
-    {
-        fprintf(
-            stderr,
-            "None of the %d rooms are starting rooms",
-            room_count
-        );
+    Journal journal;
+    if (
+        options.journal_path != NULL &&
+        !open_journal(&journal, options.journal_path)
+    ) {
+        pthread_mutex_unlock(&mutex);
+        pthread_join(child, NULL);
+        _MapStore(&store);
+        _RoomCache(&rooms);
+        _PackedMap(&packed);
+
         return 1;
     }
 
     // Rev up the game loop
-    int game_loop_result = game_loop(
-        room_buffer,
-        room_count,
-        current_room,
-        &mutex,
-        &child
-    );
+    int game_loop_result = options.machine
+        ? machine_loop(
+              &rooms,
+              current_room,
+              &store,
+              options.resume_path,
+              options.journal_path != NULL ? &journal : NULL
+          )
+        : game_loop(
+              &rooms,
+              current_room,
+              options.resume_path,
+              options.journal_path != NULL ? &journal : NULL,
+              &mutex,
+              &child
+          );
+
+    if (options.journal_path != NULL)
+    {
+        close_journal(&journal);
+    }
 
     // Cleanup
     void* res; // Dummy variable
     pthread_mutex_unlock(&mutex); // This actually is necessary to free the
     pthread_join(child, &res);    // child thread's memory
 
-    for (i = 0; i < room_count; ++i)
-    {
-        _Room(room_buffer[i]);
-        free(room_buffer[i]);
-    }
+    _MapStore(&store);
+    _RoomCache(&rooms);
+    _PackedMap(&packed);
 
     // With any luck, it's good
     return game_loop_result;
@@ -1,31 +1,23 @@
 #include <stdio.h>     // fopen, fclose, printf, scanf, sprintf
-#include <stdlib.h>    // malloc, free, rand
+#include <stdlib.h>    // malloc, free
 #include <string.h>    // memcpy, strcpy, strcat, strerror
 #include <sys/types.h> // Types for system functions
-#include <sys/stat.h>  // stat
-#include <unistd.h>    // getpid
+#include <sys/stat.h>  // stat, mkdir
+#include <unistd.h>    // sysconf
 #include <errno.h>     // errno
-#include <time.h>      // Seed for rand
+#include <time.h>      // clock_gettime, for seeding and timing
+#include <pthread.h>   // Worker threads for batch mode
+#include <dirent.h>    // opendir, readdir, for edit mode
+#include "comitoz.mem.h" // mem_alloc and friends, bool
+#include "comitoz.trace.h" // trace_begin, trace_end
 
 
 // `typedef`s
-typedef enum {false, true} bool; // C99 makes C11 look young in comparison
-
 typedef enum {START_ROOM, MID_ROOM, END_ROOM} room_type;
 
-typedef struct Room
-{
-    int id;
-    char* name;
-    int* connections;
-    int connection_count;
-    room_type type;
-} Room;
-
-
 // Room names
 #define ROOM_NAME_COUNT 10
-#define MAX_ROOM_NAME_LEN 12
+#define MAX_ROOM_NAME_LEN 23 // Longest base name plus a 10 digit suffix
 const char* ROOM_NAMES[ROOM_NAME_COUNT] = // Spooky abstract algebra names to
 {                                         // keep up the Halloween theme
     "Semigroupoid",
@@ -41,79 +33,577 @@ const char* ROOM_NAMES[ROOM_NAME_COUNT] = // Spooky abstract algebra names to
 };
 
 
+// The map, stored as a structure of arrays so that walking it is a handful of
+// dense sequential scans rather than a pointer chase per room. Room `i` is
+// just index `i` into each array, and its neighbors live in
+// `neighbors[i * MAX_CONNECTIONS]` through
+// `neighbors[i * MAX_CONNECTIONS + degrees[i] - 1]`. Neighbors are map-wide
+// ids, which are the same thing unless we're streaming (see `run_stream`)
+#define MIN_CONNECTIONS 3
+#define MAX_CONNECTIONS 6
+
+typedef struct RoomStore
+{
+    int            room_count;
+    unsigned char* types;     // Really `room_type`s, but those are 4 bytes
+    unsigned char* degrees;
+    unsigned char* fixed_degrees; // Connections that resets leave alone, or
+                                  // `NULL` for none (see `run_stream`)
+    int*           neighbors;
+    int*           open;      // Rooms that can still take a connection...
+    int*           open_pos;  // ...and where each one is in `open`, or -1
+    int            open_count;
+    int            underfull; // Rooms with fewer than `MIN_CONNECTIONS`
+    int            first_id;  // Map-wide id of room 0 (see `run_stream`)
+    int            map_room_count; // Rooms in the whole map
+    const char*    base_names[ROOM_NAME_COUNT];
+    char           (*names)[MAX_ROOM_NAME_LEN + 1]; // Names we didn't make up
+                                                    // (edit mode), or `NULL`
+    unsigned long  rng;       // Every map gets its own random stream
+} RoomStore;
+
+typedef struct Options
+{
+    int  room_count;
+    bool adjacency;
+    int  batch;   // How many maps to make
+    int  threads; // How many generator threads (and as many writers)
+    int  window;  // Rooms per streamed window, or 0 to build it all at once
+    const char* edit_dir; // Map to edit instead of making one, or `NULL`
+    bool mem_report;      // Print `format_mem_report` at exit
+    const char* trace_path; // `--trace`, or `NULL` for no trace
+} Options;
+
+// Batch mode is a little pipeline: generator threads build maps and push
+// them into a bounded queue, and writer threads pop them off and put them on
+// disk, so that the CPU-heavy and I/O-heavy halves of the job overlap
+typedef struct BatchQueue
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t  not_empty;
+    pthread_cond_t  not_full;
+    RoomStore**     slots;
+    int             capacity;
+    int             head;
+    int             count;
+    int             next_to_generate; // Index of the next map to make
+    int             taken;            // Maps claimed by writers so far
+    bool            failed;
+    const Options*  options;
+    unsigned long   seed;
+} BatchQueue;
+
+// Compressed adjacency section, written to `.adjacency` inside the room dir
+// (the leading dot keeps the text loader from thinking it's a room). Rooms
+// are renumbered in BFS order from the START_ROOM so that neighbors tend to
+// have nearby ids, and then each room gets a record of
+//
+//   u8 type | varint name length | name | u8 degree | varint neighbors...
+//
+// where the neighbors are sorted, the first one is stored as a zigzagged
+// delta from the room's own id and the rest as (gap - 1) from the previous
+// one. It all comes after a header of "CADJ", a u8 version and a varint room
+// count. Every varint is unsigned LEB128.
+#define ADJACENCY_FILE_NAME ".adjacency"
+#define ADJACENCY_VERSION 1
+#define PACKED_BLOCK 64 // Rooms per full offset in adventure's `PackedMap`
+
+// The START_ROOM's name and a '\n', so a lazy player can start without
+// reading every room file to find it. Same as in *.adventure.c
+#define START_FILE_NAME ".start"
+// adventure's `--partition` table. Same as in *.adventure.c
+#define SHARD_FILE_NAME ".shards"
+// A room record can't be bigger than this: type, name length, name, degree,
+// and 6 neighbors at 10 bytes each in the worst case
+#define ADJACENCY_RECORD_MAX (3 + MAX_ROOM_NAME_LEN + 10 * (1 + MAX_CONNECTIONS))
+
+// Byte counts for bragging about the compression
+typedef struct AdjacencyStats
+{
+    unsigned long text_bytes;            // Whole text map
+    unsigned long text_connection_bytes; // Just its CONNECTION lines
+    unsigned long packed_bytes;          // Whole `.adjacency` file
+    unsigned long packed_neighbor_bytes; // Just its degrees and neighbors
+    unsigned long edge_count;            // Each direction counted
+} AdjacencyStats;
+
+// Streaming mode builds the map a window of consecutive room ids at a time,
+// so only two windows are ever in memory. When a window comes in, it gets
+// `CROSS_EDGE_FRACTION` of its size in random connections to the window
+// before it. That one is then connected up on its own (around those), after
+// which it can't change anymore and goes to disk.
+#define CROSS_EDGE_FRACTION 16 // As in one cross edge per 16 rooms
+
+// Edit mode loads a map that's already on disk into a `RoomStore` (with
+// real names, since they might not be ours) and applies operations to it,
+// one per line on stdin:
+//
+//   add-room NAME | remove-room NAME | add-edge A B | remove-edge A B |
+//   start NAME | end NAME
+//
+// Only rooms that an operation touched get checked and rewritten. Of the
+// derived data a map can have, `.start` is just rewritten, and `.adjacency`
+// is re-encoded from scratch, since its BFS numbering can shift all over
+// from one edge. `.shards` is thrown away, since only adventure knows how to
+// partition, and a table that's missing rooms would strand players.
+typedef struct EditMap
+{
+    RoomStore      store;
+    int            capacity;       // Rooms we have space for
+    unsigned char* dirty;          // Whether each room needs rewriting
+    unsigned char* removed;
+    int*           name_index;     // Open addressing over `store.names`, -1
+    int            name_index_cap; // is empty, and it's a power of two
+    int            start_room;
+    int            end_room;
+    int            rewritten;      // Tallies for the summary
+    int            deleted;
+} EditMap;
+
+#define MAX_EDIT_LINE_LEN 128
+#define PATH_BUFFER_LEN 512
+
+#define DEFAULT_ROOM_COUNT 7
+#define MAKE_CONNECTIONS_ATTEMPTS 8
+#define DIR_NAME_ATTEMPTS 16
+#define DIR_NAME_LEN 40 // "comitoz.rooms." plus 16 hex digits, and then some
+
+
 // Forward declarations (tfw no header files)
-void _Room(Room* r);
+bool parse_args(int argc, char* argv[], Options* options);
+
+unsigned long mix_seed(unsigned long x);
+
+unsigned long get_process_seed(void);
+
+int random_below(RoomStore* store, int n);
+
+bool initialize_rooms(RoomStore* store, int room_count, unsigned long seed);
+
+bool generate_map(RoomStore* store);
+
+void _RoomStore(RoomStore* store);
+
+void reset_connections(RoomStore* store);
+
+void get_random_room_names(RoomStore* store);
+
+void get_room_name(const RoomStore* store, int room, char* buffer);
+
+bool make_connections(RoomStore* store);
+
+bool is_graph_full(const RoomStore* store);
 
-void initialize_rooms(Room* room_buffer, int room_count);
+bool add_random_connection(RoomStore* store);
 
-void get_random_room_names(char* room_name_buffer[]);
+int pick_connection_partner(RoomStore* store, int a);
 
-void make_connections(Room* rooms, int room_count);
+bool can_add_connection_from(const RoomStore* store, int room);
 
-bool is_graph_full(const Room* rooms, int room_count);
+bool connection_already_exists(const RoomStore* store, int room1, int room2);
 
-void add_random_connection(Room* rooms, int room_count);
+void connect_rooms(RoomStore* store, int room1, int room2);
 
-bool can_add_connection_from(Room room);
+bool is_same_room(int room1, int room2);
 
-bool connection_already_exists(Room room1, Room room2);
+bool make_room_dir(char* buffer, unsigned long seed);
 
-void connect_rooms(Room* room1, Room* room2);
+bool write_room_file(const RoomStore* store, const char* dir_name, int room);
 
-bool is_same_room(Room room1, Room room2);
+bool write_room_files(const RoomStore* store, const char* dir_name);
 
-void get_dir_name(char* buffer);
+bool write_start_file(const RoomStore* store, const char* dir_name, int room);
 
-bool write_room_files(const Room* rooms, int room_count);
+bool initialize_window(
+    RoomStore*       window,
+    const RoomStore* map,
+    int              first_id,
+    int              room_count,
+    unsigned long    seed
+);
+
+int connect_windows(RoomStore* previous, RoomStore* current, int edges);
+
+bool finish_window(
+    RoomStore*      window,
+    const char*     dir_name,
+    FILE*           adjacency_file,
+    AdjacencyStats* stats
+);
+
+bool run_stream(const Options* options, unsigned long seed);
+
+unsigned long hash_room_name(const char* name);
+
+int find_edit_room(const EditMap* map, const char* name);
+
+void index_edit_room(EditMap* map, int room);
+
+bool load_edit_map(const char* dir_name, int extra_rooms, EditMap* map);
+
+void _EditMap(EditMap* map);
+
+room_type str_to_room_type(const char* str, bool* ok);
+
+bool is_valid_room_name(const char* name);
+
+void drop_neighbor(RoomStore* store, int room, int other);
+
+bool apply_edit(EditMap* map, const char* line, int line_number);
+
+bool check_edits(const EditMap* map);
+
+bool write_edits(EditMap* map, const char* dir_name);
+
+bool run_edit(const Options* options);
+
+bool get_bfs_order(const RoomStore* store, int* order, int* rank);
+
+size_t put_varint(unsigned char* buffer, unsigned long value);
+
+size_t encode_adjacency_header(unsigned char* buffer, int room_count);
+
+size_t encode_adjacency_record(
+    const RoomStore* store,
+    int              room,
+    int              new_id,
+    const int*       rank,
+    unsigned char*   record,
+    AdjacencyStats*  stats
+);
+
+bool write_adjacency_file(
+    const RoomStore* store,
+    const char*      dir_name,
+    AdjacencyStats*  stats
+);
+
+void print_adjacency_stats(const AdjacencyStats* stats, int room_count);
+
+bool write_map(const RoomStore* store, const Options* options, unsigned long seed);
+
+void* batch_generator(void* queue_ptr);
+
+void* batch_writer(void* queue_ptr);
+
+bool run_batch(const Options* options, unsigned long seed);
 
 const char* room_type_to_str(room_type rt);
 
 
-// Use this to free `Room`s
-void _Room(Room* r)
+// Fill `options` from the command line, complaining and returning `false` if
+// there's anything in there we don't get
+bool parse_args(int argc, char* argv[], Options* options)
+{
+    options->room_count = DEFAULT_ROOM_COUNT;
+    options->adjacency = false;
+    options->batch = 1;
+    options->threads = 0; // Figure it out later
+    options->window = 0;
+    options->edit_dir = NULL;
+    options->mem_report = false;
+    options->trace_path = NULL;
+
+    int i;
+    for (i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--rooms") == 0 && i + 1 < argc)
+        {
+            options->room_count = atoi(argv[++i]);
+            if (options->room_count < MIN_CONNECTIONS + 1)
+            {
+                // Can't have 3 connections apiece with fewer than 4 rooms
+                fprintf(
+                    stderr,
+                    "--rooms must be at least %d\n",
+                    MIN_CONNECTIONS + 1
+                );
+
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--adjacency") == 0)
+        {
+            options->adjacency = true;
+        }
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+        {
+            options->batch = atoi(argv[++i]);
+            if (options->batch < 1)
+            {
+                fprintf(stderr, "--batch must be at least 1\n");
+
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            options->threads = atoi(argv[++i]);
+            if (options->threads < 1)
+            {
+                fprintf(stderr, "--threads must be at least 1\n");
+
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc)
+        {
+            options->window = atoi(argv[++i]);
+            if (options->window < 2 * (MAX_CONNECTIONS + 1))
+            {
+                // Small enough windows can wedge themselves every time
+                fprintf(
+                    stderr,
+                    "--stream windows must be at least %d rooms\n",
+                    2 * (MAX_CONNECTIONS + 1)
+                );
+
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--edit") == 0 && i + 1 < argc)
+        {
+            options->edit_dir = argv[++i];
+            if (strlen(options->edit_dir) > PATH_BUFFER_LEN / 2)
+            {
+                fprintf(stderr, "--edit dir name is too long\n");
+
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--mem-report") == 0)
+        {
+            options->mem_report = true;
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+            options->trace_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--mem-budget") == 0 && i + 1 < argc)
+        {
+            if (!parse_mem_budget(argv[++i]))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            fprintf(
+                stderr,
+                "Unrecognized argument: %s\n"
+                "Usage: %s [--rooms N] [--adjacency] [--batch N] [--threads N]\n"
+                "       [--stream WINDOW] [--mem-report]\n"
+                "       [--mem-budget CATEGORY=BYTES]... [--trace FILE]\n"
+                "       %s --edit DIR < OPERATIONS\n",
+                argv[i],
+                argv[0],
+                argv[0]
+            );
+
+            return false;
+        }
+    }
+
+    if (
+        options->edit_dir != NULL &&
+        (options->window > 0 || options->batch > 1)
+    ) {
+        fprintf(stderr, "--edit works on one map that already exists, so "
+                        "no --stream or --batch\n");
+
+        return false;
+    }
+    if (options->window > 0 && options->batch > 1)
+    {
+        fprintf(stderr, "--stream makes one map at a time, so no --batch\n");
+
+        return false;
+    }
+
+    if (options->threads == 0)
+    {
+        // One generator per core, but there's no point in having more
+        // threads than maps
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        options->threads = cores < 1 ? 1 : (int) cores;
+        if (options->threads > options->batch)
+        {
+            options->threads = options->batch;
+        }
+    }
+
+    return true;
+}
+
+// splitmix64's finalizer: turns a counter (or anything else) into something
+// that looks random, which is how we derive per-map seeds and dir names
+unsigned long mix_seed(unsigned long x)
+{
+    x += 0x9e3779b97f4a7c15UL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9UL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebUL;
+
+    return x ^ (x >> 31);
+}
+
+// Seed for the whole run. This used to be `time(NULL)` (and the dir name
+// used to be the PID), so two runs in the same second, or two runs that
+// happened to get the same PID, stepped on each other. /dev/urandom doesn't
+// have that problem, and the clock is there in case it's missing
+unsigned long get_process_seed(void)
 {
-    // More trivial than the one in *.adventure.c
-    free(r->connections);
+    unsigned long seed = 0;
+    FILE* urandom = fopen("/dev/urandom", "rb");
+    if (urandom != NULL)
+    {
+        if (fread(&seed, sizeof(seed), 1, urandom) != 1)
+        {
+            seed = 0;
+        }
+        fclose(urandom);
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return seed ^ mix_seed(
+        (unsigned long) now.tv_sec * 1000000000UL + (unsigned long) now.tv_nsec
+    );
+}
+
+// Uniform-ish random number in [0, n), from the map's own xorshift64* stream
+// (`rand` has hidden global state, which threads really don't appreciate)
+int random_below(RoomStore* store, int n)
+{
+    store->rng ^= store->rng >> 12;
+    store->rng ^= store->rng << 25;
+    store->rng ^= store->rng >> 27;
+
+    return (int) ((store->rng * 0x2545f4914f6cdd1dUL >> 33) % (unsigned long) n);
 }
 
-// Initialize an array of `Room`s
-void initialize_rooms(Room* room_buffer, int room_count)
+// Allocate and initialize a `RoomStore` of `room_count` rooms with no
+// connections yet. Returns `false` if we couldn't get the memory.
+bool initialize_rooms(RoomStore* store, int room_count, unsigned long seed)
 {
-    char* shuffled_room_names[ROOM_NAME_COUNT];
-    get_random_room_names(shuffled_room_names);
+    size_t count = (size_t) room_count;
+    trace_begin("initialize_rooms");
+
+    // Don't forget to seed, because you WILL get the same results every time
+    // and wonder what pointer arithmetic you did wrong when shuffling your
+    // data. xorshift also really hates a seed of 0
+    store->rng = mix_seed(seed) | 1;
+    store->room_count = room_count;
+    store->first_id = 0;
+    store->map_room_count = room_count;
+    store->types = mem_alloc(MEM_MAP, count * sizeof(unsigned char));
+    store->degrees = mem_alloc(MEM_MAP, count * sizeof(unsigned char));
+    store->fixed_degrees = NULL;
+    store->names = NULL;
+    store->neighbors = mem_alloc(MEM_MAP,
+                                 count * MAX_CONNECTIONS * sizeof(int));
+    store->open = mem_alloc(MEM_MAP, count * sizeof(int));
+    store->open_pos = mem_alloc(MEM_MAP, count * sizeof(int));
+    if (
+        store->types     == NULL ||
+        store->degrees   == NULL ||
+        store->neighbors == NULL ||
+        store->open      == NULL ||
+        store->open_pos  == NULL
+    ) {
+        fprintf(stderr, "Not enough memory for %d rooms\n", room_count);
+        _RoomStore(store);
+        trace_end("initialize_rooms");
+
+        return false;
+    }
+
+    get_random_room_names(store);
 
-    // Create the rooms in a loop using the random names; we're mutating
-    // the buffer parameter so no need to have a return value
+    // The first room starts, the second one ends, and everyone else is just
+    // along for the ride
     int i;
     for (i = 0; i < room_count; ++i)
     {
-        Room r;
-        r.id = i;
-        r.name = shuffled_room_names[i];
-        r.connections = malloc(6 * sizeof(int));
-        r.connection_count = 0;
-        if (i == 0) // Sometimes I regret giving into the pressure of C/C++
-        {           // "braces-on-their-own-line" thing
-            r.type = START_ROOM;
+        store->types[i] = MID_ROOM;
+    }
+    store->types[0] = START_ROOM;
+    store->types[1] = END_ROOM;
+
+    reset_connections(store);
+    trace_end("initialize_rooms");
+
+    return true;
+}
+
+// Connect up a freshly initialized `RoomStore`. Small maps can occasionally
+// wedge themselves, so just roll the dice again if that happens
+bool generate_map(RoomStore* store)
+{
+    int attempt;
+    for (attempt = 0; attempt < MAKE_CONNECTIONS_ATTEMPTS; ++attempt)
+    {
+        reset_connections(store);
+        if (make_connections(store))
+        {
+            return true;
         }
-        else if (i == 1)
+    }
+
+    fprintf(stderr, "Could not connect the map, giving up\n");
+
+    return false;
+}
+
+// Use this to free a `RoomStore`
+void _RoomStore(RoomStore* store)
+{
+    // Still more trivial than the one in *.adventure.c
+    mem_free(store->types);
+    mem_free(store->degrees);
+    mem_free(store->fixed_degrees);
+    mem_free(store->names);
+    mem_free(store->neighbors);
+    mem_free(store->open);
+    mem_free(store->open_pos);
+}
+
+// Rip out every connection (but the fixed ones) so that we can start over.
+// Fixed connections always come first in a room's slots, so forgetting the
+// rest is just a matter of putting the degree back
+void reset_connections(RoomStore* store)
+{
+    store->open_count = 0;
+    store->underfull = 0;
+
+    int i;
+    for (i = 0; i < store->room_count; ++i)
+    {
+        store->degrees[i] =
+            store->fixed_degrees == NULL ? 0 : store->fixed_degrees[i];
+
+        if (can_add_connection_from(store, i))
         {
-            r.type = END_ROOM;
+            store->open[store->open_count] = i;
+            store->open_pos[i] = store->open_count;
+            store->open_count++;
         }
         else
         {
-            r.type = MID_ROOM;
+            store->open_pos[i] = -1;
+        }
+        if (store->degrees[i] < MIN_CONNECTIONS)
+        {
+            store->underfull++;
         }
-
-        room_buffer[i] = r;
     }
 }
 
-// Gets a shuffled copy of `ROOM_NAMES` and puts it into `room_name_buffer`.
-// So `room_name_buffer` should be at least large enough to hold
-// `ROOM_NAME_COUNT` `char*`s
-void get_random_room_names(char* room_name_buffer[])
+// Gets a shuffled copy of `ROOM_NAMES` and puts it into `store->base_names`
+void get_random_room_names(RoomStore* store)
 {
+    const char** room_name_buffer = store->base_names;
+
     // Spooky scary memory copying (more Halloween spirit)
     memcpy(room_name_buffer, ROOM_NAMES, ROOM_NAME_COUNT * sizeof(char*));
 
@@ -121,103 +611,153 @@ void get_random_room_names(char* room_name_buffer[])
     int i;
     for (i = ROOM_NAME_COUNT - 1; i >= 1; --i)
     {
-        int j = rand() % (i + 1);
-        char* temp = room_name_buffer[j];
+        int j = random_below(store, i + 1);
+        const char* temp = room_name_buffer[j];
         room_name_buffer[j] = room_name_buffer[i];
         room_name_buffer[i] = temp;
     }
 }
 
-// Create all connections of the graph
-void make_connections(Room* rooms, int room_count)
+// Write the name of `room` (a map-wide id) into `buffer`, which needs room for
+// `MAX_ROOM_NAME_LEN + 1` `char`s. Small maps just use the shuffled names;
+// once we run out of those, every name gets a numeric suffix to keep it
+// unique. Names are computed rather than stored, since they'd be most of the
+// memory in a big map otherwise, unless they came from somebody else's map
+void get_room_name(const RoomStore* store, int room, char* buffer)
 {
-    // Add valid connections 'til the whole thing's full
-    while (!is_graph_full(rooms, room_count))
+    const char* base = store->base_names[room % ROOM_NAME_COUNT];
+    if (store->names != NULL)
+    {
+        strcpy(buffer, store->names[room]);
+    }
+    else if (store->map_room_count <= ROOM_NAME_COUNT)
+    {
+        strcpy(buffer, base);
+    }
+    else
     {
-        add_random_connection(rooms, room_count);
+        sprintf(buffer, "%s%d", base, room / ROOM_NAME_COUNT);
     }
 }
 
-// Checking to see if all rooms have 3 to 6 outbound connections
-bool is_graph_full(const Room* rooms, int room_count)
+// Create all connections of the graph, returning `false` if we painted
+// ourselves into a corner (see `add_random_connection`)
+bool make_connections(RoomStore* store)
 {
-    int i;
-    for (i = 0; i < room_count; ++i)
+    // Add valid connections 'til the whole thing's full
+    trace_begin("make_connections");
+    bool ok = true;
+    while (ok && !is_graph_full(store))
     {
-        int connection_count = rooms[i].connection_count;
-
-        if (connection_count < 3)
-        {
-            return false;
-        }
+        ok = add_random_connection(store);
     }
+    trace_end("make_connections");
 
-    return true;
+    return ok;
+}
+
+// Checking to see if all rooms have 3 to 6 outbound connections. This used to
+// be a scan over every room, but `connect_rooms` keeps count for us now
+bool is_graph_full(const RoomStore* store)
+{
+    return store->underfull == 0;
 }
 
-// Add a random (valid) connection to the graph
-void add_random_connection(Room* rooms, int room_count)
+// Add a random (valid) connection to the graph. Returns `false` only if there
+// is a room that still needs connections but can't possibly get any more,
+// which can happen on small maps when everyone else is already full.
+bool add_random_connection(RoomStore* store)
 {
-    /* I'd prefer to do this in a deterministic linear time,
-     * not an symptotically linear but indeterministic (unbounded)
-     * time.
-     *
-     * So, we simply filter the array into a new array and then get
-     * from the filtered array using a random index.
+    /* Rooms that can take another connection are kept in `store->open`, so
+     * picking `a` is one random index. The same goes for `b`, except that
+     * it also has to be a different room not already connected to `a`;
+     * see `pick_connection_partner`.
      */
-    int choices_for_a[room_count];
-    int possible_as = 0;
+    int a = store->open[random_below(store, store->open_count)];
+    int b = pick_connection_partner(store, a);
+    if (b == -1)
+    {
+        // `a` is connected to everyone that's still open. That's fine if `a`
+        // has enough connections already (we just go around again), and a
+        // dead end if it doesn't, since rooms never reopen once they're full
+        return store->degrees[a] >= MIN_CONNECTIONS;
+    }
 
-    int i;
-    for (i = 0; i < room_count; ++i)
+    // Makes the connection bidirectionally
+    connect_rooms(store, a, b);
+
+    return true;
+}
+
+// Uniformly pick an open room that `a` could connect to, or -1 if there is
+// none. We try rejection sampling first since on a big map nearly every
+// candidate is valid, and only fall back to filtering the whole open list
+// (which is what this always did) when we keep getting unlucky.
+int pick_connection_partner(RoomStore* store, int a)
+{
+    int tries;
+    for (tries = 0; tries < 32; ++tries)
     {
-        if (can_add_connection_from(rooms[i]))
-        {
-            choices_for_a[possible_as] = i;
-            possible_as++;
+        int b = store->open[random_below(store, store->open_count)];
+        if (
+            !is_same_room(a, b) &&
+            !connection_already_exists(store, a, store->first_id + b)
+        ) {
+            return b;
         }
     }
 
-    // Ugh this line is terrible. `choices_for_*` is just an array of the
-    // INDICES (of `rooms`, the `Room` buffer) that are possible choices,
-    // so we have to index into that and then use that to index into `rooms`
-    Room* a = &rooms[choices_for_a[rand() % possible_as]];
-
-    int choices_for_b[room_count];
+    // Count the valid ones, then walk to whichever got picked. That's two
+    // passes, but nothing to allocate (or to fail to)
     int possible_bs = 0;
-
-    for (i = 0; i < room_count; ++i)
+    int i;
+    for (i = 0; i < store->open_count; ++i)
     {
+        int b = store->open[i];
         if (
-            can_add_connection_from(rooms[i]) && // Line 'em up
-            !is_same_room(*a, rooms[i])       &&
-            !connection_already_exists(*a, rooms[i])
+            !is_same_room(a, b) &&
+            !connection_already_exists(store, a, store->first_id + b)
         ) {
-            choices_for_b[possible_bs] = i;
             possible_bs++;
         }
     }
+    if (possible_bs == 0)
+    {
+        return -1;
+    }
 
-    Room* b = &rooms[choices_for_b[rand() % possible_bs]];
+    int pick = random_below(store, possible_bs);
+    int b = -1;
+    for (i = 0; pick >= 0; ++i)
+    {
+        b = store->open[i];
+        if (
+            !is_same_room(a, b) &&
+            !connection_already_exists(store, a, store->first_id + b)
+        ) {
+            pick--;
+        }
+    }
 
-    // Makes the connection bidirectionally
-    connect_rooms(a, b);
+    return b;
 }
 
 // Can this room handle another connection?
-bool can_add_connection_from(Room room)
+bool can_add_connection_from(const RoomStore* store, int room)
 {
-    return room.connection_count < 6;
+    return store->degrees[room] < MAX_CONNECTIONS;
 }
 
-// Is there already a connection from `room1` to `room2`?
-bool connection_already_exists(Room room1, Room room2)
+// Is there already a connection from `room1` (an index into `store`) to
+// `room2` (a map-wide id)?
+bool connection_already_exists(const RoomStore* store, int room1, int room2)
 {
-    // Simple linear search
+    // Simple linear search, but over at most 6 adjacent `int`s
+    const int* connections = &store->neighbors[(size_t) room1 * MAX_CONNECTIONS];
     int i;
-    for (i = 0; i < room1.connection_count; ++i)
+    for (i = 0; i < store->degrees[room1]; ++i)
     {
-        if (room1.connections[i] == room2.id)
+        if (connections[i] == room2)
         {
             return true;
         }
@@ -226,133 +766,1798 @@ bool connection_already_exists(Room room1, Room room2)
     return false;
 }
 
-// Connect two rooms together.
-void connect_rooms(Room* room1, Room* room2)
+// Connect two rooms together, keeping the open list and the count of
+// underfull rooms up to date.
+void connect_rooms(RoomStore* store, int room1, int room2)
 {
-    room1->connections[room1->connection_count] = room2->id;
-    room1->connection_count++; // Information hiding is weird but you regret
-                               // everything as soon as you forget to
-                               // increment a variable like this one
+    int ends[2];
+    ends[0] = room1;
+    ends[1] = room2;
+
+    int i;
+    for (i = 0; i < 2; ++i)
+    {
+        int room = ends[i];
+        int other = ends[1 - i];
+
+        store->neighbors[(size_t) room * MAX_CONNECTIONS + store->degrees[room]] =
+            store->first_id + other;
+        store->degrees[room]++; // Information hiding is weird but you regret
+                                // everything as soon as you forget to
+                                // increment a variable like this one
+
+        if (store->degrees[room] == MIN_CONNECTIONS)
+        {
+            store->underfull--;
+        }
 
-    room2->connections[room2->connection_count] = room1->id;
-    room2->connection_count++;
+        if (!can_add_connection_from(store, room))
+        {
+            // Swap-remove it from the open list
+            int pos = store->open_pos[room];
+            int last = store->open[store->open_count - 1];
+            store->open[pos] = last;
+            store->open_pos[last] = pos;
+            store->open_pos[room] = -1;
+            store->open_count--;
+        }
+    }
 }
 
 // Are `room1` and `room2` the same room?
-bool is_same_room(Room room1, Room room2)
+bool is_same_room(int room1, int room2)
 {
-    return room1.id == room2.id; // The only purpose of the `id` field
+    return room1 == room2; // Rooms are just indices now, so this is trivial
 }
 
-// Generate dir name to put files in.
-// `buffer` should be large enough to hold 40 `char`s or more.
-void get_dir_name(char* buffer)
+// Come up with a dir name to put files in and create it, trying again if
+// it's somehow taken. Names are "comitoz.rooms." plus 64 random bits from
+// `seed`, which (unlike the PID that used to be there) don't repeat.
+// `buffer` should be large enough to hold `DIR_NAME_LEN` `char`s or more.
+bool make_room_dir(char* buffer, unsigned long seed)
 {
-    char pid_str_buffer[24];
-    sprintf(pid_str_buffer, "%d", getpid());
+    int attempt;
+    for (attempt = 0; attempt < DIR_NAME_ATTEMPTS; ++attempt)
+    {
+        sprintf(
+            buffer,
+            "comitoz.rooms.%016lx",
+            mix_seed(seed + (unsigned long) attempt)
+        );
+
+        if (mkdir(buffer, 0777) == 0) // No secrets
+        {
+            return true;
+        }
+        if (errno != EEXIST)
+        {
+            break;
+        }
+    }
+
+    fprintf(
+        stderr,
+        "mkdir(\"%s\", 0777) failed with: \"%s\"\n",
+        buffer,
+        strerror(errno)
+    );
 
-    strcpy(buffer, "comitoz.rooms.");
-    strcat(buffer, pid_str_buffer);
+    return false;
 }
 
-// Write the room files, returning `false` on failure
-bool write_room_files(const Room* rooms, int room_count)
+// Write the file for `room` into `dir_name`, returning `false` on failure.
+// The neighbors have to be map-wide ids, which they are unless this is a
+// streamed window that hasn't been finished yet
+bool write_room_file(const RoomStore* store, const char* dir_name, int room)
 {
-    char dir_name[40]; // This was a `malloc` until I noticed it just now.
-                       // `malloc` is NOT safe for children, and we were all
-                       // children once upon a time
-    get_dir_name(dir_name);
+    char room_name[MAX_ROOM_NAME_LEN + 1];
+    char connection_name[MAX_ROOM_NAME_LEN + 1];
+    get_room_name(store, store->first_id + room, room_name);
 
-    mkdir(dir_name, 0777); // No secrets
+    char rel_path_buffer[PATH_BUFFER_LEN];
+    snprintf(rel_path_buffer, PATH_BUFFER_LEN, "%s/%s", dir_name, room_name);
 
-    int i;
-    for (i = 0; i < room_count; ++i)
+    FILE* file_handle = fopen(rel_path_buffer, "w");
+    if (file_handle == NULL)
     {
-        Room room = rooms[i];
-
-        char rel_path_buffer[41 + MAX_ROOM_NAME_LEN];
-        strcpy(rel_path_buffer, dir_name);
-        strcat(rel_path_buffer, "/");
-        strcat(rel_path_buffer, room.name);
-
-        FILE* file_handle = fopen(rel_path_buffer, "w");
-        if (file_handle == NULL)
-        {
-            fprintf(
-                stderr,
-                "fopen(\"%s\", \"w\") failed with: \"%s\"\n",
-                rel_path_buffer,
-                strerror(errno)
-            );
-
-            return false;
-        }
+        fprintf(
+            stderr,
+            "fopen(\"%s\", \"w\") failed with: \"%s\"\n",
+            rel_path_buffer,
+            strerror(errno)
+        );
 
-        fprintf(file_handle, "ROOM NAME: %s\n", room.name);
-        int j;
-        for (j = 0; j < room.connection_count; ++j)
-        {
-            fprintf(
-                file_handle,
-                "CONNECTION %d: %s\n",
-                j + 1,
-                rooms[room.connections[j]].name
-            );
-        }
-        fprintf(file_handle, "ROOM TYPE: %s\n", room_type_to_str(room.type));
+        return false;
+    }
 
-        fclose(file_handle);
+    fprintf(file_handle, "ROOM NAME: %s\n", room_name);
+    const int* connections =
+        &store->neighbors[(size_t) room * MAX_CONNECTIONS];
+    int j;
+    for (j = 0; j < store->degrees[room]; ++j)
+    {
+        get_room_name(store, connections[j], connection_name);
+        fprintf(
+            file_handle,
+            "CONNECTION %d: %s\n",
+            j + 1,
+            connection_name
+        );
     }
+    fprintf(
+        file_handle,
+        "ROOM TYPE: %s\n",
+        room_type_to_str((room_type) store->types[room])
+    );
+
+    fclose(file_handle);
 
     return true;
 }
 
-// Convert `room_type` enum into its string representation
-const char* room_type_to_str(room_type rt)
+// Write all of the room files into `dir_name`, returning `false` on failure
+bool write_room_files(const RoomStore* store, const char* dir_name)
 {
-    switch (rt)
+    trace_begin("write_room_files");
+    bool ok = true;
+    int i;
+    for (i = 0; ok && i < store->room_count; ++i)
     {
-        case START_ROOM:
-            return "START_ROOM";
-        case MID_ROOM:
-            return "MID_ROOM";
-        case END_ROOM:
-            return "END_ROOM";
-        default:
-            return "wat";
+        ok = write_room_file(store, dir_name, i);
     }
+    trace_end("write_room_files");
+
+    return ok;
 }
 
-int main(void) // It turns out that in C, an empty parameter list means
-               // "this function takes any number of any kind of thing(!)",
-               // which is... awful. But at least you get a warning if you use
-               // nearly every warning flag like I do
+// Write `START_FILE_NAME`, naming `room` (by id, like `get_room_name`).
+// Returns `false` on failure
+bool write_start_file(const RoomStore* store, const char* dir_name, int room)
 {
-    // Seed our PRNG.
-    // Don't forget to do this like I did, because you WILL get the same
-    // results every time and wonder what pointer arithmetic you did wrong
-    // when shuffling your data
-    srand(time(NULL));
+    char room_name[MAX_ROOM_NAME_LEN + 1];
+    get_room_name(store, room, room_name);
+
+    char path_buffer[PATH_BUFFER_LEN];
+    snprintf(path_buffer, PATH_BUFFER_LEN, "%s/%s", dir_name,
+             START_FILE_NAME);
+    FILE* file_handle = fopen(path_buffer, "w");
+    if (file_handle == NULL)
+    {
+        fprintf(
+            stderr,
+            "fopen(\"%s\", \"w\") failed with: \"%s\"\n",
+            path_buffer,
+            strerror(errno)
+        );
 
-    int room_count = 7;
-    Room* room_buffer = malloc(room_count * sizeof(Room));
+        return false;
+    }
 
-    initialize_rooms(room_buffer, room_count);
+    fprintf(file_handle, "%s\n", room_name);
 
-    make_connections(room_buffer, room_count);
+    return fclose(file_handle) == 0;
+}
 
-    if (!write_room_files(room_buffer, room_count))
+// Fill `order` with room indices in breadth-first order from the START_ROOM
+// (and `rank` with the inverse, i.e. each room's position in `order`). Rooms
+// that can't be reached from the start, if there are any, go at the end in
+// their own BFS runs. Both buffers hold `room_count` `int`s.
+bool get_bfs_order(const RoomStore* store, int* order, int* rank)
+{
+    int i;
+    for (i = 0; i < store->room_count; ++i)
     {
-        return 1; // D'oh
+        rank[i] = -1;
+    }
+
+    // `order` doubles as the BFS queue
+    int tail = 0;
+    int next_root = 0; // Room 0 is always the START_ROOM
+    while (tail < store->room_count)
+    {
+        while (rank[next_root] != -1)
+        {
+            next_root++;
+        }
+
+        int head = tail;
+        order[tail] = next_root;
+        rank[next_root] = tail;
+        tail++;
+        while (head < tail)
+        {
+            int room = order[head++];
+            const int* neighbors =
+                &store->neighbors[(size_t) room * MAX_CONNECTIONS];
+            for (i = 0; i < store->degrees[room]; ++i)
+            {
+                if (rank[neighbors[i]] == -1)
+                {
+                    order[tail] = neighbors[i];
+                    rank[neighbors[i]] = tail;
+                    tail++;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+// Write `value` into `buffer` as an unsigned LEB128 varint, returning how
+// many bytes that took (10 at most)
+size_t put_varint(unsigned char* buffer, unsigned long value)
+{
+    size_t len = 0;
+    while (value >= 0x80)
+    {
+        buffer[len++] = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    buffer[len++] = (unsigned char) value;
+
+    return len;
+}
+
+// Write the `.adjacency` header for a map of `room_count` rooms into
+// `buffer`, returning its length
+size_t encode_adjacency_header(unsigned char* buffer, int room_count)
+{
+    size_t len = 0;
+    memcpy(buffer, "CADJ", 4);
+    len += 4;
+    buffer[len++] = ADJACENCY_VERSION;
+    len += put_varint(&buffer[len], (unsigned long) room_count);
+
+    return len;
+}
+
+// Encode `room` (an index into `store`) as record number `new_id` into
+// `record`, which needs `ADJACENCY_RECORD_MAX` bytes, and count it in
+// `stats`. Neighbors are renumbered through `rank`, or used as they are if
+// `rank` is `NULL`. Returns the record's length.
+size_t encode_adjacency_record(
+    const RoomStore* store,
+    int              room,
+    int              new_id,
+    const int*       rank,
+    unsigned char*   record,
+    AdjacencyStats*  stats
+) {
+    char room_name[MAX_ROOM_NAME_LEN + 1];
+    char connection_name[MAX_ROOM_NAME_LEN + 1];
+    int degree = store->degrees[room];
+
+    // Sort the renumbered neighbors, which is an insertion sort of at most 6
+    // things
+    const int* neighbors = &store->neighbors[(size_t) room * MAX_CONNECTIONS];
+    int sorted[MAX_CONNECTIONS];
+    int i;
+    for (i = 0; i < degree; ++i)
+    {
+        int value = rank == NULL ? neighbors[i] : rank[neighbors[i]];
+        int j = i;
+        while (j > 0 && sorted[j - 1] > value)
+        {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = value;
+    }
+
+    get_room_name(store, store->first_id + room, room_name);
+    size_t name_len = strlen(room_name);
+
+    size_t len = 0;
+    record[len++] = store->types[room];
+    len += put_varint(&record[len], (unsigned long) name_len);
+    memcpy(&record[len], room_name, name_len);
+    len += name_len;
+
+    size_t neighbor_start = len;
+    record[len++] = (unsigned char) degree;
+    for (i = 0; i < degree; ++i)
+    {
+        unsigned long encoded;
+        if (i == 0)
+        {
+            long delta = (long) sorted[0] - (long) new_id;
+            encoded = delta < 0 ? ((unsigned long) -delta << 1) - 1
+                                : (unsigned long) delta << 1;
+        }
+        else
+        {
+            encoded = (unsigned long) (sorted[i] - sorted[i - 1] - 1);
+        }
+        len += put_varint(&record[len], encoded);
+    }
+
+    stats->packed_bytes += len;
+    stats->packed_neighbor_bytes += len - neighbor_start;
+    stats->edge_count += (unsigned long) degree;
+
+    // What the text format spends on the same room, without actually having
+    // to format it
+    stats->text_bytes += strlen("ROOM NAME: \n") + name_len;
+    stats->text_bytes += strlen("ROOM TYPE: \n") +
+        strlen(room_type_to_str((room_type) store->types[room]));
+    for (i = 0; i < degree; ++i)
+    {
+        get_room_name(store, neighbors[i], connection_name);
+        unsigned long line_len = (unsigned long) (
+            strlen("CONNECTION 0: \n") + strlen(connection_name)
+        );
+        stats->text_bytes += line_len;
+        stats->text_connection_bytes += line_len;
+    }
+
+    return len;
+}
+
+// Write the compressed adjacency section for the map (see
+// `ADJACENCY_FILE_NAME`) and tally up how big it is compared to the text
+// format in `stats`. Returns `false` on failure.
+bool write_adjacency_file(
+    const RoomStore* store,
+    const char*      dir_name,
+    AdjacencyStats*  stats
+) {
+    size_t count = (size_t) store->room_count;
+    int* order = mem_alloc(MEM_MAP, count * sizeof(int));
+    int* rank = mem_alloc(MEM_MAP, count * sizeof(int));
+    if (order == NULL || rank == NULL)
+    {
+        fprintf(stderr, "Not enough memory to renumber %d rooms\n",
+                store->room_count);
+        mem_free(order);
+        mem_free(rank);
+
+        return false;
+    }
+    get_bfs_order(store, order, rank);
+
+    char path_buffer[PATH_BUFFER_LEN];
+    snprintf(
+        path_buffer,
+        PATH_BUFFER_LEN,
+        "%s/%s",
+        dir_name,
+        ADJACENCY_FILE_NAME
+    );
+    FILE* file_handle = fopen(path_buffer, "wb");
+    if (file_handle == NULL)
+    {
+        fprintf(
+            stderr,
+            "fopen(\"%s\", \"wb\") failed with: \"%s\"\n",
+            path_buffer,
+            strerror(errno)
+        );
+        mem_free(order);
+        mem_free(rank);
+
+        return false;
+    }
+
+    memset(stats, 0, sizeof(AdjacencyStats));
+
+    unsigned char record[ADJACENCY_RECORD_MAX];
+    size_t len = encode_adjacency_header(record, store->room_count);
+    fwrite(record, 1, len, file_handle);
+    stats->packed_bytes += len;
+
+    int new_id;
+    for (new_id = 0; new_id < store->room_count; ++new_id)
+    {
+        len = encode_adjacency_record(
+            store,
+            order[new_id],
+            new_id,
+            rank,
+            record,
+            stats
+        );
+        fwrite(record, 1, len, file_handle);
+    }
+
+    mem_free(order);
+    mem_free(rank);
+
+    if (fclose(file_handle) != 0)
+    {
+        fprintf(
+            stderr,
+            "Writing \"%s\" failed with: \"%s\"\n",
+            path_buffer,
+            strerror(errno)
+        );
+
+        return false;
+    }
+
+    return true;
+}
+
+// Show how much the compressed adjacency saved us, and what it costs once
+// it's loaded
+void print_adjacency_stats(const AdjacencyStats* stats, int room_count)
+{
+    // What `RoomStore` spends per room: 6 neighbor slots and a degree
+    unsigned long slot_bytes = (unsigned long) room_count *
+        (MAX_CONNECTIONS * sizeof(int) + sizeof(unsigned char));
+
+    // adventure's `PackedMap` keeps the whole file, plus a `size_t` offset
+    // per `PACKED_BLOCK` rooms, a 2-byte one per room into its block and an
+    // `int` per room sorted by name hash
+    unsigned long block_count =
+        ((unsigned long) room_count + PACKED_BLOCK - 1) / PACKED_BLOCK;
+    unsigned long offset_bytes = block_count * sizeof(size_t) +
+                                 (unsigned long) room_count *
+                                     sizeof(unsigned short);
+    unsigned long index_bytes = (unsigned long) room_count * sizeof(int);
+    unsigned long loaded_bytes = stats->packed_bytes + offset_bytes +
+                                 index_bytes;
+
+    // What that stands in for is adventure's `MapStore`, which on top of the
+    // neighbor slots and degrees has a type, a name id and a by-name entry
+    // per room, and every name interned: a `MAX_ROOM_NAME_LEN + 1` slot and
+    // an 8-byte hash slot (id and hash), at least two per name
+    unsigned long name_slots = 1;
+    while (name_slots < 2 * (unsigned long) room_count)
+    {
+        name_slots *= 2;
+    }
+    unsigned long store_bytes = slot_bytes +
+        (unsigned long) room_count *
+            (sizeof(unsigned char) + 2 * sizeof(int) + MAX_ROOM_NAME_LEN + 1) +
+        name_slots * 2 * sizeof(int);
+
+    printf("%d rooms, %lu edges\n", room_count, stats->edge_count / 2);
+    printf(
+        "Whole map:  %lu bytes as text, %lu packed (%.2fx)\n",
+        stats->text_bytes,
+        stats->packed_bytes,
+        (double) stats->text_bytes / (double) stats->packed_bytes
+    );
+    printf(
+        "Adjacency:  %lu bytes as text, %lu packed (%.2fx), "
+        "%.2f bytes/neighbor\n",
+        stats->text_connection_bytes,
+        stats->packed_neighbor_bytes,
+        (double) stats->text_connection_bytes /
+            (double) stats->packed_neighbor_bytes,
+        (double) stats->packed_neighbor_bytes / (double) stats->edge_count
+    );
+    printf(
+        "In memory:  %lu bytes of neighbor slots, %lu packed (%.2fx)\n"
+        "            A loaded map is the whole file plus %lu of offsets and\n"
+        "            %lu of name index, for %lu, vs %lu as a MapStore with\n"
+        "            its names interned (%.2fx)\n",
+        slot_bytes,
+        stats->packed_neighbor_bytes,
+        (double) slot_bytes / (double) stats->packed_neighbor_bytes,
+        offset_bytes,
+        index_bytes,
+        loaded_bytes,
+        store_bytes,
+        (double) store_bytes / (double) loaded_bytes
+    );
+}
+
+// Put a finished map on disk: a fresh dir with room files in it, plus the
+// adjacency section if we were asked for one. `seed` picks the dir name.
+bool write_map(const RoomStore* store, const Options* options, unsigned long seed)
+{
+    char dir_name[DIR_NAME_LEN]; // This was a `malloc` once. `malloc` is NOT
+                                 // safe for children, and we were all
+                                 // children once upon a time
+    if (!make_room_dir(dir_name, seed))
+    {
+        return false;
+    }
+
+    if (
+        !write_room_files(store, dir_name) ||
+        !write_start_file(store, dir_name, store->first_id) // Room 0 starts
+    ) {
+        return false; // D'oh
+    }
+
+    if (options->adjacency)
+    {
+        AdjacencyStats stats;
+        trace_begin("write_adjacency_file");
+        bool written = write_adjacency_file(store, dir_name, &stats);
+        trace_end("write_adjacency_file");
+        if (!written)
+        {
+            return false;
+        }
+
+        // Nobody wants to read a thousand of these
+        if (options->batch == 1)
+        {
+            print_adjacency_stats(&stats, store->room_count);
+        }
+    }
+
+    return true;
+}
+
+// Set up `window` to hold rooms `first_id` through `first_id + room_count - 1`
+// of the map that `map` describes, with its own random stream. Only the
+// very first room starts and only the very last one ends, so the player has
+// to cross every window to win. `false` if we're out of memory.
+bool initialize_window(
+    RoomStore*       window,
+    const RoomStore* map,
+    int              first_id,
+    int              room_count,
+    unsigned long    seed
+) {
+    if (!initialize_rooms(window, room_count, seed))
+    {
+        return false;
+    }
+
+    // Everybody has to agree on names
+    memcpy(window->base_names, map->base_names, sizeof(map->base_names));
+    window->first_id = first_id;
+    window->map_room_count = map->map_room_count;
+
+    int i;
+    for (i = 0; i < room_count; ++i)
+    {
+        window->types[i] = MID_ROOM;
+    }
+    if (first_id == 0)
+    {
+        window->types[0] = START_ROOM;
+    }
+    if (first_id + room_count == map->map_room_count)
+    {
+        window->types[room_count - 1] = END_ROOM;
+    }
+
+    return true;
+}
+
+// Add up to `edges` random connections between `previous` and `current`.
+// Neither has been connected up on its own yet, so there's plenty of space,
+// and this is bounded so it can't wedge either one: a pair that doesn't work
+// out (somebody's full, or they're already connected) is just skipped. The
+// connections it makes are fixed for both windows. Returns how many it made.
+int connect_windows(RoomStore* previous, RoomStore* current, int edges)
+{
+    int made = 0;
+    int attempt;
+    for (attempt = 0; attempt < 4 * edges && made < edges; ++attempt)
+    {
+        int a = random_below(current, previous->room_count);
+        int b = random_below(current, current->room_count);
+        if (
+            !can_add_connection_from(previous, a) ||
+            !can_add_connection_from(current, b) ||
+            connection_already_exists(previous, a, current->first_id + b)
+        ) {
+            continue;
+        }
+
+        previous->neighbors[
+            (size_t) a * MAX_CONNECTIONS + previous->degrees[a]++
+        ] = current->first_id + b;
+        current->neighbors[
+            (size_t) b * MAX_CONNECTIONS + current->degrees[b]++
+        ] = previous->first_id + a;
+        made++;
+    }
+
+    return made;
+}
+
+// Connect `window` up on its own around the connections it already has to
+// the windows on either side, then write it out (and its `.adjacency`
+// records, if `adjacency_file` isn't `NULL`). Frees the window either way.
+bool finish_window(
+    RoomStore*      window,
+    const char*     dir_name,
+    FILE*           adjacency_file,
+    AdjacencyStats* stats
+) {
+    size_t count = (size_t) window->room_count;
+    window->fixed_degrees = mem_alloc(MEM_MAP, count * sizeof(unsigned char));
+    if (window->fixed_degrees == NULL)
+    {
+        fprintf(stderr, "Not enough memory to finish a window\n");
+        _RoomStore(window);
+
+        return false;
+    }
+    memcpy(window->fixed_degrees, window->degrees, count);
+
+    bool ok = generate_map(window) && write_room_files(window, dir_name);
+
+    unsigned char record[ADJACENCY_RECORD_MAX];
+    int room;
+    for (room = 0; ok && adjacency_file != NULL && room < window->room_count;
+         ++room)
+    {
+        size_t len = encode_adjacency_record(
+            window,
+            room,
+            window->first_id + room,
+            NULL,
+            record,
+            stats
+        );
+        fwrite(record, 1, len, adjacency_file);
+    }
+
+    _RoomStore(window);
+
+    return ok;
+}
+
+// Build and write the map a window at a time (see `CROSS_EDGE_FRACTION`), so
+// that peak memory depends on `options->window` and not on how many rooms
+// there are. The last window soaks up whatever's left over, so windows are
+// between one and two `options->window`s long. With `--adjacency`, records
+// go out as each window is done, in room id order rather than BFS order.
+bool run_stream(const Options* options, unsigned long seed)
+{
+    // Just enough of a `RoomStore` to name rooms with
+    RoomStore map;
+    memset(&map, 0, sizeof(RoomStore));
+    map.rng = mix_seed(seed) | 1;
+    map.room_count = options->room_count;
+    map.map_room_count = options->room_count;
+    get_random_room_names(&map);
+
+    char dir_name[DIR_NAME_LEN];
+    if (
+        !make_room_dir(dir_name, seed + 1) ||
+        !write_start_file(&map, dir_name, 0) // Only the first window starts
+    ) {
+        return false;
+    }
+
+    FILE* adjacency_file = NULL;
+    char path_buffer[DIR_NAME_LEN + 16];
+    AdjacencyStats stats;
+    memset(&stats, 0, sizeof(AdjacencyStats));
+    if (options->adjacency)
+    {
+        snprintf(path_buffer, DIR_NAME_LEN + 16, "%s/%s", dir_name,
+                 ADJACENCY_FILE_NAME);
+        adjacency_file = fopen(path_buffer, "wb");
+        if (adjacency_file == NULL)
+        {
+            fprintf(
+                stderr,
+                "fopen(\"%s\", \"wb\") failed with: \"%s\"\n",
+                path_buffer,
+                strerror(errno)
+            );
+
+            return false;
+        }
+
+        unsigned char header[ADJACENCY_RECORD_MAX];
+        size_t len = encode_adjacency_header(header, options->room_count);
+        fwrite(header, 1, len, adjacency_file);
+        stats.packed_bytes += len;
+    }
+
+    RoomStore windows[2];
+    RoomStore* previous = NULL;
+    RoomStore* current = &windows[0];
+    unsigned long cross_edges = 0;
+    int window_count = 0;
+    bool ok = true;
+
+    int first_id = 0;
+    while (ok && first_id < options->room_count)
+    {
+        int remaining = options->room_count - first_id;
+        int room_count = remaining < 2 * options->window ? remaining
+                                                         : options->window;
+
+        ok = initialize_window(
+            current,
+            &map,
+            first_id,
+            room_count,
+            seed + 2 + (unsigned long) window_count
+        );
+        if (!ok)
+        {
+            break;
+        }
+
+        if (previous != NULL)
+        {
+            // After this, nothing else will ever touch `previous`
+            int edges = room_count / CROSS_EDGE_FRACTION;
+            cross_edges += (unsigned long) connect_windows(
+                previous,
+                current,
+                edges > 0 ? edges : 1
+            );
+
+            ok = finish_window(previous, dir_name, adjacency_file, &stats);
+        }
+
+        previous = current;
+        current = current == &windows[0] ? &windows[1] : &windows[0];
+        first_id += room_count;
+        window_count++;
+    }
+
+    // The last one has nobody after it to wait for
+    if (previous != NULL)
+    {
+        if (ok)
+        {
+            ok = finish_window(previous, dir_name, adjacency_file, &stats);
+        }
+        else
+        {
+            _RoomStore(previous);
+        }
+    }
+
+    if (adjacency_file != NULL && fclose(adjacency_file) != 0)
+    {
+        fprintf(
+            stderr,
+            "Writing \"%s\" failed with: \"%s\"\n",
+            path_buffer,
+            strerror(errno)
+        );
+        ok = false;
+    }
+
+    if (ok)
+    {
+        printf(
+            "%d rooms in %d windows of %d, %lu connections between windows\n",
+            options->room_count,
+            window_count,
+            options->window,
+            cross_edges
+        );
+        if (options->adjacency)
+        {
+            print_adjacency_stats(&stats, options->room_count);
+        }
+    }
+
+    return ok;
+}
+
+// FNV-1a, for the edit map's name index
+unsigned long hash_room_name(const char* name)
+{
+    unsigned long hash = 14695981039346656037UL;
+    while (*name != '\0')
+    {
+        hash = (hash ^ (unsigned char) *name++) * 1099511628211UL;
+    }
+
+    return hash;
+}
+
+// Index of the room called `name` (which may have been removed), or -1
+int find_edit_room(const EditMap* map, const char* name)
+{
+    unsigned long mask = (unsigned long) map->name_index_cap - 1;
+    unsigned long slot = hash_room_name(name) & mask;
+    while (map->name_index[slot] != -1)
+    {
+        int room = map->name_index[slot];
+        if (strcmp(map->store.names[room], name) == 0)
+        {
+            return room;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    return -1;
+}
+
+// Make `room` findable by name
+void index_edit_room(EditMap* map, int room)
+{
+    unsigned long mask = (unsigned long) map->name_index_cap - 1;
+    unsigned long slot = hash_room_name(map->store.names[room]) & mask;
+    while (map->name_index[slot] != -1)
+    {
+        slot = (slot + 1) & mask;
+    }
+    map->name_index[slot] = room;
+}
+
+// Load the map in `dir_name` with space for `extra_rooms` more, returning
+// `false` (after saying why) if it can't be read or doesn't make sense
+bool load_edit_map(const char* dir_name, int extra_rooms, EditMap* map)
+{
+    memset(map, 0, sizeof(EditMap));
+    map->start_room = -1;
+    map->end_room = -1;
+
+    DIR* dir = opendir(dir_name);
+    if (dir == NULL)
+    {
+        fprintf(
+            stderr,
+            "opendir(\"%s\") failed with: \"%s\"\n",
+            dir_name,
+            strerror(errno)
+        );
+
+        return false;
+    }
+
+    // First the names, so that connections can be turned into ids
+    int name_cap = 64;
+    char (*names)[MAX_ROOM_NAME_LEN + 1] =
+        mem_alloc(MEM_STRINGS, (size_t) name_cap * sizeof(*names));
+    int room_count = 0;
+    struct dirent* entity = names != NULL ? readdir(dir) : NULL;
+    while (entity != NULL)
+    {
+        if (entity->d_name[0] != '.') // `.adjacency` too
+        {
+            if (strlen(entity->d_name) > MAX_ROOM_NAME_LEN)
+            {
+                fprintf(stderr, "\"%s\" is too long to be a room name\n",
+                        entity->d_name);
+                closedir(dir);
+                mem_free(names);
+
+                return false;
+            }
+            if (room_count >= name_cap)
+            {
+                char (*bigger)[MAX_ROOM_NAME_LEN + 1] = mem_realloc(
+                    MEM_STRINGS,
+                    names,
+                    (size_t) name_cap * 2 * sizeof(*names)
+                );
+                if (bigger == NULL)
+                {
+                    mem_free(names);
+                    names = NULL;
+
+                    break;
+                }
+                names = bigger;
+                name_cap *= 2;
+            }
+            strcpy(names[room_count++], entity->d_name);
+        }
+
+        entity = readdir(dir);
+    }
+    closedir(dir);
+    if (names == NULL)
+    {
+        fprintf(stderr, "Not enough memory to list the rooms in \"%s\"\n",
+                dir_name);
+
+        return false;
+    }
+
+    map->capacity = room_count + extra_rooms;
+    if (room_count < 2)
+    {
+        fprintf(stderr, "\"%s\" doesn't have a map in it\n", dir_name);
+        mem_free(names);
+
+        return false;
+    }
+    if (!initialize_rooms(&map->store, map->capacity, 0))
+    {
+        mem_free(names);
+
+        return false;
+    }
+    map->store.room_count = room_count;
+    map->store.map_room_count = room_count;
+    map->store.names = mem_realloc(MEM_STRINGS, names,
+                                   (size_t) map->capacity * sizeof(*names));
+    if (map->store.names == NULL)
+    {
+        mem_free(names); // Still ours, since growing it failed
+    }
+    map->dirty = mem_calloc(MEM_MAP, (size_t) map->capacity,
+                            sizeof(unsigned char));
+    map->removed = mem_calloc(MEM_MAP, (size_t) map->capacity,
+                              sizeof(unsigned char));
+    map->name_index_cap = 16;
+    while (map->name_index_cap < 2 * map->capacity)
+    {
+        map->name_index_cap *= 2;
+    }
+    map->name_index = mem_alloc(MEM_MAP,
+                                (size_t) map->name_index_cap * sizeof(int));
+    if (
+        map->store.names == NULL || map->dirty == NULL ||
+        map->removed == NULL || map->name_index == NULL
+    ) {
+        fprintf(stderr, "Not enough memory to edit %d rooms\n", room_count);
+        _EditMap(map);
+
+        return false;
     }
 
-    // Cleanup
     int i;
+    for (i = 0; i < map->name_index_cap; ++i)
+    {
+        map->name_index[i] = -1;
+    }
     for (i = 0; i < room_count; ++i)
     {
-        _Room(&room_buffer[i]); // Sometimes you feel thankful for C++
+        index_edit_room(map, i);
+    }
+
+    // Then what's in the files
+    char path_buffer[PATH_BUFFER_LEN];
+    char* line = NULL;
+    size_t line_cap = 0;
+    bool ok = true;
+    int room;
+    for (room = 0; ok && room < room_count; ++room)
+    {
+        snprintf(path_buffer, PATH_BUFFER_LEN, "%s/%s", dir_name,
+                 map->store.names[room]);
+        FILE* file_handle = fopen(path_buffer, "r");
+        if (file_handle == NULL)
+        {
+            fprintf(
+                stderr,
+                "fopen(\"%s\", \"r\") failed with: \"%s\"\n",
+                path_buffer,
+                strerror(errno)
+            );
+            ok = false;
+
+            break;
+        }
+
+        bool got_type = false;
+        while (ok && mem_getline(&line, &line_cap, file_handle) != -1)
+        {
+            char value[MAX_ROOM_NAME_LEN + 2];
+            int number;
+            if (sscanf(line, "CONNECTION %d: %24s", &number, value) == 2)
+            {
+                int other = find_edit_room(map, value);
+                if (other == -1 || map->store.degrees[room] >= MAX_CONNECTIONS)
+                {
+                    fprintf(stderr, "%s: bad connection to \"%s\"\n",
+                            path_buffer, value);
+                    ok = false;
+                }
+                else
+                {
+                    map->store.neighbors[
+                        (size_t) room * MAX_CONNECTIONS +
+                        map->store.degrees[room]++
+                    ] = other;
+                }
+            }
+            else if (sscanf(line, "ROOM TYPE: %24s", value) == 1)
+            {
+                room_type type = str_to_room_type(value, &ok);
+                map->store.types[room] = (unsigned char) type;
+                got_type = ok;
+                if (!ok)
+                {
+                    fprintf(stderr, "%s: bad room type \"%s\"\n",
+                            path_buffer, value);
+                }
+                else if (type == START_ROOM || type == END_ROOM)
+                {
+                    int* slot = type == START_ROOM ? &map->start_room
+                                                   : &map->end_room;
+                    if (*slot != -1)
+                    {
+                        fprintf(stderr, "%s: a second %s\n", path_buffer,
+                                value);
+                        ok = false;
+                    }
+                    *slot = room;
+                }
+            }
+        }
+        if (ok && !feof(file_handle))
+        {
+            // `mem_getline` ran out of memory partway
+            fprintf(stderr, "Not enough memory to read %s\n", path_buffer);
+            ok = false;
+        }
+        fclose(file_handle);
+
+        if (ok && !got_type)
+        {
+            fprintf(stderr, "%s: no ROOM TYPE\n", path_buffer);
+            ok = false;
+        }
+    }
+    mem_free(line);
+
+    if (!ok)
+    {
+        _EditMap(map);
     }
-    free(room_buffer);
+
+    return ok;
+}
+
+// Destructor for `EditMap`
+void _EditMap(EditMap* map)
+{
+    _RoomStore(&map->store);
+    mem_free(map->dirty);
+    mem_free(map->removed);
+    mem_free(map->name_index);
+    map->dirty = NULL;
+    map->removed = NULL;
+    map->name_index = NULL;
+}
+
+// The opposite of `room_type_to_str`. `*ok` is set to `false` if `str` isn't
+// a room type at all
+room_type str_to_room_type(const char* str, bool* ok)
+{
+    if (strcmp(str, "START_ROOM") == 0)
+    {
+        return START_ROOM;
+    }
+    if (strcmp(str, "END_ROOM") == 0)
+    {
+        return END_ROOM;
+    }
+    if (strcmp(str, "MID_ROOM") != 0)
+    {
+        *ok = false;
+    }
+
+    return MID_ROOM;
+}
+
+// Can a room be called this? It has to fit, it has to be a file name that
+// the loaders won't skip, and it can't have spaces since we split on those
+bool is_valid_room_name(const char* name)
+{
+    size_t len = strlen(name);
+    return len > 0 && len <= MAX_ROOM_NAME_LEN && name[0] != '.' &&
+           strchr(name, '/') == NULL && strchr(name, ' ') == NULL;
+}
+
+// Take `other` out of `room`'s connections, keeping the rest in order so
+// their CONNECTION numbers don't shuffle around for no reason
+void drop_neighbor(RoomStore* store, int room, int other)
+{
+    int* connections = &store->neighbors[(size_t) room * MAX_CONNECTIONS];
+    int i;
+    for (i = 0; i < store->degrees[room]; ++i)
+    {
+        if (connections[i] == other)
+        {
+            memmove(
+                &connections[i],
+                &connections[i + 1],
+                (size_t) (store->degrees[room] - i - 1) * sizeof(int)
+            );
+            store->degrees[room]--;
+
+            return;
+        }
+    }
+}
+
+// Apply one line's worth of operation to `map`, marking whatever it touches
+// as dirty. `false` (after saying why) if it doesn't make sense
+bool apply_edit(EditMap* map, const char* line, int line_number)
+{
+    char op[16];
+    char a_name[MAX_ROOM_NAME_LEN + 2];
+    char b_name[MAX_ROOM_NAME_LEN + 2];
+    int fields = sscanf(line, "%15s %24s %24s", op, a_name, b_name);
+    if (fields <= 0 || op[0] == '#')
+    {
+        return true; // Blank or a comment
+    }
+
+    RoomStore* store = &map->store;
+    bool two_rooms = strcmp(op, "add-edge") == 0 ||
+                     strcmp(op, "remove-edge") == 0;
+    if (fields != (two_rooms ? 3 : 2))
+    {
+        fprintf(stderr, "Line %d: \"%s\" takes %d room name%s\n",
+                line_number, op, two_rooms ? 2 : 1, two_rooms ? "s" : "");
+
+        return false;
+    }
+
+    int a = find_edit_room(map, a_name);
+    int b = two_rooms ? find_edit_room(map, b_name) : -1;
+    bool a_exists = a != -1 && !map->removed[a];
+    bool b_exists = b != -1 && !map->removed[b];
+
+    if (strcmp(op, "add-room") == 0)
+    {
+        if (a_exists || !is_valid_room_name(a_name))
+        {
+            fprintf(stderr, "Line %d: can't add a room called \"%s\"\n",
+                    line_number, a_name);
+
+            return false;
+        }
+
+        if (a == -1) // Otherwise it's coming back from the dead
+        {
+            if (store->room_count == map->capacity)
+            {
+                fprintf(stderr, "Line %d: no space left for \"%s\"\n",
+                        line_number, a_name);
+
+                return false;
+            }
+            a = store->room_count++;
+            strcpy(store->names[a], a_name);
+            index_edit_room(map, a);
+        }
+        map->removed[a] = false;
+        store->degrees[a] = 0;
+        store->types[a] = MID_ROOM;
+        map->dirty[a] = true;
+
+        return true;
+    }
+
+    if (!a_exists || (two_rooms && !b_exists))
+    {
+        fprintf(stderr, "Line %d: no room called \"%s\"\n", line_number,
+                a_exists ? b_name : a_name);
+
+        return false;
+    }
+
+    if (strcmp(op, "remove-room") == 0)
+    {
+        // Everybody it was connected to loses a connection
+        const int* connections =
+            &store->neighbors[(size_t) a * MAX_CONNECTIONS];
+        int i;
+        for (i = 0; i < store->degrees[a]; ++i)
+        {
+            drop_neighbor(store, connections[i], a);
+            map->dirty[connections[i]] = true;
+        }
+        store->degrees[a] = 0;
+        map->removed[a] = true;
+        map->dirty[a] = true;
+        if (map->start_room == a)
+        {
+            map->start_room = -1;
+        }
+        if (map->end_room == a)
+        {
+            map->end_room = -1;
+        }
+    }
+    else if (strcmp(op, "add-edge") == 0)
+    {
+        if (
+            a == b || connection_already_exists(store, a, b) ||
+            !can_add_connection_from(store, a) ||
+            !can_add_connection_from(store, b)
+        ) {
+            fprintf(stderr, "Line %d: can't connect \"%s\" and \"%s\"\n",
+                    line_number, a_name, b_name);
+
+            return false;
+        }
+
+        store->neighbors[(size_t) a * MAX_CONNECTIONS + store->degrees[a]++] =
+            b;
+        store->neighbors[(size_t) b * MAX_CONNECTIONS + store->degrees[b]++] =
+            a;
+        map->dirty[a] = true;
+        map->dirty[b] = true;
+    }
+    else if (strcmp(op, "remove-edge") == 0)
+    {
+        if (!connection_already_exists(store, a, b))
+        {
+            fprintf(stderr, "Line %d: \"%s\" and \"%s\" aren't connected\n",
+                    line_number, a_name, b_name);
+
+            return false;
+        }
+
+        drop_neighbor(store, a, b);
+        drop_neighbor(store, b, a);
+        map->dirty[a] = true;
+        map->dirty[b] = true;
+    }
+    else if (strcmp(op, "start") == 0 || strcmp(op, "end") == 0)
+    {
+        room_type type = op[0] == 's' ? START_ROOM : END_ROOM;
+        int* slot = type == START_ROOM ? &map->start_room : &map->end_room;
+        if (*slot == a)
+        {
+            return true; // It already is
+        }
+        if (map->start_room == a || map->end_room == a)
+        {
+            // Starting in the end room (or vice versa) is no kind of game
+            fprintf(stderr, "Line %d: \"%s\" can't be both start and end\n",
+                    line_number, a_name);
+
+            return false;
+        }
+
+        if (*slot != -1)
+        {
+            // There can be only one
+            store->types[*slot] = MID_ROOM;
+            map->dirty[*slot] = true;
+        }
+
+        store->types[a] = (unsigned char) type;
+        *slot = a;
+        map->dirty[a] = true;
+    }
+    else
+    {
+        fprintf(stderr, "Line %d: unknown operation \"%s\"\n", line_number,
+                op);
+
+        return false;
+    }
+
+    return true;
+}
+
+// Make sure the edited map is still a map, looking only at the rooms the
+// edits touched (everything else was fine before and hasn't changed).
+// Complains about every problem it finds, not just the first
+bool check_edits(const EditMap* map)
+{
+    bool ok = true;
+    if (map->start_room == -1 || map->end_room == -1)
+    {
+        fprintf(stderr, "The map needs a START_ROOM and an END_ROOM\n");
+        ok = false;
+    }
+
+    int room;
+    for (room = 0; room < map->store.room_count; ++room)
+    {
+        int degree = map->store.degrees[room];
+        if (
+            map->dirty[room] && !map->removed[room] &&
+            (degree < MIN_CONNECTIONS || degree > MAX_CONNECTIONS)
+        ) {
+            fprintf(
+                stderr,
+                "%s would have %d connections (it needs %d to %d)\n",
+                map->store.names[room],
+                degree,
+                MIN_CONNECTIONS,
+                MAX_CONNECTIONS
+            );
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+// Rewrite the rooms that changed, delete the ones that are gone, drop
+// `.shards` and redo `.adjacency` if the map has them. Returns `false` on
+// failure
+bool write_edits(EditMap* map, const char* dir_name)
+{
+    RoomStore* store = &map->store;
+    char path_buffer[PATH_BUFFER_LEN];
+
+    int room;
+    for (room = 0; room < store->room_count; ++room)
+    {
+        if (!map->dirty[room])
+        {
+            continue;
+        }
+
+        if (map->removed[room])
+        {
+            snprintf(path_buffer, PATH_BUFFER_LEN, "%s/%s", dir_name,
+                     store->names[room]);
+            if (unlink(path_buffer) == -1 && errno != ENOENT)
+            {
+                fprintf(
+                    stderr,
+                    "unlink(\"%s\") failed with: \"%s\"\n",
+                    path_buffer,
+                    strerror(errno)
+                );
+
+                return false;
+            }
+            map->deleted++;
+        }
+        else
+        {
+            if (!write_room_file(store, dir_name, room))
+            {
+                return false;
+            }
+            map->rewritten++;
+        }
+    }
+
+    // Cheap enough to just rewrite in case `start` moved it (or the map
+    // predates `.start`)
+    if (!write_start_file(store, dir_name, map->start_room))
+    {
+        return false;
+    }
+
+    snprintf(path_buffer, PATH_BUFFER_LEN, "%s/%s", dir_name,
+             SHARD_FILE_NAME);
+    if (unlink(path_buffer) == 0)
+    {
+        printf("Removed %s, so run adventure --partition again to serve it\n",
+               path_buffer);
+    }
+    else if (errno != ENOENT)
+    {
+        fprintf(stderr, "unlink(\"%s\") failed with: \"%s\"\n", path_buffer,
+                strerror(errno));
+
+        return false;
+    }
+
+    snprintf(path_buffer, PATH_BUFFER_LEN, "%s/%s", dir_name,
+             ADJACENCY_FILE_NAME);
+    struct stat sb;
+    if (stat(path_buffer, &sb) == -1)
+    {
+        return true; // Nothing derived to keep up to date
+    }
+
+    // `.adjacency` wants ids 0 to n - 1 with no gaps, so squeeze out the
+    // removed rooms into a fresh store. The start room gets to be 0, since
+    // that's where the BFS numbering starts from
+    int live = 1;
+    int* new_ids = mem_alloc(MEM_MAP, (size_t) store->room_count * sizeof(int));
+    for (room = 0; new_ids != NULL && room < store->room_count; ++room)
+    {
+        new_ids[room] = map->removed[room]      ? -1 :
+                        room == map->start_room ? 0  : live++;
+    }
+
+    RoomStore packed;
+    if (new_ids == NULL || !initialize_rooms(&packed, live, 0))
+    {
+        mem_free(new_ids);
+
+        return false;
+    }
+    packed.names = mem_alloc(MEM_STRINGS,
+                             (size_t) live * sizeof(*packed.names));
+    if (packed.names == NULL)
+    {
+        fprintf(stderr, "Not enough memory to re-encode %s\n", path_buffer);
+        mem_free(new_ids);
+        _RoomStore(&packed);
+
+        return false;
+    }
+
+    for (room = 0; room < store->room_count; ++room)
+    {
+        int id = new_ids[room];
+        if (id == -1)
+        {
+            continue;
+        }
+
+        strcpy(packed.names[id], store->names[room]);
+        packed.types[id] = store->types[room];
+        packed.degrees[id] = store->degrees[room];
+        const int* connections =
+            &store->neighbors[(size_t) room * MAX_CONNECTIONS];
+        int i;
+        for (i = 0; i < store->degrees[room]; ++i)
+        {
+            packed.neighbors[(size_t) id * MAX_CONNECTIONS + (size_t) i] =
+                new_ids[connections[i]];
+        }
+    }
+    mem_free(new_ids);
+
+    AdjacencyStats stats;
+    bool ok = write_adjacency_file(&packed, dir_name, &stats);
+    _RoomStore(&packed);
+
+    return ok;
+}
+
+// Edit the map in `options->edit_dir` with the operations on stdin. Nothing
+// is written unless every operation makes sense and the result is still a
+// valid map
+bool run_edit(const Options* options)
+{
+    // Read all the operations first, so we know how much space new rooms
+    // are going to need
+    int line_cap = 64;
+    int line_count = 0;
+    char (*lines)[MAX_EDIT_LINE_LEN] =
+        mem_alloc(MEM_IO, (size_t) line_cap * sizeof(*lines));
+    int extra_rooms = 0;
+    bool read_ok = lines != NULL;
+    while (
+        read_ok &&
+        fgets(lines[line_count], MAX_EDIT_LINE_LEN, stdin) != NULL
+    ) {
+        // Tokenized exactly like `apply_edit` does it, so that it can't
+        // find an add we didn't count
+        char op[16];
+        if (
+            sscanf(lines[line_count], "%15s", op) == 1 &&
+            strcmp(op, "add-room") == 0
+        ) {
+            extra_rooms++;
+        }
+        if (++line_count >= line_cap)
+        {
+            char (*bigger)[MAX_EDIT_LINE_LEN] = mem_realloc(
+                MEM_IO,
+                lines,
+                (size_t) line_cap * 2 * sizeof(*lines)
+            );
+            read_ok = bigger != NULL;
+            if (read_ok)
+            {
+                lines = bigger;
+                line_cap *= 2;
+            }
+        }
+    }
+    if (!read_ok)
+    {
+        fprintf(stderr, "Not enough memory to read more than %d operations\n",
+                line_count);
+    }
+
+    EditMap map;
+    if (
+        !read_ok ||
+        !load_edit_map(options->edit_dir, extra_rooms, &map)
+    ) {
+        mem_free(lines);
+
+        return false;
+    }
+
+    bool ok = true;
+    int i;
+    for (i = 0; ok && i < line_count; ++i)
+    {
+        ok = apply_edit(&map, lines[i], i + 1);
+    }
+    mem_free(lines);
+
+    ok = ok && check_edits(&map) && write_edits(&map, options->edit_dir);
+    if (ok)
+    {
+        printf(
+            "%d operations: %d rooms rewritten, %d removed, %d left alone\n",
+            line_count,
+            map.rewritten,
+            map.deleted,
+            map.store.room_count - map.rewritten - map.deleted
+        );
+    }
+
+    _EditMap(&map);
+
+    return ok;
+}
+
+// Entry point for generator threads: keep claiming map indices, building
+// those maps, and handing them to the writers until we're out of maps
+void* batch_generator(void* queue_ptr)
+{
+    BatchQueue* queue = (BatchQueue*) queue_ptr;
+    trace_thread_name("generator");
+
+    for (;;)
+    {
+        pthread_mutex_lock(&queue->mutex);
+        if (queue->failed || queue->next_to_generate >= queue->options->batch)
+        {
+            pthread_mutex_unlock(&queue->mutex);
+
+            return NULL;
+        }
+        int map_index = queue->next_to_generate++;
+        pthread_mutex_unlock(&queue->mutex);
+
+        // The heavy lifting happens outside the lock, obviously
+        RoomStore* store = mem_alloc(MEM_MAP, sizeof(RoomStore));
+        bool ok = store != NULL && initialize_rooms(
+            store,
+            queue->options->room_count,
+            queue->seed + 2 * (unsigned long) map_index
+        );
+        if (ok && !generate_map(store))
+        {
+            _RoomStore(store);
+            ok = false;
+        }
+
+        pthread_mutex_lock(&queue->mutex);
+        if (!ok)
+        {
+            mem_free(store);
+            queue->failed = true;
+            pthread_cond_broadcast(&queue->not_empty);
+            pthread_cond_broadcast(&queue->not_full);
+            pthread_mutex_unlock(&queue->mutex);
+
+            return NULL;
+        }
+
+        while (queue->count == queue->capacity && !queue->failed)
+        {
+            pthread_cond_wait(&queue->not_full, &queue->mutex);
+        }
+        if (queue->failed)
+        {
+            pthread_mutex_unlock(&queue->mutex);
+            _RoomStore(store);
+            mem_free(store);
+
+            return NULL;
+        }
+
+        queue->slots[(queue->head + queue->count) % queue->capacity] = store;
+        queue->count++;
+        pthread_cond_signal(&queue->not_empty);
+        pthread_mutex_unlock(&queue->mutex);
+    }
+}
+
+// Entry point for writer threads: pop maps off the queue and write them out
+// until every map has been claimed by somebody
+void* batch_writer(void* queue_ptr)
+{
+    BatchQueue* queue = (BatchQueue*) queue_ptr;
+    trace_thread_name("writer");
+
+    for (;;)
+    {
+        pthread_mutex_lock(&queue->mutex);
+        while (
+            queue->count == 0 &&
+            queue->taken < queue->options->batch &&
+            !queue->failed
+        ) {
+            pthread_cond_wait(&queue->not_empty, &queue->mutex);
+        }
+        if (queue->count == 0) // Either everything's written or we're toast
+        {
+            pthread_mutex_unlock(&queue->mutex);
+
+            return NULL;
+        }
+
+        RoomStore* store = queue->slots[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        int map_index = queue->taken++;
+        pthread_cond_signal(&queue->not_full);
+        pthread_mutex_unlock(&queue->mutex);
+
+        // Odd seeds name dirs, even ones (up in `batch_generator`) make maps
+        bool ok = write_map(
+            store,
+            queue->options,
+            queue->seed + 2 * (unsigned long) map_index + 1
+        );
+        _RoomStore(store);
+        mem_free(store);
+
+        if (!ok)
+        {
+            pthread_mutex_lock(&queue->mutex);
+            queue->failed = true;
+            pthread_cond_broadcast(&queue->not_empty);
+            pthread_cond_broadcast(&queue->not_full);
+            pthread_mutex_unlock(&queue->mutex);
+
+            return NULL;
+        }
+    }
+}
+
+// Make `options->batch` maps with `options->threads` generators and as many
+// writers, reporting throughput when there's more than one map. Returns
+// `false` if any map failed.
+bool run_batch(const Options* options, unsigned long seed)
+{
+    int threads = options->threads;
+
+    BatchQueue queue;
+    pthread_mutex_init(&queue.mutex, NULL);
+    pthread_cond_init(&queue.not_empty, NULL);
+    pthread_cond_init(&queue.not_full, NULL);
+    queue.capacity = 2 * threads; // Bounds how many maps are in memory
+    queue.slots = mem_alloc(MEM_MAP,
+                            (size_t) queue.capacity * sizeof(RoomStore*));
+    queue.head = 0;
+    queue.count = 0;
+    queue.next_to_generate = 0;
+    queue.taken = 0;
+    queue.failed = queue.slots == NULL;
+    queue.options = options;
+    queue.seed = seed;
+
+    pthread_t* generators = mem_alloc(MEM_MAP,
+                                      (size_t) threads * sizeof(pthread_t));
+    pthread_t* writers = mem_alloc(MEM_MAP,
+                                   (size_t) threads * sizeof(pthread_t));
+    int generators_started = 0;
+    int writers_started = 0;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int i;
+    for (i = 0; i < threads && generators != NULL && writers != NULL; ++i)
+    {
+        if (pthread_create(&generators[i], NULL, batch_generator, &queue) == 0)
+        {
+            generators_started++;
+        }
+        if (pthread_create(&writers[i], NULL, batch_writer, &queue) == 0)
+        {
+            writers_started++;
+        }
+    }
+
+    if (generators_started == 0 || writers_started == 0)
+    {
+        fprintf(stderr, "Could not start any batch threads\n");
+        pthread_mutex_lock(&queue.mutex);
+        queue.failed = true;
+        pthread_cond_broadcast(&queue.not_empty);
+        pthread_cond_broadcast(&queue.not_full);
+        pthread_mutex_unlock(&queue.mutex);
+    }
+
+    for (i = 0; i < generators_started; ++i)
+    {
+        pthread_join(generators[i], NULL);
+    }
+    for (i = 0; i < writers_started; ++i)
+    {
+        pthread_join(writers[i], NULL);
+    }
+
+    // Maps that got generated but never written because somebody failed
+    while (queue.count > 0)
+    {
+        _RoomStore(queue.slots[queue.head]);
+        mem_free(queue.slots[queue.head]);
+        queue.head = (queue.head + 1) % queue.capacity;
+        queue.count--;
+    }
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (double) (end.tv_sec - start.tv_sec) +
+                     (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    bool ok = !queue.failed;
+    if (ok && options->batch > 1)
+    {
+        printf(
+            "%d maps of %d rooms in %.3f s on %d threads (%.1f maps/s)\n",
+            options->batch,
+            options->room_count,
+            seconds,
+            threads,
+            (double) options->batch / seconds
+        );
+    }
+
+    mem_free(generators);
+    mem_free(writers);
+    mem_free(queue.slots);
+    pthread_mutex_destroy(&queue.mutex);
+    pthread_cond_destroy(&queue.not_empty);
+    pthread_cond_destroy(&queue.not_full);
+
+    return ok;
+}
+
+// Convert `room_type` enum into its string representation
+const char* room_type_to_str(room_type rt)
+{
+    switch (rt)
+    {
+        case START_ROOM:
+            return "START_ROOM";
+        case MID_ROOM:
+            return "MID_ROOM";
+        case END_ROOM:
+            return "END_ROOM";
+        default:
+            return "wat";
+    }
+}
+
+int main(int argc, char* argv[]) // It used to be `main(void)`, because in C
+                                 // an empty parameter list means "this
+                                 // function takes any number of any kind of
+                                 // thing(!)", which is... awful
+{
+    Options options;
+    if (!parse_args(argc, argv, &options))
+    {
+        return 1;
+    }
+
+    if (options.mem_report)
+    {
+        atexit(print_mem_report);
+    }
+    if (options.trace_path != NULL)
+    {
+        start_trace(options.trace_path);
+        trace_thread_name("main");
+    }
+
+    // One seed for the whole run; every map and dir name is derived from it
+    unsigned long seed = get_process_seed();
+
+    if (options.batch > 1)
+    {
+        return run_batch(&options, seed) ? 0 : 1;
+    }
+    if (options.window > 0)
+    {
+        return run_stream(&options, seed) ? 0 : 1;
+    }
+    if (options.edit_dir != NULL)
+    {
+        return run_edit(&options) ? 0 : 1;
+    }
+
+    // Just the one map, so no need for any threads
+    RoomStore store;
+    if (!initialize_rooms(&store, options.room_count, seed))
+    {
+        return 1;
+    }
+
+    if (!generate_map(&store) || !write_map(&store, &options, seed + 1))
+    {
+        _RoomStore(&store);
+
+        return 1;
+    }
+
+    // Cleanup
+    _RoomStore(&store); // Sometimes you feel thankful for C++
 
     return 0;
 }
@@ -0,0 +1,174 @@
+#include <stdio.h>     // printf, fprintf, fopen, fread
+#include <stdlib.h>    // malloc, free
+#include <string.h>    // memcmp, strerror
+#include <errno.h>     // errno
+#include <time.h>      // localtime, strftime
+
+
+// `typedef`s
+typedef enum {false, true} bool; // Same as the others
+
+#define MAX_ROOM_NAME_LEN 23 // Same as in *.buildrooms.c
+
+// Everything below has to match *.adventure.c
+#define JOURNAL_VERSION 1
+#define JOURNAL_COMMAND_LEN 32
+
+typedef struct JournalRecord
+{
+    unsigned long timestamp_ns;  // Wall clock
+    unsigned int  session;
+    unsigned char code;          // A `step_code`
+    unsigned char padding[3];
+    char          from[MAX_ROOM_NAME_LEN + 1];
+    char          to[MAX_ROOM_NAME_LEN + 1];
+    char          command[JOURNAL_COMMAND_LEN];
+} JournalRecord;
+
+// In `step_code` order
+static const char* const step_code_names[] = {
+    "MOVED",
+    "UNKNOWN",
+    "TIME",
+    "SAVE",
+    "LOAD",
+    "WON",
+    "ERROR",
+    "MEMORY",
+    "OVER"
+};
+
+#define DEFAULT_JOURNAL_PATH "comitoz.journal"
+#define RECORDS_PER_READ 4096
+
+
+// Forward declarations
+bool check_header(FILE* file_handle, const char* path);
+
+void print_record(const JournalRecord* record);
+
+
+// Make sure this is a journal we know how to read. `false` (after saying
+// why) if it isn't
+bool check_header(FILE* file_handle, const char* path)
+{
+    unsigned char header[8];
+    if (fread(header, 1, sizeof(header), file_handle) != sizeof(header))
+    {
+        fprintf(stderr, "\"%s\" is too short to be a journal\n", path);
+
+        return false;
+    }
+
+    if (memcmp(header, "CJNL", 4) != 0 || header[4] != JOURNAL_VERSION)
+    {
+        fprintf(stderr, "\"%s\" is not a version %d journal\n", path,
+                JOURNAL_VERSION);
+
+        return false;
+    }
+    if (header[5] != sizeof(JournalRecord))
+    {
+        fprintf(
+            stderr,
+            "\"%s\" has %d byte records, but we expect %d\n",
+            path,
+            header[5],
+            (int) sizeof(JournalRecord)
+        );
+
+        return false;
+    }
+
+    return true;
+}
+
+// One record per line: when, who, what happened, where they went and what
+// they typed
+void print_record(const JournalRecord* record)
+{
+    time_t seconds = (time_t) (record->timestamp_ns / 1000000000UL);
+    struct tm* time_struct = localtime(&seconds);
+    char time_str[32];
+    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", time_struct);
+
+    const char* code_name =
+        record->code < sizeof(step_code_names) / sizeof(step_code_names[0])
+            ? step_code_names[record->code]
+            : "?";
+
+    printf(
+        "%s.%09lu %u %-7s %s -> %s \"%.*s\"\n",
+        time_str,
+        record->timestamp_ns % 1000000000UL,
+        record->session,
+        code_name,
+        record->from,
+        record->to,
+        JOURNAL_COMMAND_LEN,
+        record->command
+    );
+}
+
+// Dump the journal named on the command line (or the default one) as text
+int main(int argc, char* argv[])
+{
+    if (argc > 2)
+    {
+        fprintf(stderr, "Usage: %s [JOURNAL]\n", argv[0]);
+
+        return 1;
+    }
+    const char* path = argc == 2 ? argv[1] : DEFAULT_JOURNAL_PATH;
+
+    FILE* file_handle = fopen(path, "rb");
+    if (file_handle == NULL)
+    {
+        fprintf(
+            stderr,
+            "fopen(\"%s\", \"rb\") failed with: \"%s\"\n",
+            path,
+            strerror(errno)
+        );
+
+        return 1;
+    }
+
+    if (!check_header(file_handle, path))
+    {
+        fclose(file_handle);
+
+        return 1;
+    }
+
+    JournalRecord* records = malloc(RECORDS_PER_READ * sizeof(JournalRecord));
+    size_t got = fread(records, sizeof(JournalRecord), RECORDS_PER_READ,
+                       file_handle);
+    while (got > 0)
+    {
+        size_t i;
+        for (i = 0; i < got; ++i)
+        {
+            // The fields are fixed size and might be completely full
+            records[i].from[MAX_ROOM_NAME_LEN] = '\0';
+            records[i].to[MAX_ROOM_NAME_LEN] = '\0';
+            print_record(&records[i]);
+        }
+
+        got = fread(records, sizeof(JournalRecord), RECORDS_PER_READ,
+                    file_handle);
+    }
+
+    int result = 0;
+    if (ferror(file_handle))
+    {
+        fprintf(stderr, "Error reading \"%s\"\n", path);
+        result = 1;
+    }
+
+    // Cleanup
+    free(records);
+    fclose(file_handle);
+
+    return result;
+}
@@ -0,0 +1,860 @@
+#include <stdio.h>     // printf, fprintf, fopen, getline
+#include <stdlib.h>    // malloc, realloc, free, qsort, atoi
+#include <string.h>    // strcmp, strstr, strerror, memmove
+#include <sys/types.h> // Types for system functions
+#include <sys/wait.h>  // waitpid
+#include <unistd.h>    // fork, pipe, execv, read, write, close
+#include <poll.h>      // poll
+#include <errno.h>     // errno
+#include <signal.h>    // signal, so a dead child doesn't take us with it
+#include <time.h>      // clock_gettime
+
+
+// `typedef`s
+typedef enum {false, true} bool; // Same as the other two
+
+// Command line knobs
+typedef struct Options
+{
+    int          sessions;     // How many games run at once
+    int          games;        // How many games to play in total
+    int          max_turns;    // Per game, before we give up and hang up
+    int          time_every;   // Ask for the "time" every this many turns
+    char*        binary;
+    const char*  script_path;  // Moves to send instead of random ones
+    unsigned int seed;
+    bool         machine;      // Play over the game's `--machine` protocol
+    int          pipeline;     // How many `--machine` moves can be in flight
+    char**       game_args;    // Passed through to the game, `NULL` ended
+} Options;
+
+// One running game and everything we know about it
+typedef struct Session
+{
+    pid_t  pid;
+    int    to_game;   // Its stdin
+    int    from_game; // Its stdout
+    char*  output;    // What it's said since we last answered it
+    size_t output_len;
+    size_t output_cap;
+    double spawned_at;
+    double sent_at;   // When we sent the last move
+    bool   waiting;   // Whether `sent_at` is a move it hasn't answered yet
+    int    turns;
+    int    script_pos;
+    bool   active;
+    bool   won;       // `--machine` only, since the `W` gets eaten
+    int    degree;    // `--machine`: connections out of the room we're in
+    double* sent_ats; // `--machine`: when each move in flight was sent, as a
+    int    sent_head; // ring of `--pipeline` starting at the oldest
+    int    in_flight;
+} Session;
+
+// A growable pile of latencies, in milliseconds
+typedef struct Samples
+{
+    double* values;
+    int     len;
+    int     cap;
+} Samples;
+
+#define PROMPT "WHERE TO? >"
+#define CONNECTIONS_LABEL "POSSIBLE CONNECTIONS: "
+#define MAX_CONNECTIONS 6
+#define MAX_ROOM_NAME_LEN 23 // Same as in *.buildrooms.c
+#define MAX_PIPELINE 1024
+
+
+// Forward declarations
+bool parse_args(int argc, char* argv[], Options* options);
+
+double now_ms(void);
+
+void add_sample(Samples* samples, double value);
+
+int compare_doubles(const void* a, const void* b);
+
+void print_samples(const char* label, Samples* samples);
+
+char** read_script(const char* path, int* move_count);
+
+bool spawn_session(Session* session, const Options* options);
+
+void end_session(Session* session);
+
+int parse_connections(const char* output, char names[][MAX_ROOM_NAME_LEN + 1]);
+
+bool answer_prompt(
+    Session*       session,
+    const Options* options,
+    char**         script,
+    int            script_len,
+    Samples*       turn_latency
+);
+
+bool answer_records(
+    Session*       session,
+    const Options* options,
+    char**         script,
+    int            script_len,
+    Samples*       startup,
+    Samples*       turn_latency
+);
+
+
+// Fill `options` from the command line, complaining and returning `false` if
+// we got something we don't understand. Everything after "--" goes to the game
+bool parse_args(int argc, char* argv[], Options* options)
+{
+    options->sessions = 8;
+    options->games = 8;
+    options->max_turns = 1000;
+    options->time_every = 0;
+    static char default_binary[] = "./comitoz.adventure";
+    options->binary = default_binary;
+    options->script_path = NULL;
+    options->seed = (unsigned int) time(NULL);
+    options->machine = false;
+    options->pipeline = 1;
+    options->game_args = NULL;
+
+    bool games_given = false;
+
+    int i;
+    for (i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--") == 0)
+        {
+            options->game_args = &argv[i + 1];
+
+            break;
+        }
+        else if (strcmp(argv[i], "--sessions") == 0 && i + 1 < argc)
+        {
+            options->sessions = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--games") == 0 && i + 1 < argc)
+        {
+            options->games = atoi(argv[++i]);
+            games_given = true;
+        }
+        else if (strcmp(argv[i], "--turns") == 0 && i + 1 < argc)
+        {
+            options->max_turns = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--time-every") == 0 && i + 1 < argc)
+        {
+            options->time_every = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--binary") == 0 && i + 1 < argc)
+        {
+            options->binary = argv[++i];
+        }
+        else if (strcmp(argv[i], "--script") == 0 && i + 1 < argc)
+        {
+            options->script_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+        {
+            options->seed = (unsigned int) atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--machine") == 0)
+        {
+            options->machine = true;
+        }
+        else if (strcmp(argv[i], "--pipeline") == 0 && i + 1 < argc)
+        {
+            options->pipeline = atoi(argv[++i]);
+        }
+        else
+        {
+            fprintf(
+                stderr,
+                "Unrecognized argument: %s\n"
+                "Usage: %s [--sessions N] [--games N] [--turns N]\n"
+                "       [--time-every N] [--binary PATH] [--script FILE]\n"
+                "       [--seed N] [--machine [--pipeline N]]\n"
+                "       [-- GAME ARGS...]\n",
+                argv[i],
+                argv[0]
+            );
+
+            return false;
+        }
+    }
+
+    if (!games_given)
+    {
+        options->games = options->sessions; // One game per session, then
+    }
+    if (options->sessions < 1 || options->games < 1 || options->max_turns < 1)
+    {
+        fprintf(stderr, "--sessions, --games and --turns must be positive\n");
+
+        return false;
+    }
+    if (options->pipeline < 1 || options->pipeline > MAX_PIPELINE)
+    {
+        fprintf(stderr, "--pipeline takes 1 to %d moves\n", MAX_PIPELINE);
+
+        return false;
+    }
+    if (options->machine && options->time_every > 0)
+    {
+        fprintf(stderr, "--machine games don't tell the time\n");
+
+        return false;
+    }
+
+    return true;
+}
+
+// Monotonic milliseconds, for timing things
+double now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double) now.tv_sec * 1e3 + (double) now.tv_nsec / 1e6;
+}
+
+// Add a latency to the pile
+void add_sample(Samples* samples, double value)
+{
+    if (samples->len >= samples->cap)
+    {
+        samples->cap = samples->cap == 0 ? 256 : samples->cap * 2;
+        samples->values = realloc(
+            samples->values,
+            (size_t) samples->cap * sizeof(double)
+        );
+    }
+
+    samples->values[samples->len++] = value;
+}
+
+// `qsort` comparator for `double`s
+int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+
+    return (x > y) - (x < y);
+}
+
+// Sort the samples and print the interesting percentiles
+void print_samples(const char* label, Samples* samples)
+{
+    if (samples->len == 0)
+    {
+        printf("%-8s (none)\n", label);
+
+        return;
+    }
+
+    qsort(samples->values, (size_t) samples->len, sizeof(double),
+          compare_doubles);
+
+    double sum = 0;
+    int i;
+    for (i = 0; i < samples->len; ++i)
+    {
+        sum += samples->values[i];
+    }
+
+    // Nearest-rank percentiles
+    int n = samples->len;
+    printf(
+        "%-8s n=%-8d mean %8.3f  p50 %8.3f  p90 %8.3f  p99 %8.3f  "
+        "max %8.3f ms\n",
+        label,
+        n,
+        sum / n,
+        samples->values[(n - 1) * 50 / 100],
+        samples->values[(n - 1) * 90 / 100],
+        samples->values[(n - 1) * 99 / 100],
+        samples->values[n - 1]
+    );
+}
+
+// Read a script of moves, one per line. Returns `NULL` on failure
+char** read_script(const char* path, int* move_count)
+{
+    FILE* file_handle = fopen(path, "r");
+    if (file_handle == NULL)
+    {
+        fprintf(
+            stderr,
+            "fopen(\"%s\", \"r\") failed with: \"%s\"\n",
+            path,
+            strerror(errno)
+        );
+
+        return NULL;
+    }
+
+    int cap = 16;
+    char** moves = malloc((size_t) cap * sizeof(char*));
+    *move_count = 0;
+
+    char* line = NULL;
+    size_t line_cap = 0;
+    ssize_t chars_read = getline(&line, &line_cap, file_handle);
+    while (chars_read != -1)
+    {
+        if (chars_read > 0 && line[chars_read - 1] == '\n')
+        {
+            line[--chars_read] = '\0';
+        }
+
+        if (chars_read > 0)
+        {
+            if (*move_count >= cap)
+            {
+                cap *= 2;
+                moves = realloc(moves, (size_t) cap * sizeof(char*));
+            }
+            moves[*move_count] = malloc((size_t) chars_read + 1);
+            strcpy(moves[*move_count], line);
+            (*move_count)++;
+        }
+
+        chars_read = getline(&line, &line_cap, file_handle);
+    }
+
+    free(line);
+    fclose(file_handle);
+
+    return moves;
+}
+
+// Start a game with its stdin and stdout hooked up to pipes that we hold the
+// other ends of. Returns `false` (after saying why) on failure.
+bool spawn_session(Session* session, const Options* options)
+{
+    int to_game[2];
+    int from_game[2];
+    if (pipe(to_game) == -1)
+    {
+        fprintf(stderr, "pipe() failed with: \"%s\"\n", strerror(errno));
+
+        return false;
+    }
+    if (pipe(from_game) == -1)
+    {
+        fprintf(stderr, "pipe() failed with: \"%s\"\n", strerror(errno));
+        close(to_game[0]);
+        close(to_game[1]);
+
+        return false;
+    }
+
+    session->spawned_at = now_ms();
+
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        fprintf(stderr, "fork() failed with: \"%s\"\n", strerror(errno));
+        close(to_game[0]);
+        close(to_game[1]);
+        close(from_game[0]);
+        close(from_game[1]);
+
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        // In the child: become the game
+        dup2(to_game[0], STDIN_FILENO);
+        dup2(from_game[1], STDOUT_FILENO);
+        close(to_game[0]);
+        close(to_game[1]);
+        close(from_game[0]);
+        close(from_game[1]);
+
+        int arg_count = 0;
+        while (options->game_args != NULL && options->game_args[arg_count])
+        {
+            arg_count++;
+        }
+
+        char** argv = malloc((size_t) (arg_count + 3) * sizeof(char*));
+        argv[0] = options->binary;
+        int i;
+        for (i = 0; i < arg_count; ++i)
+        {
+            argv[i + 1] = options->game_args[i];
+        }
+        static char machine_arg[] = "--machine";
+        argv[arg_count + 1] = options->machine ? machine_arg : NULL;
+        argv[arg_count + 2] = NULL;
+
+        execv(options->binary, argv);
+        fprintf(
+            stderr,
+            "execv(\"%s\") failed with: \"%s\"\n",
+            options->binary,
+            strerror(errno)
+        );
+        _exit(127);
+    }
+
+    close(to_game[0]);
+    close(from_game[1]);
+
+    session->pid = pid;
+    session->to_game = to_game[1];
+    session->from_game = from_game[0];
+    session->output_len = 0;
+    session->waiting = false;
+    session->turns = 0;
+    session->script_pos = 0;
+    session->active = true;
+    session->won = false;
+    session->degree = 0;
+    session->sent_head = 0;
+    session->in_flight = 0;
+
+    return true;
+}
+
+// Hang up on a game and wait for it to go away
+void end_session(Session* session)
+{
+    if (session->to_game != -1)
+    {
+        close(session->to_game);
+        session->to_game = -1;
+    }
+    close(session->from_game);
+    session->from_game = -1;
+
+    int status;
+    waitpid(session->pid, &status, 0);
+    session->active = false;
+}
+
+// Pull the names out of the last "POSSIBLE CONNECTIONS: a, b, c." line in
+// `output`, returning how many there were
+int parse_connections(const char* output, char names[][MAX_ROOM_NAME_LEN + 1])
+{
+    const char* line = NULL;
+    const char* found = strstr(output, CONNECTIONS_LABEL);
+    while (found != NULL)
+    {
+        line = found;
+        found = strstr(found + 1, CONNECTIONS_LABEL);
+    }
+    if (line == NULL)
+    {
+        return 0;
+    }
+
+    line += strlen(CONNECTIONS_LABEL);
+    int count = 0;
+    while (count < MAX_CONNECTIONS)
+    {
+        size_t len = 0;
+        while (
+            line[len] != ',' && line[len] != '.' &&
+            line[len] != '\n' && line[len] != '\0' &&
+            len < MAX_ROOM_NAME_LEN
+        ) {
+            len++;
+        }
+        memcpy(names[count], line, len);
+        names[count][len] = '\0';
+        count++;
+
+        if (line[len] != ',')
+        {
+            break;
+        }
+        line += len + 2; // Past ", "
+    }
+
+    return count;
+}
+
+// The game is waiting for us, so tell it where to go next. Returns `false`
+// if we're done with this game (out of turns, or it hung up on us).
+bool answer_prompt(
+    Session*       session,
+    const Options* options,
+    char**         script,
+    int            script_len,
+    Samples*       turn_latency
+) {
+    double now = now_ms();
+    if (session->waiting)
+    {
+        add_sample(turn_latency, now - session->sent_at);
+        session->waiting = false;
+    }
+
+    if (session->turns >= options->max_turns)
+    {
+        return false;
+    }
+
+    char move[MAX_ROOM_NAME_LEN + 2];
+    if (options->time_every > 0 && session->turns % options->time_every ==
+        options->time_every - 1)
+    {
+        strcpy(move, "time");
+    }
+    else if (script != NULL)
+    {
+        strncpy(move, script[session->script_pos % script_len],
+                MAX_ROOM_NAME_LEN);
+        move[MAX_ROOM_NAME_LEN] = '\0';
+        session->script_pos++;
+    }
+    else
+    {
+        char names[MAX_CONNECTIONS][MAX_ROOM_NAME_LEN + 1];
+        int count = parse_connections(session->output, names);
+        if (count == 0)
+        {
+            fprintf(stderr, "Session %d: no connections in the prompt\n",
+                    (int) session->pid);
+
+            return false;
+        }
+        strcpy(move, names[rand() % count]);
+    }
+
+    size_t len = strlen(move);
+    move[len++] = '\n';
+
+    session->output_len = 0;
+    session->output[0] = '\0';
+    session->turns++;
+    session->sent_at = now_ms();
+    session->waiting = true;
+
+    return write(session->to_game, move, len) == (ssize_t) len;
+}
+
+// Eat every complete `--machine` record the game has sent, then top up the
+// moves in flight to `--pipeline`. Moves are random connection indexes (or
+// the script's lines, verbatim), picked from the newest room we know about,
+// which is stale once there's more than one in flight; the game just says
+// `X` to those. Returns `false` if we're done with this game.
+bool answer_records(
+    Session*       session,
+    const Options* options,
+    char**         script,
+    int            script_len,
+    Samples*       startup,
+    Samples*       turn_latency
+) {
+    double now = now_ms();
+    size_t start = 0;
+    char* newline;
+    while (
+        (newline = memchr(&session->output[start], '\n',
+                          session->output_len - start)) != NULL
+    ) {
+        const char* record = &session->output[start];
+        start = (size_t) (newline - session->output) + 1;
+
+        if (session->turns == 0)
+        {
+            add_sample(startup, now - session->spawned_at); // The first `R`
+        }
+        else if (session->in_flight > 0)
+        {
+            add_sample(turn_latency,
+                       now - session->sent_ats[session->sent_head]);
+            session->sent_head = (session->sent_head + 1) % options->pipeline;
+            session->in_flight--;
+        }
+
+        if (record[0] == 'W')
+        {
+            session->won = true;
+        }
+        else if (record[0] == 'R')
+        {
+            // "R <id> <type> <n> ..."
+            int degree = 0;
+            if (sscanf(record, "R %*d %*c %d", &degree) == 1)
+            {
+                session->degree = degree;
+            }
+        }
+    }
+    session->output_len -= start;
+    memmove(session->output, &session->output[start], session->output_len);
+    session->output[session->output_len] = '\0';
+
+    if (session->won)
+    {
+        return true; // It'll hang up on its own
+    }
+    if (session->degree == 0)
+    {
+        fprintf(stderr, "Session %d: no connections in the record\n",
+                (int) session->pid);
+
+        return false;
+    }
+
+    // Everything we send this time goes in one `write`
+    char moves[MAX_PIPELINE * (MAX_ROOM_NAME_LEN + 2)];
+    size_t len = 0;
+    while (
+        session->in_flight < options->pipeline &&
+        session->turns < options->max_turns
+    ) {
+        if (script != NULL)
+        {
+            const char* move = script[session->script_pos % script_len];
+            size_t move_len = strlen(move);
+            if (move_len > MAX_ROOM_NAME_LEN)
+            {
+                move_len = MAX_ROOM_NAME_LEN;
+            }
+            memcpy(&moves[len], move, move_len);
+            len += move_len;
+            session->script_pos++;
+        }
+        else
+        {
+            len += (size_t) sprintf(&moves[len], "%d",
+                                    rand() % session->degree);
+        }
+        moves[len++] = '\n';
+
+        int slot = (session->sent_head + session->in_flight++) %
+                   options->pipeline;
+        session->sent_ats[slot] = now;
+        session->turns++;
+    }
+
+    if (session->in_flight == 0)
+    {
+        return false; // Out of turns
+    }
+
+    return len == 0 || write(session->to_game, moves, len) == (ssize_t) len;
+}
+
+// Start up to `--sessions` games at once, keep starting them until we've
+// played `--games`, and answer every prompt as it comes. Then tell everyone
+// how it went.
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parse_args(argc, argv, &options))
+    {
+        return 1;
+    }
+
+    srand(options.seed);
+    signal(SIGPIPE, SIG_IGN); // A game quitting on us is not our problem
+
+    char** script = NULL;
+    int script_len = 0;
+    if (options.script_path != NULL)
+    {
+        script = read_script(options.script_path, &script_len);
+        if (script == NULL || script_len == 0)
+        {
+            fprintf(stderr, "Nothing to do in %s\n", options.script_path);
+
+            return 1;
+        }
+    }
+
+    Session* sessions = calloc((size_t) options.sessions, sizeof(Session));
+    struct pollfd* fds = malloc((size_t) options.sessions *
+                                sizeof(struct pollfd));
+    int* fd_owner = malloc((size_t) options.sessions * sizeof(int));
+
+    Samples startup = {NULL, 0, 0};
+    Samples turn_latency = {NULL, 0, 0};
+    int games_started = 0;
+    int games_finished = 0;
+    int games_won = 0;
+    long total_turns = 0;
+
+    double started_at = now_ms();
+
+    int i;
+    for (i = 0; i < options.sessions; ++i)
+    {
+        sessions[i].output_cap = 4096;
+        sessions[i].output = malloc(sessions[i].output_cap);
+        sessions[i].sent_ats = malloc((size_t) options.pipeline *
+                                      sizeof(double));
+        sessions[i].active = false;
+        sessions[i].to_game = -1;
+        sessions[i].from_game = -1;
+    }
+
+    for (;;)
+    {
+        // Keep every slot busy while there are games left to play
+        for (i = 0; i < options.sessions; ++i)
+        {
+            if (!sessions[i].active && games_started < options.games)
+            {
+                if (!spawn_session(&sessions[i], &options))
+                {
+                    games_started = options.games; // Stop trying
+
+                    break;
+                }
+                sessions[i].output[0] = '\0';
+                games_started++;
+            }
+        }
+
+        int fd_count = 0;
+        for (i = 0; i < options.sessions; ++i)
+        {
+            if (sessions[i].active)
+            {
+                fds[fd_count].fd = sessions[i].from_game;
+                fds[fd_count].events = POLLIN;
+                fd_owner[fd_count] = i;
+                fd_count++;
+            }
+        }
+        if (fd_count == 0)
+        {
+            break;
+        }
+
+        if (poll(fds, (nfds_t) fd_count, -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            fprintf(stderr, "poll() failed with: \"%s\"\n", strerror(errno));
+
+            break;
+        }
+
+        int f;
+        for (f = 0; f < fd_count; ++f)
+        {
+            if (fds[f].revents == 0)
+            {
+                continue;
+            }
+
+            Session* session = &sessions[fd_owner[f]];
+            if (session->output_len + 1024 + 1 > session->output_cap)
+            {
+                session->output_cap *= 2;
+                session->output = realloc(session->output,
+                                          session->output_cap);
+            }
+
+            ssize_t got = read(
+                session->from_game,
+                &session->output[session->output_len],
+                1024
+            );
+            if (got <= 0)
+            {
+                // Game over, one way or another. It only counts as a win if
+                // we didn't hang up first
+                if (
+                    session->to_game != -1 &&
+                    (session->won ||
+                     strstr(session->output, "CONGRATULATIONS") != NULL)
+                )
+                {
+                    games_won++;
+                }
+                total_turns += session->turns;
+                games_finished++;
+                end_session(session);
+
+                continue;
+            }
+
+            session->output_len += (size_t) got;
+            session->output[session->output_len] = '\0';
+
+            if (options.machine)
+            {
+                if (
+                    session->to_game != -1 &&
+                    !answer_records(session, &options, script, script_len,
+                                    &startup, &turn_latency)
+                ) {
+                    close(session->to_game);
+                    session->to_game = -1;
+                }
+
+                continue;
+            }
+
+            size_t prompt_len = strlen(PROMPT);
+            if (
+                session->output_len >= prompt_len &&
+                strcmp(&session->output[session->output_len - prompt_len],
+                       PROMPT) == 0
+            ) {
+                if (!session->waiting && session->turns == 0)
+                {
+                    add_sample(&startup, now_ms() - session->spawned_at);
+                }
+
+                if (
+                    !answer_prompt(session, &options, script, script_len,
+                                   &turn_latency)
+                ) {
+                    // Hanging up makes the game see EOF and wrap up
+                    close(session->to_game);
+                    session->to_game = -1;
+                }
+            }
+        }
+    }
+
+    double elapsed = now_ms() - started_at;
+
+    printf(
+        "%d games (%d won) over %d sessions, %ld turns in %.3f s\n",
+        games_finished,
+        games_won,
+        options.sessions,
+        total_turns,
+        elapsed / 1e3
+    );
+    printf(
+        "Throughput: %.1f turns/s, %.1f games/s\n",
+        (double) total_turns / (elapsed / 1e3),
+        (double) games_finished / (elapsed / 1e3)
+    );
+    print_samples("Startup", &startup);
+    print_samples("Turn", &turn_latency);
+
+    // Cleanup
+    for (i = 0; i < options.sessions; ++i)
+    {
+        free(sessions[i].output);
+        free(sessions[i].sent_ats);
+    }
+    for (i = 0; i < script_len; ++i)
+    {
+        free(script[i]);
+    }
+    free(script);
+    free(sessions);
+    free(fds);
+    free(fd_owner);
+    free(startup.values);
+    free(turn_latency.values);
+
+    return 0;
+}
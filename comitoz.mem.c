@@ -0,0 +1,351 @@
+#include <stdlib.h> // malloc, calloc, realloc, free, strtoull, exit
+#include <stdio.h>  // fprintf, snprintf, fgets, fputs
+#include <string.h> // strchr, strlen, strncmp
+#include "comitoz.mem.h"
+
+
+// `typedef`s
+// Goes in front of every block, and `mem_free` takes it from there
+typedef struct MemHeader
+{
+    size_t size;
+    size_t category; // A whole `size_t` so the block after us stays aligned
+} MemHeader;
+
+// Updated atomically, since threads allocate too
+typedef struct MemStats
+{
+    size_t        current[MEM_CATEGORY_COUNT];
+    size_t        peak[MEM_CATEGORY_COUNT];
+    size_t        budget[MEM_CATEGORY_COUNT]; // 0 means no limit
+    unsigned long allocations[MEM_CATEGORY_COUNT];
+    size_t        total;
+    size_t        total_peak;
+    size_t        total_budget;
+    unsigned long refused[MEM_CATEGORY_COUNT]; // Allocations over budget
+} MemStats;
+
+static MemStats mem_stats;
+
+static const char* const mem_category_names[] = {
+    "map",
+    "strings",
+    "session",
+    "io"
+};
+
+
+// Forward declarations
+void mem_raise_peak(size_t* peak, size_t value);
+
+bool mem_charge(size_t category, size_t size);
+
+void mem_refund(size_t category, size_t size);
+
+
+// Bump `*peak` up to `value` if that's higher, racing other threads fairly
+void mem_raise_peak(size_t* peak, size_t value)
+{
+    size_t seen = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while (
+        value > seen &&
+        !__atomic_compare_exchange_n(peak, &seen, value, true,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+    ) {
+    }
+}
+
+// Count `size` more bytes in `category`. `false` if that would put it (or
+// the total) over budget, in which case nothing is counted and the caller
+// has to fail the allocation. The first refusal in each category is
+// reported, since the callers' own complaints don't say it was the budget
+bool mem_charge(size_t category, size_t size)
+{
+    size_t now = __atomic_add_fetch(&mem_stats.current[category], size,
+                                    __ATOMIC_RELAXED);
+    size_t total = __atomic_add_fetch(&mem_stats.total, size,
+                                      __ATOMIC_RELAXED);
+
+    size_t budget = mem_stats.budget[category];
+    if (
+        (budget != 0 && now > budget) ||
+        (mem_stats.total_budget != 0 && total > mem_stats.total_budget)
+    ) {
+        mem_refund(category, size);
+        if (
+            __atomic_add_fetch(&mem_stats.refused[category], 1,
+                               __ATOMIC_RELAXED) == 1
+        ) {
+            bool total_over = budget == 0 || now <= budget;
+            fprintf(
+                stderr,
+                "Out of memory budget: %zu more bytes would put %s at %zu, "
+                "over its %zu, so that %s allocation fails (and so will any "
+                "others that don't fit)\n",
+                size,
+                total_over ? "the total" : mem_category_names[category],
+                total_over ? total : now,
+                total_over ? mem_stats.total_budget : budget,
+                mem_category_names[category]
+            );
+        }
+
+        return false;
+    }
+
+    mem_raise_peak(&mem_stats.peak[category], now);
+    mem_raise_peak(&mem_stats.total_peak, total);
+
+    return true;
+}
+
+// Stop counting `size` bytes in `category`
+void mem_refund(size_t category, size_t size)
+{
+    __atomic_sub_fetch(&mem_stats.current[category], size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&mem_stats.total, size, __ATOMIC_RELAXED);
+}
+
+// `malloc`, but counted against `category`
+void* mem_alloc(mem_category category, size_t size)
+{
+    if (size > (size_t) -1 - sizeof(MemHeader))
+    {
+        return NULL;
+    }
+
+    if (!mem_charge(category, size))
+    {
+        return NULL;
+    }
+
+    MemHeader* header = malloc(sizeof(MemHeader) + size);
+    if (header == NULL)
+    {
+        mem_refund(category, size);
+
+        return NULL;
+    }
+
+    header->size = size;
+    header->category = category;
+    __atomic_add_fetch(&mem_stats.allocations[category], 1, __ATOMIC_RELAXED);
+
+    return header + 1;
+}
+
+// `calloc`, but counted against `category`
+void* mem_calloc(mem_category category, size_t count, size_t size)
+{
+    if (size != 0 && count > ((size_t) -1 - sizeof(MemHeader)) / size)
+    {
+        return NULL;
+    }
+
+    if (!mem_charge(category, count * size))
+    {
+        return NULL;
+    }
+
+    MemHeader* header = calloc(1, sizeof(MemHeader) + count * size);
+    if (header == NULL)
+    {
+        mem_refund(category, count * size);
+
+        return NULL;
+    }
+
+    header->size = count * size;
+    header->category = category;
+    __atomic_add_fetch(&mem_stats.allocations[category], 1, __ATOMIC_RELAXED);
+
+    return header + 1;
+}
+
+// `realloc`. A block stays in whatever category it started in, so
+// `category` only matters when `ptr` is `NULL`
+void* mem_realloc(mem_category category, void* ptr, size_t size)
+{
+    if (ptr == NULL)
+    {
+        return mem_alloc(category, size);
+    }
+    if (size > (size_t) -1 - sizeof(MemHeader))
+    {
+        return NULL;
+    }
+
+    MemHeader* header = (MemHeader*) ptr - 1;
+    size_t old_size = header->size;
+    size_t block_category = header->category;
+    if (size > old_size && !mem_charge(block_category, size - old_size))
+    {
+        return NULL; // Leaving `ptr` alone, like `realloc` does
+    }
+
+    header = realloc(header, sizeof(MemHeader) + size);
+    if (header == NULL)
+    {
+        if (size > old_size)
+        {
+            mem_refund(block_category, size - old_size);
+        }
+
+        return NULL;
+    }
+
+    header->size = size;
+    if (size < old_size)
+    {
+        mem_refund(block_category, old_size - size);
+    }
+    __atomic_add_fetch(&mem_stats.allocations[block_category], 1,
+                       __ATOMIC_RELAXED);
+
+    return header + 1;
+}
+
+// `free`, for anything from the above
+void mem_free(void* ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    MemHeader* header = (MemHeader*) ptr - 1;
+    mem_refund(header->category, header->size);
+    free(header);
+}
+
+// `getline`, but with a buffer from `mem_alloc` (in `MEM_IO`), since the
+// real one `malloc`s behind our back. -1 at the end of the file or if we run
+// out of memory, which `feof` can tell apart
+ssize_t mem_getline(char** line, size_t* cap, FILE* file_handle)
+{
+    if (*line == NULL)
+    {
+        *cap = 128;
+        *line = mem_alloc(MEM_IO, *cap);
+        if (*line == NULL)
+        {
+            return -1;
+        }
+    }
+
+    size_t len = 0;
+    for (;;)
+    {
+        if (fgets(&(*line)[len], (int) (*cap - len), file_handle) == NULL)
+        {
+            return len > 0 ? (ssize_t) len : -1;
+        }
+
+        // A NUL at the start of what `fgets` read hides the rest of it, so
+        // what's visible so far is all the line we get
+        size_t added = strlen(&(*line)[len]);
+        len += added;
+        if (added == 0 || (*line)[len - 1] == '\n')
+        {
+            return (ssize_t) len;
+        }
+
+        // Didn't fit, so make room and keep reading where we left off
+        char* bigger = mem_realloc(MEM_IO, *line, *cap * 2);
+        if (bigger == NULL)
+        {
+            return -1;
+        }
+        *line = bigger;
+        *cap *= 2;
+    }
+}
+
+// Take a `--mem-budget` argument, which is CATEGORY=BYTES with an optional
+// K, M or G on the end (CATEGORY can also be "total"). `false` (after
+// saying why) if it doesn't make sense
+bool parse_mem_budget(const char* arg)
+{
+    const char* equals = strchr(arg, '=');
+    char* end = NULL;
+    unsigned long long bytes = equals == NULL
+                                   ? 0 : strtoull(equals + 1, &end, 10);
+    if (end != NULL && (*end == 'K' || *end == 'M' || *end == 'G'))
+    {
+        bytes <<= *end == 'K' ? 10 : *end == 'M' ? 20 : 30;
+        end++;
+    }
+    if (equals == NULL || end == equals + 1 || *end != '\0' || bytes == 0)
+    {
+        fprintf(stderr, "--mem-budget takes CATEGORY=BYTES[K|M|G], not %s\n",
+                arg);
+
+        return false;
+    }
+
+    size_t name_len = (size_t) (equals - arg);
+    if (name_len == 5 && strncmp(arg, "total", 5) == 0)
+    {
+        mem_stats.total_budget = (size_t) bytes;
+
+        return true;
+    }
+
+    int i;
+    for (i = 0; i < MEM_CATEGORY_COUNT; ++i)
+    {
+        if (
+            strlen(mem_category_names[i]) == name_len &&
+            strncmp(arg, mem_category_names[i], name_len) == 0
+        ) {
+            mem_stats.budget[i] = (size_t) bytes;
+
+            return true;
+        }
+    }
+
+    fprintf(stderr, "No memory category called %.*s (there's map, strings, "
+                    "session, io and total)\n", (int) name_len, arg);
+
+    return false;
+}
+
+// Write a table of what's in use, the peaks and how many allocations each
+// category has seen into `buffer`, which needs `MEM_REPORT_LEN` bytes.
+// Returns the length
+size_t format_mem_report(char* buffer)
+{
+    int len = snprintf(buffer, MEM_REPORT_LEN, "%-8s %12s %12s %12s\n",
+                       "Memory", "In use", "Peak", "Allocations");
+    int i;
+    for (i = 0; i < MEM_CATEGORY_COUNT; ++i)
+    {
+        len += snprintf(
+            &buffer[len],
+            MEM_REPORT_LEN - (size_t) len,
+            "%-8s %12zu %12zu %12lu\n",
+            mem_category_names[i],
+            __atomic_load_n(&mem_stats.current[i], __ATOMIC_RELAXED),
+            __atomic_load_n(&mem_stats.peak[i], __ATOMIC_RELAXED),
+            __atomic_load_n(&mem_stats.allocations[i], __ATOMIC_RELAXED)
+        );
+    }
+    len += snprintf(
+        &buffer[len],
+        MEM_REPORT_LEN - (size_t) len,
+        "%-8s %12zu %12zu\n",
+        "total",
+        __atomic_load_n(&mem_stats.total, __ATOMIC_RELAXED),
+        __atomic_load_n(&mem_stats.total_peak, __ATOMIC_RELAXED)
+    );
+
+    return (size_t) len;
+}
+
+// The same table on stderr. `atexit` calls this for `--mem-report`
+void print_mem_report(void)
+{
+    char buffer[MEM_REPORT_LEN];
+    format_mem_report(buffer);
+    fputs(buffer, stderr);
+}
@@ -0,0 +1,49 @@
+// Memory accounting, for *.adventure.c and *.buildrooms.c alike, so the
+// reports from the two line up
+#ifndef COMITOZ_MEM_H
+#define COMITOZ_MEM_H
+
+#include <stdio.h>     // FILE, for `mem_getline`
+#include <sys/types.h> // ssize_t, ditto
+
+
+typedef enum {false, true} bool; // tfw no C99
+
+// Everything we allocate goes through `mem_alloc` and friends, which tag it
+// with what it's for and keep running totals, so we can tell what a map or a
+// session actually costs. Each block starts with a header that remembers its
+// size and category, so `mem_free` doesn't have to be told. The counts are
+// of the bytes asked for, without the headers. Any category (or the total)
+// can have a budget, and an allocation that would go over it fails (returns
+// `NULL`) just as if `malloc` had, so callers handle it the same way and can
+// decide for themselves whether to give up, instead of the OOM killer
+// deciding later without saying why.
+typedef enum
+{
+    MEM_MAP,     // Rooms, caches, map stores and their scratch space
+    MEM_STRINGS, // Room names, connection names and prompts
+    MEM_SESSION, // Players' paths and everything else per player
+    MEM_IO,      // Line, output, checkpoint and journal buffers
+    MEM_CATEGORY_COUNT
+} mem_category;
+
+#define MEM_REPORT_LEN 512 // Enough for `format_mem_report`
+
+
+void* mem_alloc(mem_category category, size_t size);
+
+void* mem_calloc(mem_category category, size_t count, size_t size);
+
+void* mem_realloc(mem_category category, void* ptr, size_t size);
+
+void mem_free(void* ptr);
+
+ssize_t mem_getline(char** line, size_t* cap, FILE* file_handle);
+
+bool parse_mem_budget(const char* arg);
+
+size_t format_mem_report(char* buffer);
+
+void print_mem_report(void);
+
+#endif
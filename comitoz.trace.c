@@ -0,0 +1,245 @@
+#include <stdlib.h>      // atexit
+#include <stdio.h>       // fopen, fclose, fprintf
+#include <string.h>      // strerror
+#include <errno.h>       // errno
+#include <time.h>        // clock_gettime
+#include <unistd.h>      // getpid
+#include <sys/syscall.h> // SYS_gettid
+#include "comitoz.mem.h"
+#include "comitoz.trace.h"
+
+
+// `typedef`s
+typedef struct TraceEvent
+{
+    const char*   name;  // Always a string literal
+    unsigned long ns;    // Since tracing started
+    char          phase; // 'B'egin or 'E'nd, as Chrome spells them
+} TraceEvent;
+
+typedef struct TraceBuffer
+{
+    TraceEvent*         events;
+    int                 count;
+    int                 cap;
+    int                 tid;
+    const char*         thread_name;
+    unsigned long       dropped; // Events past `TRACE_MAX_EVENTS`
+    struct TraceBuffer* next;
+} TraceBuffer;
+
+#define TRACE_MAX_EVENTS (1 << 20) // Per thread, so a long game can't run
+                                   // us out of memory
+
+static const char*          trace_path = NULL; // `NULL` means we're not
+static unsigned long        trace_start_ns;
+static TraceBuffer*         trace_buffers = NULL; // Everyone's, newest first
+static __thread TraceBuffer* trace_buffer = NULL; // This thread's
+
+
+// Forward declarations
+unsigned long trace_now_ns(void);
+
+TraceBuffer* get_trace_buffer(void);
+
+void trace_event(const char* name, char phase);
+
+void write_trace(void);
+
+
+// The monotonic clock in nanoseconds
+unsigned long trace_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (unsigned long) now.tv_sec * 1000000000UL +
+           (unsigned long) now.tv_nsec;
+}
+
+// Turn tracing on, to be written to `path` at exit. Call this before any
+// threads start
+void start_trace(const char* path)
+{
+    trace_path = path;
+    trace_start_ns = trace_now_ns();
+    atexit(write_trace);
+}
+
+// This thread's buffer, set up and chained on if it doesn't have one yet.
+// `NULL` if we're out of memory, in which case this thread goes untraced
+TraceBuffer* get_trace_buffer(void)
+{
+    if (trace_buffer != NULL)
+    {
+        return trace_buffer;
+    }
+
+    TraceBuffer* buffer = mem_calloc(MEM_IO, 1, sizeof(TraceBuffer));
+    if (buffer == NULL)
+    {
+        return NULL;
+    }
+    buffer->cap = 256;
+    buffer->events = mem_alloc(MEM_IO,
+                               (size_t) buffer->cap * sizeof(TraceEvent));
+    if (buffer->events == NULL)
+    {
+        mem_free(buffer);
+
+        return NULL;
+    }
+    buffer->tid = (int) syscall(SYS_gettid);
+    buffer->thread_name = "thread";
+
+    buffer->next = __atomic_load_n(&trace_buffers, __ATOMIC_RELAXED);
+    while (
+        !__atomic_compare_exchange_n(&trace_buffers, &buffer->next, buffer,
+                                     true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)
+    ) {
+    }
+    trace_buffer = buffer;
+
+    return buffer;
+}
+
+// What this thread is called in the trace
+void trace_thread_name(const char* name)
+{
+    if (trace_path == NULL)
+    {
+        return;
+    }
+
+    TraceBuffer* buffer = get_trace_buffer();
+    if (buffer != NULL)
+    {
+        buffer->thread_name = name;
+    }
+}
+
+// Record that `name` began or ended (`phase` is 'B' or 'E') just now
+void trace_event(const char* name, char phase)
+{
+    unsigned long now = trace_now_ns();
+    TraceBuffer* buffer = get_trace_buffer();
+    if (buffer == NULL)
+    {
+        return;
+    }
+
+    if (buffer->count >= buffer->cap)
+    {
+        TraceEvent* bigger = buffer->cap < TRACE_MAX_EVENTS
+            ? mem_realloc(MEM_IO, buffer->events,
+                          (size_t) buffer->cap * 2 * sizeof(TraceEvent))
+            : NULL;
+        if (bigger == NULL)
+        {
+            buffer->dropped++;
+
+            return;
+        }
+        buffer->events = bigger;
+        buffer->cap *= 2;
+    }
+
+    TraceEvent* event = &buffer->events[buffer->count++];
+    event->name = name;
+    event->ns = now - trace_start_ns;
+    event->phase = phase;
+}
+
+// Mark the start of `name` on this thread's timeline
+void trace_begin(const char* name)
+{
+    if (trace_path != NULL)
+    {
+        trace_event(name, 'B');
+    }
+}
+
+// Mark the end of `name`, which had better be the last thing that began
+void trace_end(const char* name)
+{
+    if (trace_path != NULL)
+    {
+        trace_event(name, 'E');
+    }
+}
+
+// Write every thread's events to `trace_path` and let the buffers go.
+// `atexit` calls this, once every thread we care about is done
+void write_trace(void)
+{
+    FILE* file_handle = fopen(trace_path, "w");
+    if (file_handle == NULL)
+    {
+        fprintf(
+            stderr,
+            "fopen(\"%s\", \"w\") failed with: \"%s\"\n",
+            trace_path,
+            strerror(errno)
+        );
+
+        return;
+    }
+
+    int pid = (int) getpid();
+    unsigned long dropped = 0;
+    const char* separator = "";
+    fprintf(file_handle, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    TraceBuffer* buffer = __atomic_load_n(&trace_buffers, __ATOMIC_ACQUIRE);
+    while (buffer != NULL)
+    {
+        // Names go on the rows, so threads are easy to tell apart
+        fprintf(
+            file_handle,
+            "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+            "\"args\":{\"name\":\"%s\"}}",
+            separator,
+            pid,
+            buffer->tid,
+            buffer->thread_name
+        );
+        separator = ",\n";
+
+        int i;
+        for (i = 0; i < buffer->count; ++i)
+        {
+            const TraceEvent* event = &buffer->events[i];
+            fprintf(
+                file_handle,
+                ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lu.%03lu,"
+                "\"pid\":%d,\"tid\":%d}",
+                event->name,
+                event->phase,
+                event->ns / 1000,
+                event->ns % 1000,
+                pid,
+                buffer->tid
+            );
+        }
+        dropped += buffer->dropped;
+
+        TraceBuffer* next = buffer->next;
+        mem_free(buffer->events);
+        mem_free(buffer);
+        buffer = next;
+    }
+    trace_buffers = NULL;
+    trace_buffer = NULL;
+
+    fprintf(file_handle, "\n]}\n");
+    if (fclose(file_handle) != 0)
+    {
+        fprintf(stderr, "Writing \"%s\" failed with: \"%s\"\n", trace_path,
+                strerror(errno));
+    }
+    if (dropped > 0)
+    {
+        fprintf(stderr, "The trace is missing %lu events that didn't fit\n",
+                dropped);
+    }
+}
@@ -0,0 +1,22 @@
+// Chrome trace-event recording, for *.adventure.c and *.buildrooms.c alike
+#ifndef COMITOZ_TRACE_H
+#define COMITOZ_TRACE_H
+
+
+// `--trace FILE` records when the interesting phases of a run begin and end,
+// and writes them out at exit as Chrome trace-event JSON (load it in
+// chrome://tracing or ui.perfetto.dev). Each thread appends to a buffer of
+// its own, so recording takes no locks; buffers are chained together the
+// first time a thread records anything, so they can still be found after
+// their threads are gone. Without `--trace`, `trace_begin` and `trace_end`
+// are a call, a load and a branch, which is why the calls can stay in for good.
+
+void start_trace(const char* path);
+
+void trace_thread_name(const char* name);
+
+void trace_begin(const char* name);
+
+void trace_end(const char* name);
+
+#endif